@@ -39,9 +39,30 @@
 namespace iodme {
 
 struct buffer {
+	// Frame lifecycle points (see metadata::trace)
+	enum TracePoint {
+		T_POOL_POP,   // receiver got the clean buffer
+		T_FIRST_RECV, // first byte of the frame received
+		T_RX_DONE,    // handed off to the writers
+		T_WR_POP,     // writer picked it up
+		T_WRITE_END,  // data written
+		T_SYNC_END,   // data durable (inline sync only)
+		T_RELEASED,   // returned to the clean queue
+		T_COUNT
+	};
+
 	struct metadata {
+		enum Flags {
+			HAS_CRC = (1<<0) // crc is valid
+		};
+
 		uint64_t seqno;
+		uint64_t timestamp; // frame timestamp (nsec, realtime)
+		uint32_t stream;    // stream index within the generator process
+		uint32_t flags;
+		uint32_t crc;       // CRC32C of the frame data (see iodme/crc32c.hpp)
 		char     name[128];
+		uint64_t trace[T_COUNT]; // lifecycle timestamps (nsec, monotonic), 0 - not reached
 	};
 
 	uint8_t*  base;
@@ -82,7 +103,8 @@ struct buffer {
 		MEMFD    = (1<<1)
 	};
 
-	bool alloc(size_t size, unsigned int flags = 0, const char *filename = 0);
+	// Node >= 0 places (and pre-faults) the memory on that NUMA node
+	bool alloc(size_t size, unsigned int flags = 0, const char *filename = 0, int node = -1);
 	void free();
 	bool add_metadata(metadata& m);
 };
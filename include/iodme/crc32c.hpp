@@ -0,0 +1,64 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_CRC32C_HPP
+#define IODME_CRC32C_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace iodme {
+namespace crc32c {
+
+// CRC-32C (Castagnoli polynomial, same as iSCSI/ext4/btrfs).
+// x86 uses the SSE4.2 crc32 instruction over three interleaved streams
+// that are folded together with PCLMUL, arm64 uses the ARMv8 CRC
+// instructions. Other CPUs get a slicing-by-8 table version.
+// All kernels produce the same values.
+
+// Extend crc with n bytes of data. Start with 0.
+// update(update(0, a), b) is the checksum of a followed by b.
+uint32_t update(uint32_t crc, const void *data, size_t n);
+
+// Checksum of n bytes
+static inline uint32_t compute(const void *data, size_t n)
+{
+	return update(0, data, n);
+}
+
+// Name of the kernel picked for this CPU (eg "sse42-pclmul")
+const char *kernel_name();
+
+} // namespace crc32c
+} // namespace iodme
+
+#endif // IODME_CRC32C_HPP
@@ -0,0 +1,135 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_FILE_SYNCER_HPP
+#define IODME_FILE_SYNCER_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <atomic>
+#include <vector>
+
+#include <iodme/thread.hpp>
+#include <iodme/queue.hpp>
+#include <iodme/metrics.hpp>
+
+namespace iodme {
+
+// Background sync stage.
+// Writers hand over fully written files, syncer makes them durable,
+// drops cached pages and closes them. This takes device flush latency
+// out of the buffer recycling loop.
+// Files that fail to sync are not counted as durable (frames/bytes),
+// they show up in errors() instead. The owner is expected to act on it.
+class file_syncer : public iodme::thread {
+public:
+	enum Policy {
+		SYNC_RANGE, // kick writeback on hand-off, fsync each file in order
+		SYNC_GROUP  // sync the files in batches every group_time_ns or group_bytes
+	};
+
+	struct options {
+		Policy   policy;
+		uint64_t group_time_ns;
+		uint64_t group_bytes;
+		uint64_t max_unsynced; // max bytes handed over but not yet synced
+		uint64_t in_poll_period_ns; // writers poll period when the entry queue is full
+	};
+
+	static const options default_options;
+
+private:
+	struct entry {
+		int      fd;
+		uint64_t size;
+	};
+
+	static const unsigned int ENTRY_QUEUE_DEPTH = 1024;
+
+	options _opts;
+	iodme::notify_queue<entry, ENTRY_QUEUE_DEPTH> _q;
+	std::atomic<uint64_t> _unsynced;
+	std::atomic<uint32_t> _window_seq;     // futex, bumped when the window opens up
+	std::atomic<uint32_t> _window_waiters; // writers blocked on the full window
+
+	std::vector<entry> _batch;
+	uint64_t _batch_bytes;
+	uint64_t _batch_start_ns;
+
+	iodme::metrics::stage_metrics _m;        // frames are durable files here
+	iodme::metrics::histogram&    _fsync_ns; // fsync (range) or group commit time
+
+	void loop();
+	bool reserve(uint64_t size);
+	bool do_sync(const entry& e);
+	void finish(const entry& e, bool ok);
+	void commit_batch();
+
+public:
+	file_syncer(const std::string& name, const options& opts) :
+		iodme::thread(name),
+		_opts(opts),
+		_unsynced(0),
+		_window_seq(0),
+		_window_waiters(0),
+		_batch_bytes(0),
+		_batch_start_ns(0),
+		_m(name),
+		_fsync_ns(_m.grp.add_histogram("fsync_ns"))
+	{
+		_m.grp.add_gauge("unsynced", [this]() { return unsynced(); });
+	}
+
+	~file_syncer()
+	{
+		// Pending files are synced on the way out of the loop
+		join();
+	}
+
+	// Bytes handed over but not yet synced
+	uint64_t unsynced() const { return _unsynced.load(std::memory_order_relaxed); }
+
+	// Number of files that failed to sync (data may be lost)
+	uint64_t errors() const { return _m.errors.get(); }
+
+	// Hand over a written file. Called from the writer threads.
+	// Starts the writeback and blocks while the un-synced window is full.
+	// The syncer owns the fd after this call.
+	void sync(int fd, uint64_t size);
+};
+
+} // namespace iodme
+
+#endif // IODME_FILE_SYNCER_HPP
@@ -44,6 +44,18 @@
 #include <iodme/queue.hpp>
 #include <iodme/thread.hpp>
 #include <iodme/mover.hpp>
+#include <iodme/uring.hpp>
+#include <iodme/segment.hpp>
+#include <iodme/file-syncer.hpp>
+#include <iodme/reclaimer.hpp>
+#include <iodme/sequencer.hpp>
+#include <iodme/metrics.hpp>
+#include <iodme/tracer.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
 
 namespace iodme {
 
@@ -52,31 +64,160 @@ private:
 	std::string   _odir;
 	iodme::queue& _in_q;
 	iodme::queue& _out_q;
-	uint64_t      _in_pp_ns;
+	iodme::wait_strategy _in_wait;
 	unsigned int  _flags;
+	unsigned int  _io_depth;
+	uint64_t      _seg_size;
+	uint64_t      _seg_time_ns;
+	iodme::file_syncer *_syncer;
+	iodme::sequencer   *_seq;
+	iodme::tracer      *_tracer;
+	iodme::reclaimer   *_reclaimer;
+
+	iodme::metrics::stage_metrics _m;
+	iodme::metrics::histogram&    _write_ns; // io_uring mode: whole open-to-close chain
+	iodme::metrics::histogram&    _fsync_ns;
+	iodme::metrics::histogram&    _crc_ns;     // CHECKSUM mode
+	iodme::metrics::counter&      _crc_errors; // frames that don't match their checksum
+
+	bool _xattr_failed; // filesystem can't store checksums (reported once)
+
+	// Open segments (one per stream)
+	std::map<std::string, std::unique_ptr<iodme::segment>> _segments;
+
+	// Sequencer streams, looked up in the sequencer once per stream
+	std::map<std::string, iodme::sequencer::stream*, std::less<>> _seq_streams;
 
 	// O_DIRECT requires multiple of block size (most devices use 512)
 	const unsigned int directio_block = 512;
 
+	// Frame that is being written via io_uring
+	struct uring_frame {
+		iodme::buffer b;
+		std::string   ofile;   // file being written (.part if sequenced)
+		uint32_t      pad;
+		unsigned int  pending; // number of ops in flight
+		int           err;     // first error (if any)
+		uint64_t      start;   // submit time
+	};
+
 	void loop();
+	bool setup_uring(iodme::uring& ring);
+	void loop_uring(iodme::uring& ring);
 
+	std::string output_name(const iodme::buffer& b) const;
+	iodme::sequencer::stream& seq_stream(const iodme::buffer& b);
+	uint32_t add_directio_pad(iodme::buffer& b, unsigned int& open_flags, const std::string& ofile);
+
+	bool write_data(iodme::mover& dme, int fd, iodme::buffer& b, off_t offset, int& w_errno, bool shared_fd = false);
 	bool do_write(iodme::mover& dme, iodme::buffer& b);
+	bool do_append(iodme::mover& dme, iodme::buffer& b);
+	bool do_append_shared(iodme::mover& dme, iodme::buffer& b);
+
+	void close_segment(iodme::segment& seg);
+	void rotate_segments(bool all);
+
+	void release(iodme::buffer& b);
+
+	void check_crc(iodme::buffer& b);
+	void store_crc(int fd, const std::string& path, const iodme::buffer& b);
+
+	bool submit_frame(iodme::uring& ring, unsigned int slot, uring_frame& f);
+	void complete_frame(uring_frame& f);
 
 public:
 	enum Flags {
 		DIRECTIO = (1<<0),
-		SPLICE   = (1<<1)
+		SPLICE   = (1<<1),
+		URING    = (1<<2), // async open/write/fsync/close via io_uring
+		SEGMENT  = (1<<3), // append frames into rolling segment files
+		CHECKSUM = (1<<4)  // verify frame checksums before writing, compute missing ones
+	};
+
+	struct options {
+		unsigned int flags;
+		iodme::wait_strategy in_wait; // how to wait for input buffers
+		unsigned int io_depth;        // max number of frames in flight (URING mode)
+		uint64_t     segment_size;    // rotate segments after this many bytes (SEGMENT mode)
+		uint64_t     segment_time_ns; // rotate segments after this long, 0 - no time limit
+		iodme::file_syncer *syncer;   // hand files over to the sync stage, null - fsync inline
+		iodme::sequencer *sequencer;  // publish frames in order across writers, null - as they complete
+		iodme::tracer *tracer;        // account for frame lifecycle, null - no tracing
+		iodme::reclaimer *reclaimer;  // report output files for retention, null - keep everything
 	};
 
+	static const options default_options;
+
+	// Output file name for a frame: <odir>/<name>.<seqno>
+	static std::string output_name(const std::string& odir, const char *name, uint64_t seqno);
+
+	// Split an output file name (no directory): <name>.<seqno> (frame) or
+	// <name>.<seqno>.seg (segment). Returns false for anything else (.part, .idx, ...).
+	static bool parse_output_name(const std::string& file, std::string& name, uint64_t& seqno, bool& seg);
+
+	// Frame checksums are kept in this extended attribute of the output
+	// file (8 hex digits). Segments keep them in the index instead.
+	static const char *CRC_XATTR;
+
+	// Attach the checksum to the output file (fd, or path if fd is -1)
+	static bool set_crc_xattr(int fd, const std::string& path, uint32_t crc);
+
+	file_writer(const std::string& name, const std::string& odir, iodme::queue &in_q, iodme::queue &out_q,
+			const options& opts) :
+		thread(name),
+		_odir(odir),
+		_in_q(in_q),
+		_out_q(out_q),
+		_in_wait(opts.in_wait),
+		_flags(opts.flags),
+		_io_depth(opts.io_depth ? opts.io_depth : 1),
+		_seg_size(opts.segment_size),
+		_seg_time_ns(opts.segment_time_ns),
+		_syncer(opts.syncer),
+		_seq(opts.sequencer),
+		_tracer(opts.tracer),
+		_reclaimer(opts.reclaimer),
+		_m(name),
+		_write_ns(_m.grp.add_histogram("write_ns")),
+		_fsync_ns(_m.grp.add_histogram("fsync_ns")),
+		_crc_ns(_m.grp.add_histogram("crc_ns")),
+		_crc_errors(_m.grp.add_counter("crc_errors")),
+		_xattr_failed(false)
+	{
+		_m.grp.add_gauge("in_q", [&in_q]() { return in_q.size(); });
+	}
+
+	// in_poll_period_ns is the max time to block waiting for input
 	file_writer(const std::string& name, const std::string& odir, iodme::queue &in_q, iodme::queue &out_q,
 			unsigned int flags = 0, uint64_t in_poll_period_ns = 100000) :
 		thread(name),
 		_odir(odir),
 		_in_q(in_q),
 		_out_q(out_q),
-		_in_pp_ns(in_poll_period_ns),
-		_flags(flags)
-	{}
+		_in_wait({ default_wait.spin, in_poll_period_ns }),
+		_flags(flags),
+		_io_depth(default_options.io_depth),
+		_seg_size(default_options.segment_size),
+		_seg_time_ns(default_options.segment_time_ns),
+		_syncer(default_options.syncer),
+		_seq(default_options.sequencer),
+		_tracer(default_options.tracer),
+		_reclaimer(default_options.reclaimer),
+		_m(name),
+		_write_ns(_m.grp.add_histogram("write_ns")),
+		_fsync_ns(_m.grp.add_histogram("fsync_ns")),
+		_crc_ns(_m.grp.add_histogram("crc_ns")),
+		_crc_errors(_m.grp.add_counter("crc_errors")),
+		_xattr_failed(false)
+	{
+		_m.grp.add_gauge("in_q", [&in_q]() { return in_q.size(); });
+	}
+
+	~file_writer()
+	{
+		// Open segments are closed on the way out of the loop
+		join();
+	}
 };
 
 } // namespace iodme
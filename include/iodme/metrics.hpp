@@ -0,0 +1,221 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_METRICS_HPP
+#define IODME_METRICS_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <iodme/thread.hpp>
+
+namespace iodme {
+namespace metrics {
+
+// Counter owned by a single thread.
+// Updated with plain relaxed load/store (no locked instructions,
+// no shared cache lines between stages), read by the exporter.
+class counter {
+private:
+	std::atomic<uint64_t> _v;
+
+public:
+	counter() : _v(0) {}
+
+	void add(uint64_t n = 1) { _v.store(_v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+	uint64_t get() const { return _v.load(std::memory_order_relaxed); }
+};
+
+// Log-linear histogram (HDR style) owned by a single thread.
+// Values below 2^SUB_BITS are exact, above that each power of two is split
+// into 2^SUB_BITS buckets, which keeps the relative error under ~6%.
+class histogram {
+public:
+	static const unsigned int SUB_BITS = 4;
+	static const unsigned int SUB_COUNT = 1 << SUB_BITS;
+	static const unsigned int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+	struct snapshot {
+		uint64_t count;
+		uint64_t sum;
+		uint64_t max;
+		std::vector<uint64_t> buckets;
+
+		// Value at the given percentile (0-100), upper bound of the bucket
+		uint64_t percentile(double p) const;
+	};
+
+private:
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _sum;
+	std::atomic<uint64_t> _max;
+	std::atomic<uint64_t> _buckets[BUCKETS];
+
+	static void bump(std::atomic<uint64_t>& c, uint64_t n)
+	{
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+public:
+	histogram();
+
+	static unsigned int bucket(uint64_t v)
+	{
+		if (v < SUB_COUNT)
+			return v;
+		unsigned int e = 63 - __builtin_clzll(v);
+		return ((e - SUB_BITS + 1) << SUB_BITS) + ((v >> (e - SUB_BITS)) & (SUB_COUNT - 1));
+	}
+
+	// Largest value that maps into the bucket
+	static uint64_t bucket_max(unsigned int i);
+
+	void record(uint64_t v)
+	{
+		bump(_buckets[bucket(v)], 1);
+		bump(_count, 1);
+		bump(_sum, v);
+		if (v > _max.load(std::memory_order_relaxed))
+			_max.store(v, std::memory_order_relaxed);
+	}
+
+	void read(snapshot& s) const;
+};
+
+// Named set of metrics (usually one per stage thread).
+// Owns the metrics and keeps them registered for its lifetime.
+class group {
+public:
+	typedef std::function<uint64_t()> gauge;
+
+private:
+	friend class registry;
+
+	std::string _name;
+	std::vector<std::pair<std::string, std::unique_ptr<counter>>>   _counters;
+	std::vector<std::pair<std::string, std::unique_ptr<histogram>>> _histograms;
+	std::vector<std::pair<std::string, gauge>>                      _gauges;
+
+public:
+	explicit group(const std::string& name);
+	~group();
+
+	group(const group&) = delete;
+	group& operator=(const group&) = delete;
+
+	const std::string& name() const { return _name; }
+
+	counter&   add_counter(const std::string& name);
+	histogram& add_histogram(const std::string& name);
+
+	// Gauges are sampled by the exporter thread
+	void add_gauge(const std::string& name, const gauge& g);
+};
+
+// Metrics common to all data path stages
+struct stage_metrics {
+	group     grp;
+	counter&  frames;
+	counter&  bytes;
+	counter&  syscalls;
+	counter&  stalls;  // had to wait for buffers or room downstream
+	counter&  errors;
+
+	explicit stage_metrics(const std::string& name) :
+		grp(name),
+		frames(grp.add_counter("frames")),
+		bytes(grp.add_counter("bytes")),
+		syscalls(grp.add_counter("syscalls")),
+		stalls(grp.add_counter("stalls")),
+		errors(grp.add_counter("errors"))
+	{}
+};
+
+// All registered groups
+class registry {
+public:
+	static void add(group *g);
+	static void remove(group *g);
+
+	// Protects the group list and group contents
+	static std::mutex& mutex();
+
+	// Read a single counter or histogram of a registered group.
+	// Returns false if there is no such group or metric.
+	static bool read(const std::string& grp, const std::string& name, uint64_t& v);
+	static bool read(const std::string& grp, const std::string& name, histogram::snapshot& s);
+
+	// Snapshot of all metrics as a JSON object
+	static std::string json();
+};
+
+// Periodically writes the JSON snapshot of all metrics into a file.
+// File is replaced atomically (write + rename) so it can be polled.
+class exporter : public iodme::thread {
+public:
+	struct options {
+		std::string path;
+		uint64_t    period_ns;
+	};
+
+	static const options default_options;
+
+private:
+	options _opts;
+
+	void loop();
+	bool dump();
+
+public:
+	explicit exporter(const options& opts = default_options) :
+		iodme::thread("IODME-METRICS"),
+		_opts(opts)
+	{}
+
+	~exporter()
+	{
+		// Final snapshot is written on the way out of the loop
+		join();
+	}
+};
+
+} // namespace metrics
+} // namespace iodme
+
+#endif // IODME_METRICS_HPP
@@ -0,0 +1,144 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_MIRROR_HPP
+#define IODME_MIRROR_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <atomic>
+#include <deque>
+#include <string>
+
+#include <iodme/thread.hpp>
+#include <iodme/mover.hpp>
+#include <iodme/proto.hpp>
+#include <iodme/metrics.hpp>
+
+namespace iodme {
+
+// Mirror stage.
+// Forwards a copy of a spliced stream to another destination (TCP socket
+// or a file on another disk) in the wire format: hello followed by the
+// frames with their headers.
+// The receiver tee(2)s frame pages from its mover pipe into the mirror
+// pipe, the mirror thread splices them out to the destination. No data is
+// copied through user memory.
+// The mirror pipe is the only buffering for the destination. Frames that
+// don't fit into it are skipped, so a slow mirror never stalls the
+// recording. Pipe room is counted in slots (tee(2) copies the socket
+// buffers one for one), with a worst case estimate per frame. A mirror
+// that still falls behind in the middle of a frame can't resync and is
+// shut down.
+// Writing into a file blocks (O_NONBLOCK is ignored) while holding the
+// source pipe lock, which would stall the receiver's tee(). File mirrors
+// move small chunks into a private pipe first and write from there.
+class mirror : public iodme::thread, public iodme::tee_sink {
+public:
+	struct options {
+		unsigned int pipe_size; // mirror pipe size in bytes, 0 - fs.pipe-max-size
+	};
+
+	static const options default_options;
+
+private:
+	std::string _dest;
+	int         _fd;          // destination
+	int         _pipe_fd[2];
+	int         _file_fd[2];  // private pipe (file destinations)
+	unsigned int _pipe_size;
+	unsigned int _pipe_slots;
+	options     _opts;
+
+	std::atomic<bool> _broken; // destination failed or overrun, stop feeding it
+	bool        _in_frame;     // current frame is being mirrored
+
+	// Pipe slots held by the frames that haven't been drained yet (receiver)
+	struct held {
+		uint64_t     end;   // stream offset of the end of the frame
+		unsigned int slots; // worst case
+	};
+	std::deque<held>      _held;
+	uint64_t              _queued; // bytes put into the pipe so far
+	std::atomic<unsigned int> _slots;
+
+	iodme::metrics::stage_metrics _m; // frames and bytes forwarded, stalls - slow destination (mirror thread)
+	iodme::metrics::counter&      _skipped;  // frames skipped, no room in the pipe
+	iodme::metrics::counter&      _overruns; // pipe filled up in the middle of a frame
+
+	void loop();
+	void loop_file();
+	void loop_socket();
+	void stop(const char *why);
+	void release();
+	static unsigned int frame_slots(uint64_t len);
+
+public:
+	// Mirror the stream 'name' into 'fd' (socket or file). The mirror owns the fd.
+	// Hello 'h' is sent ahead of the frames. Check failed() before start().
+	mirror(const std::string& name, const std::string& dest, int fd,
+			const iodme::proto::hello& h, const options& opts = default_options);
+	~mirror();
+
+	// Destination is gone (failed or overrun)
+	bool broken() const { return _broken.load(std::memory_order_relaxed); }
+
+	// Actual pipe size in bytes
+	unsigned int pipe_size() const { return _pipe_size; }
+
+	// ---- Receiver side. Called from the thread that owns the stream.
+
+	// Start mirroring a frame. Returns false if the frame is skipped
+	// (no room in the pipe or broken destination).
+	bool begin(const iodme::proto::frame_header& fh);
+
+	// Duplicate n bytes of the current frame from the receiver pipe.
+	void tee(int pipe_fd, size_t n);
+
+	// Done with the frame
+	void end()
+	{
+		if (_in_frame)
+			_m.frames.add();
+		_in_frame = false;
+	}
+
+	// No more frames. Mirror thread drains the pipe and exits.
+	void finish();
+};
+
+} // namespace iodme
+
+#endif // IODME_MIRROR_HPP
@@ -31,10 +31,27 @@
 #ifndef IODME_MOVER_HPP
 #define IODME_MOVER_HPP
 
+#include <vector>
+
 #include <iodme/buffer.hpp>
 
 namespace iodme {
 
+// Max pipe buffer size (fs.pipe-max-size sysctl)
+unsigned int max_pipe_size();
+
+// Extra consumer of the spliced data (eg mirror).
+// Gets a reference to the data sitting in the mover pipe with tee(2)
+// before the data is spliced into the output.
+class tee_sink {
+public:
+	virtual ~tee_sink() {}
+
+	// Duplicate the first n bytes of the pipe (read end 'pipe_fd').
+	// Must not block and must not consume the pipe data.
+	virtual void tee(int pipe_fd, size_t n) = 0;
+};
+
 class mover {
 private:
 	bool _failed;
@@ -54,6 +71,12 @@ public:
 
 	// Do direct write/splice without using pipe
 	bool do_write(int fd, int in_fd, size_t len);
+
+	// Splice up to len bytes from in_fd (eg socket) into fd via the pipe.
+	// Stops early on EOF. Number of bytes moved is returned in 'moved'.
+	// Data is also tee'd into the 'tees' (if any) on the way through the pipe.
+	bool do_splice(int fd, int in_fd, size_t len, size_t& moved,
+			const std::vector<tee_sink *> *tees = 0);
 };
 
 } // namespace iodme
@@ -0,0 +1,142 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_NETRX_REACTOR_HPP
+#define IODME_NETRX_REACTOR_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <string>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <iodme/buffer.hpp>
+#include <iodme/queue.hpp>
+#include <iodme/thread.hpp>
+#include <iodme/proto.hpp>
+#include <iodme/metrics.hpp>
+
+namespace iodme {
+
+// Event-driven receiver.
+// Accepts connections on its own listening socket and serves all of them
+// from a single thread using epoll. Run several reactors on SO_REUSEPORT
+// sockets bound to the same port to spread connections across threads.
+// Only framed streams are supported (see iodme/proto.hpp).
+class netrx_reactor : public iodme::thread {
+public:
+	enum Flags {
+		VERIFY   = (1<<0), // check STAMPED frame payloads (see iodme/payload.hpp)
+		CHECKSUM = (1<<1)  // check frames against the sender checksums (see iodme/crc32c.hpp)
+	};
+
+private:
+	struct conn {
+		enum State {
+			HELLO,
+			HEADER,
+			WAIT_BUFFER, // header is in, waiting for a clean buffer
+			PAYLOAD
+		};
+
+		int         sk;
+		State       state;
+		std::string name;
+		uint32_t    got;     // bytes of hello/header received so far
+		uint64_t    start;   // time the frame header came in
+		uint32_t    crc;     // checksum of the payload received so far (CHECKSUM mode)
+		iodme::proto::hello        hello;
+		iodme::proto::frame_header fh;
+		iodme::buffer b;
+	};
+
+	int _lsk;
+	int _epfd;
+	uint32_t _max_frame_size;
+	unsigned int _flags;
+	iodme::queue& _in_q;
+	iodme::queue& _out_q;
+
+	std::map<int, std::unique_ptr<conn>> _conns;
+	std::vector<conn*> _starved; // connections waiting for buffers
+	bool _buffer_wait;           // registered as an event waiter on the clean queue
+
+	iodme::metrics::stage_metrics _m;
+	iodme::metrics::histogram&    _recv_ns; // header to last byte of the frame
+	iodme::metrics::counter&      _verify_errors; // frames with corrupted payload (VERIFY mode)
+	iodme::metrics::counter&      _crc_errors;    // frames that don't match their checksum (CHECKSUM mode)
+
+	void loop();
+
+	void do_accept();
+	bool do_input(conn& c);
+	bool start_frame(conn& c);
+	void feed_starved();
+	void drop(conn& c);
+
+	bool set_events(conn& c, uint32_t events);
+
+public:
+	// Takes ownership of the listening socket
+	netrx_reactor(const std::string& name, int listen_sk, uint32_t max_frame_size,
+			iodme::queue &in_q, iodme::queue &out_q, unsigned int flags = 0) :
+		thread(name),
+		_lsk(listen_sk),
+		_epfd(-1),
+		_buffer_wait(false),
+		_max_frame_size(max_frame_size),
+		_flags(flags),
+		_in_q(in_q),
+		_out_q(out_q),
+		_m(name),
+		_recv_ns(_m.grp.add_histogram("recv_ns")),
+		_verify_errors(_m.grp.add_counter("verify_errors")),
+		_crc_errors(_m.grp.add_counter("crc_errors"))
+	{
+		_m.grp.add_gauge("in_q", [&in_q]() { return in_q.size(); });
+	}
+
+	~netrx_reactor()
+	{
+		// Connections are torn down on the way out of the loop
+		join();
+		close(_lsk);
+	}
+};
+
+} // namespace iodme
+
+#endif // IODME_NETRX_REACTOR_HPP
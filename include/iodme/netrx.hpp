@@ -35,26 +35,72 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/socket.h>
 
 #include <hogl/post.hpp>
 #include <string>
+#include <memory>
+#include <vector>
 
 #include <iodme/buffer.hpp>
 #include <iodme/queue.hpp>
 #include <iodme/thread.hpp>
+#include <iodme/mover.hpp>
+#include <iodme/mirror.hpp>
+#include <iodme/file-syncer.hpp>
+#include <iodme/reclaimer.hpp>
+#include <iodme/proto.hpp>
+#include <iodme/metrics.hpp>
 
 namespace iodme {
 
 class netrx : public iodme::thread {
+public:
+	enum Flags {
+		SPLICE = (1<<0), // splice socket -> pipe -> output file, bypassing the buffers
+		RAW    = (1<<1), // unframed byte stream (see iodme/proto.hpp for framing)
+		VERIFY = (1<<2), // check STAMPED frame payloads (see iodme/payload.hpp)
+		CHECKSUM = (1<<3) // check frames against the sender checksums (see iodme/crc32c.hpp)
+	};
+
+	struct options {
+		unsigned int flags;
+		std::string  odir;       // output directory (SPLICE mode)
+		uint32_t     frame_size; // bytes per output file (RAW SPLICE mode)
+		iodme::file_syncer *syncer; // hand files over to the sync stage, null - fsync inline
+		iodme::wait_strategy in_wait; // how to wait for clean buffers
+		iodme::reclaimer *reclaimer;  // report output files for retention (SPLICE mode), null - keep everything
+	};
+
+	static const options default_options;
+
 private:
 	std::string _name;
 	int         _sk;
 	iodme::queue& _in_q;
 	iodme::queue& _out_q;
+	options     _opts;
+
+	iodme::metrics::stage_metrics _m;
+	iodme::metrics::histogram&    _recv_ns;  // header to last byte of the frame
+	iodme::metrics::histogram&    _fsync_ns; // SPLICE mode with inline sync
+	iodme::metrics::counter&      _verify_errors; // frames with corrupted payload (VERIFY mode)
+	iodme::metrics::counter&      _crc_errors;    // frames that don't match their checksum (CHECKSUM mode)
+
+	std::vector<std::unique_ptr<iodme::mirror>> _mirrors;
+	std::vector<iodme::tee_sink *> _tees; // mirrors that take the current frame
 
 	void loop();
+	void loop_raw();
+	void loop_framed();
+	void loop_splice(iodme::mover& dme);
+
+	void recv_failed(const char *what);
+	void finish_mirrors();
+	bool recv_crc(uint8_t *data, size_t len, uint32_t& crc, uint64_t& calls);
 
 	void kill()
 	{
@@ -64,25 +110,61 @@ private:
 
 	void new_frame(iodme::buffer& b, uint64_t& seqno)
 	{
-		size_t n = _name.copy(b.meta->name, sizeof(b.meta->name));
-		b.meta->name[n] ='\0';
-		b.meta->seqno = seqno++;
+		init_frame(b, _name, seqno++);
 
 		hogl::post(_area, _area->INFO, "new-frame: base %p capacity %u seqno %llu",
 				b.base, b.capacity, b.meta->seqno);
 	}
 
 public:
-	netrx(const std::string& name, int in_sk, iodme::queue &in_q, iodme::queue &out_q) :
+	// Stamp stream name and seqno into the buffer metadata.
+	// Starts the lifecycle trace, buffer is assumed to be just popped from the pool.
+	static void init_frame(iodme::buffer& b, const std::string& name, uint64_t seqno)
+	{
+		size_t n = name.copy(b.meta->name, sizeof(b.meta->name) - 1);
+		b.meta->name[n] ='\0';
+		b.meta->seqno = seqno;
+		b.meta->flags = 0;
+
+		memset(b.meta->trace, 0, sizeof(b.meta->trace));
+		b.meta->trace[buffer::T_POOL_POP] = now_ns();
+	}
+
+	// Carry the sender checksum (if any) over into the buffer metadata
+	static void set_crc(iodme::buffer& b, const iodme::proto::frame_header& fh)
+	{
+		if (fh.flags & iodme::proto::FRAME_CRC32C) {
+			b.meta->crc = fh.crc;
+			b.meta->flags |= buffer::metadata::HAS_CRC;
+		}
+	}
+
+	netrx(const std::string& name, int in_sk, iodme::queue &in_q, iodme::queue &out_q,
+			const options& opts = default_options) :
 		thread(std::string("IODME-NETRX") + std::to_string(in_sk)),
 		_name(name),
 		_sk(in_sk),
 		_in_q(in_q),
-		_out_q(out_q)
-	{}
+		_out_q(out_q),
+		_opts(opts),
+		_m(std::string("IODME-NETRX") + std::to_string(in_sk) + "/" + name),
+		_recv_ns(_m.grp.add_histogram("recv_ns")),
+		_fsync_ns(_m.grp.add_histogram("fsync_ns")),
+		_verify_errors(_m.grp.add_counter("verify_errors")),
+		_crc_errors(_m.grp.add_counter("crc_errors"))
+	{
+		_m.grp.add_gauge("in_q", [&in_q]() { return in_q.size(); });
+	}
+
+	// Forward a copy of the stream to the mirror (framed SPLICE mode only).
+	// Netrx owns the mirror after this call. Must be called before start().
+	void add_mirror(std::unique_ptr<iodme::mirror> m) { _mirrors.push_back(std::move(m)); }
 
 	~netrx()
 	{
+		// Mirrors are fed from the loop
+		shutdown(_sk, SHUT_RDWR);
+		join();
 		close(_sk);
 	}
 };
@@ -33,34 +33,126 @@
 
 #define _GNU_SOURCE 1
 
+#include <unistd.h>
+#include <sys/socket.h>
+
 #include <iodme/thread.hpp>
 #include <iodme/queue.hpp>
+#include <iodme/proto.hpp>
+#include <iodme/metrics.hpp>
+
+#include <deque>
+#include <memory>
+#include <vector>
 
 namespace iodme {
 
 class nettx : public iodme::thread {
+public:
+	enum Flags {
+		ZEROCOPY = (1<<0), // MSG_ZEROCOPY, buffers are released when the kernel is done with them
+		RAW      = (1<<1)  // unframed byte stream (no hello, no frame headers)
+	};
+
 private:
+	// Frames sent with MSG_ZEROCOPY waiting for completion
+	struct zc_frame {
+		iodme::buffer b;
+		uint32_t      last_id; // id of the last send() call for this frame
+	};
+
+	// Connection to the sink, carries one stream
+	struct conn {
+		int sk;
+		iodme::proto::hello hello;
+		int send_flags;
+
+		std::deque<zc_frame> zc_pending;
+		uint32_t zc_next_id;  // id of the next zerocopy send() call
+		uint32_t zc_done;     // all ids below this are complete
+	};
+
 	iodme::queue &_q;
-	int _sk;
+	iodme::queue *_free_q; // return sent frames here, null - free them
+	unsigned int _flags;
+	iodme::wait_strategy _wait;
+
+	std::vector<std::unique_ptr<conn>> _conns; // indexed by buffer::metadata::stream, null - not ours
+	size_t   _zc_pending;  // frames waiting for completion (all connections)
+	uint64_t _zc_copied;   // number of sends where kernel fell back to copying
+
+	iodme::metrics::stage_metrics _m;
+	iodme::metrics::histogram&    _send_ns; // header to last byte handed to the kernel
 
 	void loop();
 
+	bool setup(conn& c);
+	bool send_frame(conn& c, iodme::buffer& b);
+	bool reap_zc(conn& c);
+	void reap_zc_all(int timeout_ms);
+	void release(iodme::buffer& b);
+
+	// Shutdown unblocks the sends, sockets are closed once the thread is gone
 	void kill()
 	{
-		close(_sk);
+		for (auto& c : _conns)
+			if (c) shutdown(c->sk, SHUT_RDWR);
 		iodme::thread::kill();
 	}
 
 public:
-	nettx(int sk, iodme::queue &q) :
-		iodme::thread("IODME-NETTX"),
+	// Framed stream, the hello is sent when the thread starts
+	nettx(int sk, iodme::queue &q, const iodme::proto::hello& hello, unsigned int flags = 0,
+			const iodme::wait_strategy& wait = default_wait) :
+		nettx("IODME-NETTX", q, flags, wait)
+	{
+		add_stream(0, sk, hello);
+	}
+
+	// Raw stream
+	nettx(int sk, iodme::queue &q, unsigned int flags = 0,
+			const iodme::wait_strategy& wait = default_wait) :
+		nettx("IODME-NETTX", q, flags | RAW, wait)
+	{
+		add_stream(0, sk, iodme::proto::hello());
+	}
+
+	// Multiple streams sharing the thread, see add_stream().
+	// Frames are routed to the connections by buffer::metadata::stream.
+	nettx(const std::string& name, iodme::queue &q, unsigned int flags = 0,
+			const iodme::wait_strategy& wait = default_wait) :
+		iodme::thread(name),
 		_q(q),
-		_sk(sk)
-	{}
+		_free_q(0),
+		_flags(flags),
+		_wait(wait),
+		_zc_pending(0),
+		_zc_copied(0),
+		_m(name),
+		_send_ns(_m.grp.add_histogram("send_ns"))
+	{
+		_m.grp.add_gauge("in_q", [&q]() { return q.size(); });
+	}
+
+	// Send the frames of the stream over the connected socket (takes ownership).
+	// The hello is ignored for raw streams. Must be called before start().
+	void add_stream(uint32_t stream, int sk, const iodme::proto::hello& hello)
+	{
+		if (stream >= _conns.size())
+			_conns.resize(stream + 1);
+		_conns[stream].reset(new conn { sk, hello, 0, {}, 0, 0 });
+	}
+
+	// Return sent buffers into free_q (eg pump's pool) instead of freeing them.
+	// Must be called before start().
+	void set_free_queue(iodme::queue &free_q) { _free_q = &free_q; }
 
 	~nettx()
 	{
-		close(_sk);
+		kill();
+		join();
+		for (auto& c : _conns)
+			if (c) close(c->sk);
 	}
 };
 
@@ -0,0 +1,67 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_NUMA_HPP
+#define IODME_NUMA_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+
+namespace iodme {
+namespace numa {
+
+// Minimal NUMA helpers (sysfs + raw syscalls, no libnuma dependency)
+
+// Number of memory nodes. Returns 1 on non-NUMA systems.
+int num_nodes();
+
+// Node the CPU belongs to, -1 if unknown
+int node_of_cpu(int cpu);
+
+// CPUs that belong to the node
+bool node_cpus(int node, cpu_set_t& cpus);
+
+// Node the socket's traffic is processed on (SO_INCOMING_CPU), -1 if unknown
+int socket_node(int sk);
+
+// Bind memory range to the node (mbind MPOL_BIND).
+// Only affects pages that are faulted in after the call.
+bool bind(void *addr, size_t len, int node);
+
+// Parse CPU list in the sysfs format (eg "0-3,8,10-11")
+bool parse_cpulist(const char *str, cpu_set_t& cpus);
+
+} // namespace numa
+} // namespace iodme
+
+#endif // IODME_NUMA_HPP
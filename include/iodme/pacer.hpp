@@ -0,0 +1,119 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_PACER_HPP
+#define IODME_PACER_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+
+#include <random>
+#include <string>
+
+namespace iodme {
+
+// Frame pacing for the generator.
+// Frames are scheduled on absolute deadlines (nsec, CLOCK_MONOTONIC) computed
+// from the start of the run, so the time spent producing a frame does not add
+// up and the average rate does not drift. The caller sleeps until the deadline
+// (see thread::sleep_until()).
+class pacer {
+public:
+	enum Profile {
+		CONSTANT, // fixed interval
+		BURST,    // bursts of back-to-back frames, same average rate
+		RAMP,     // rate goes linearly from ramp_from to rate, then holds
+		POISSON   // exponentially distributed intervals (random arrivals)
+	};
+
+	// What to do when the producer falls behind the schedule
+	enum CatchUp {
+		CATCHUP_BURST, // send late frames back-to-back until back on schedule
+		CATCHUP_SKIP,  // skip the missed slots, send only the latest one
+		CATCHUP_RESET  // restart the schedule from now (rate drifts)
+	};
+
+	struct options {
+		Profile  profile;
+		CatchUp  catchup;
+		double   rate;      // average frames per second, 0 - as fast as possible
+		unsigned burst;     // frames per burst (BURST)
+		double   ramp_from; // initial rate (RAMP)
+		double   ramp_time; // seconds to reach the rate (RAMP)
+		uint32_t min_size;  // frame sizes are uniformly distributed in [min_size, max_size],
+		uint32_t max_size;  // 0 - use the whole buffer
+		uint64_t seed;      // for POISSON intervals and frame sizes
+	};
+
+	static const options default_options;
+
+	struct slot {
+		uint64_t deadline; // when to send the frame
+		uint32_t size;     // frame size, 0 - whole buffer
+		uint64_t skipped;  // slots skipped to get here (CATCHUP_SKIP)
+	};
+
+private:
+	options  _opts;
+	uint64_t _start;  // schedule origin
+	uint64_t _n;      // current slot
+	double   _t;      // current slot offset from the origin (nsec)
+	double   _t_next; // next slot offset
+
+	std::mt19937_64 _rng;
+	std::exponential_distribution<double>   _interval; // POISSON
+	std::uniform_int_distribution<uint32_t> _size;
+
+	double offset(uint64_t n);
+	void   advance();
+
+public:
+	explicit pacer(const options& opts = default_options);
+
+	const options& opts() const { return _opts; }
+
+	// Start the schedule, first slot is due right away
+	void start(uint64_t now);
+
+	// Take the next slot
+	slot next(uint64_t now);
+
+	// Parse traffic profile spec: constant, burst:<frames>,
+	// ramp:<initial-fps>:<seconds>, poisson. Updates the options.
+	static bool parse_profile(const std::string& spec, options& opts);
+
+	// Parse catch-up policy: burst, skip, reset
+	static bool parse_catchup(const std::string& str, CatchUp& c);
+};
+
+} // namespace iodme
+
+#endif // IODME_PACER_HPP
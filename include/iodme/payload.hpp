@@ -0,0 +1,87 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_PAYLOAD_HPP
+#define IODME_PAYLOAD_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+
+namespace iodme {
+namespace payload {
+
+// Synthetic frame payloads for the generator.
+// Random data comes from 8 interleaved xorshift128+ streams (word i from
+// stream i % 8), which maps onto AVX2/AVX-512/NEON registers. All kernels
+// produce the same bytes, so a frame filled on one machine can be
+// verified on another.
+
+enum Kind {
+	ZERO,    // all zeros
+	PATTERN, // fixed random block repeated over the frame
+	RANDOM,  // pseudo-random, seeded from the frame seqno
+	STAMPED  // pseudo-random blocks prefixed with a stamp (verifiable)
+};
+
+// STAMPED frames are made of blocks of this size (the last one may be short).
+// Each block starts with a stamp followed by data seeded from the stamp.
+static const uint32_t STAMP_BLOCK_SIZE = 4096;
+
+struct stamp {
+	uint64_t seqno;  // frame seqno
+	uint64_t offset; // block offset within the frame
+};
+
+// Parse/format payload kind ("zero", "pattern", "random", "stamped")
+bool parse_kind(const std::string& str, Kind& k);
+const char *kind_name(Kind k);
+
+// Name of the fill kernel picked for this CPU (eg "avx2")
+const char *kernel_name();
+
+// Fill n bytes of the frame. Large fills use non-temporal stores.
+void fill(Kind k, uint8_t *dst, size_t n, uint64_t seqno);
+
+// Same as fill() and return the CRC32C of the frame (see iodme/crc32c.hpp).
+// Checksum is computed while the data is still in the cache.
+uint32_t fill_crc(Kind k, uint8_t *dst, size_t n, uint64_t seqno);
+
+// Check STAMPED frame contents.
+// Returns number of corrupted blocks, 0 - all good.
+size_t verify(const uint8_t *src, size_t n, uint64_t seqno);
+
+} // namespace payload
+} // namespace iodme
+
+#endif // IODME_PAYLOAD_HPP
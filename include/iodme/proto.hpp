@@ -0,0 +1,106 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_PROTO_HPP
+#define IODME_PROTO_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <errno.h>
+
+#include <string>
+
+namespace iodme {
+namespace proto {
+
+// Wire protocol between the generator (nettx) and the sink (netrx).
+// Client sends a hello right after connecting, followed by the stream of
+// frames, each prefixed with a frame header.
+// All fields are little-endian on the wire.
+
+static const uint32_t HELLO_MAGIC = 0x4d444f49; // "IODM"
+static const uint32_t FRAME_MAGIC = 0x454d5246; // "FRME"
+static const uint16_t VERSION     = 2;
+
+struct hello {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;      // reserved
+	uint32_t frame_size; // max frame size
+	uint32_t rate_mhz;   // frame rate hint in millihertz
+	char     name[128];  // stream name
+} __attribute__((packed));
+
+struct frame_header {
+	uint32_t magic;
+	uint32_t length;     // payload length
+	uint64_t seqno;
+	uint64_t timestamp;  // sender timestamp (nsec)
+	uint32_t crc;        // CRC32C of the payload (FRAME_CRC32C)
+	uint32_t flags;
+} __attribute__((packed));
+
+// Frame header flags
+enum {
+	FRAME_CRC32C = (1<<0) // crc is valid
+};
+
+// Make a hello for the stream
+hello make_hello(const std::string& name, uint32_t frame_size, float rate);
+
+// Blocking send/recv helpers. Return false on error, errno is set
+// (ECONNRESET on EOF, EPROTO on bad magic/version).
+bool send_hello(int sk, const hello& h);
+bool recv_hello(int sk, hello& h);
+bool send_header(int sk, const frame_header& fh, int flags = 0);
+bool recv_header(int sk, frame_header& fh);
+
+// Receive exactly len bytes. Returns false on error or EOF.
+// Number of recv() calls is added to 'calls' (if given).
+bool recv_all(int sk, void *data, size_t len, uint64_t *calls = 0);
+
+// Convert received hello/header to host order and validate (in place).
+// Used by non-blocking receivers that assemble them from partial reads.
+bool decode_hello(hello& h);
+bool decode_header(frame_header& fh);
+
+// Convert hello/header to wire order (in place).
+// Used by senders that don't go through send_hello()/send_header() (eg mirror).
+void encode_hello(hello& h);
+void encode_header(frame_header& fh);
+
+// Stream names are used for output file names
+bool valid_name(const char *name);
+
+} // namespace proto
+} // namespace iodme
+
+#endif // IODME_PROTO_HPP
@@ -32,27 +32,120 @@
 #define IODME_PUMP_HPP
 
 #include <stdint.h>
+
+#include <string>
+#include <vector>
+
 #include <iodme/thread.hpp>
 #include <iodme/queue.hpp>
+#include <iodme/metrics.hpp>
+#include <iodme/payload.hpp>
+#include <iodme/pacer.hpp>
 
 namespace iodme {
 
 class pump : public iodme::thread {
 private:
-	iodme::queue &_q;
+	// Generated stream, each has its own schedule and output queue
+	struct stream {
+		uint32_t      id;    // goes into buffer::metadata::stream
+		std::string   name;
+		iodme::queue *q;
+		iodme::pacer  pacer;
+		iodme::pacer::slot slot; // next frame
+		uint64_t      seqno;
+	};
+
+	std::vector<stream> _streams;
+	iodme::queue *_free_q; // pre-allocated frames, null - allocate per frame
 
 	size_t   _size;
-	uint64_t _interval_nsec;
+	iodme::payload::Kind _payload;
+	bool     _checksum;
+
+	iodme::metrics::stage_metrics _m;
+	iodme::metrics::histogram&    _fill_ns; // payload generation (and checksum)
+	iodme::metrics::histogram&    _late_ns; // wake up past the frame deadline
+	iodme::metrics::counter&      _skipped; // slots skipped to catch up
+	iodme::metrics::counter&      _dropped; // frames dropped (no free buffers or full queue)
+
+	static iodme::pacer::options pacing(unsigned int interval_nsec)
+	{
+		iodme::pacer::options o = iodme::pacer::default_options;
+		o.rate = interval_nsec ? 1e9 / interval_nsec : 0;
+		return o;
+	}
 
 	void loop();
+	void make_frame(stream& s);
 
 public:
 	pump(size_t size, unsigned int interval_nsec, iodme::queue &out_q) :
-		iodme::thread("IODME-PUMP"),
-		_q(out_q),
+		pump("IODME-PUMP", size)
+	{
+		add_stream(0, "", out_q, pacing(interval_nsec));
+	}
+
+	// Generate frames into pre-allocated buffers (with metadata) taken
+	// from free_q. Paced streams drop frames if there are no free buffers,
+	// unpaced ones wait for them (counted as stalls).
+	// Consumer is expected to return the buffers into free_q.
+	pump(size_t size, unsigned int interval_nsec, iodme::queue &free_q, iodme::queue &out_q) :
+		pump("IODME-PUMP", size, free_q)
+	{
+		add_stream(0, "", out_q, pacing(interval_nsec));
+	}
+
+	// Multiple streams sharing the thread (and the buffers), see add_stream().
+	// Frames are produced in the order of their deadlines.
+	pump(const std::string& name, size_t size) :
+		iodme::thread(name),
+		_free_q(0),
 		_size(size),
-		_interval_nsec(interval_nsec)
+		_payload(iodme::payload::ZERO),
+		_checksum(false),
+		_m(name),
+		_fill_ns(_m.grp.add_histogram("fill_ns")),
+		_late_ns(_m.grp.add_histogram("late_ns")),
+		_skipped(_m.grp.add_counter("skipped")),
+		_dropped(_m.grp.add_counter("dropped"))
 	{}
+
+	pump(const std::string& name, size_t size, iodme::queue &free_q) :
+		pump(name, size)
+	{
+		_free_q = &free_q;
+		_m.grp.add_gauge("free_q", [&free_q]() { return free_q.size(); });
+	}
+
+	// Generate frames of the stream into out_q. Frame sizes are capped at
+	// the buffer capacity. Must be called before start().
+	void add_stream(uint32_t id, const std::string& name, iodme::queue &out_q,
+			const iodme::pacer::options& pacing)
+	{
+		_streams.push_back({ id, name, &out_q, iodme::pacer(pacing), {}, 0 });
+	}
+
+	~pump()
+	{
+		// Streams are touched on the way out of the loop
+		join();
+	}
+
+	// Select frame contents (see iodme/payload.hpp). Must be called before start().
+	void set_payload(iodme::payload::Kind k) { _payload = k; }
+
+	// Checksum each frame (CRC32C, see iodme/crc32c.hpp), it travels in the
+	// frame metadata. Must be called before start().
+	void set_checksum(bool on) { _checksum = on; }
+
+	// Replace the constant interval with a traffic profile (see iodme/pacer.hpp)
+	// for all streams added so far. Must be called before start().
+	void set_pacing(const iodme::pacer::options& opts)
+	{
+		for (auto& s : _streams)
+			s.pacer = iodme::pacer(opts);
+	}
 };
 
 } // namespace iodme
@@ -31,15 +31,231 @@
 #ifndef IODME_QUEUE_HPP
 #define IODME_QUEUE_HPP
 
-#include <boost/lockfree/queue.hpp>
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+
+#include <atomic>
+#include <algorithm>
 
 #include <iodme/buffer.hpp>
+#include <iodme/ring.hpp>
 
 namespace iodme {
 
+// Default queue depth
 static const unsigned int QUEUE_DEPTH = 128;
 
-typedef boost::lockfree::queue<buffer, boost::lockfree::capacity<QUEUE_DEPTH>> queue;
+// How consumers wait for the queue.
+// Spin (try to pop) a few times first, then block until notified by the producer.
+// Blocking is bounded so that consumers get to check for kill/timeouts.
+struct wait_strategy {
+	unsigned int spin;     // number of pop attempts before blocking
+	uint64_t     block_ns; // max time to block, 0 - don't block
+};
+
+static const wait_strategy default_wait = { 64, 100 * 1000 * 1000 };
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Lockfree queue with futex based notifications.
+// Producers only pay for a syscall when there are blocked consumers.
+// MPMC queues can be shared by any number of producers and consumers.
+// SPSC queues are faster but must have exactly one producer thread and
+// one consumer thread (eg a pump feeding a single nettx).
+// Depth is given at runtime (rounded up to a power of two), N is the default.
+// Consumers that wait in epoll (eg netrx_reactor) get an eventfd instead
+// of the futex, see event_fd().
+template<typename T, size_t N = QUEUE_DEPTH>
+class notify_queue {
+public:
+	enum Mode {
+		MPMC,
+		SPSC
+	};
+
+private:
+	Mode _mode;
+	iodme::ring_mpmc<T> _mpmc;
+	iodme::ring_spsc<T> _spsc;
+
+	alignas(64) std::atomic<uint32_t> _seq;     // bumped when consumers need a wake up
+	std::atomic<uint32_t>             _waiters; // number of blocked consumers
+	std::atomic<uint32_t>             _event_waiters; // number of consumers waiting on the eventfd
+	std::atomic<int>                  _efd;
+
+	size_t try_pop(T *v, size_t max)
+	{
+		return _mode == SPSC ? _spsc.pop(v, max) : _mpmc.pop(v, max);
+	}
+
+	void futex_wait(uint32_t val, uint64_t nsec)
+	{
+		struct timespec ts = {
+			(time_t) (nsec / 1000000000),
+			(long)   (nsec % 1000000000)
+		};
+		syscall(SYS_futex, (uint32_t *) &_seq, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+	}
+
+	void futex_wake(int n)
+	{
+		syscall(SYS_futex, (uint32_t *) &_seq, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+	}
+
+	// Wake up to n blocked consumers, one per new entry.
+	// The fence pairs with the one in pop_wait(): either we see the waiter
+	// or the waiter sees the new entries when it rechecks the queue.
+	void notify(size_t n)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t w = _waiters.load(std::memory_order_relaxed);
+		if (w) {
+			_seq.fetch_add(1, std::memory_order_relaxed);
+			futex_wake(std::min<size_t>(n, w));
+		}
+		if (_event_waiters.load(std::memory_order_relaxed)) {
+			uint64_t one = 1;
+			ssize_t r = write(_efd.load(std::memory_order_relaxed), &one, sizeof(one));
+			(void) r;
+		}
+	}
+
+public:
+	explicit notify_queue(size_t depth = N, Mode mode = MPMC) :
+		_mode(mode),
+		_mpmc(mode == MPMC ? depth : 0),
+		_spsc(mode == SPSC ? depth : 0),
+		_seq(0), _waiters(0), _event_waiters(0), _efd(-1)
+	{}
+
+	~notify_queue()
+	{
+		if (_efd >= 0)
+			close(_efd);
+	}
+
+	notify_queue(const notify_queue&) = delete;
+	notify_queue& operator=(const notify_queue&) = delete;
+
+	Mode mode() const { return _mode; }
+
+	size_t capacity() const { return _mode == SPSC ? _spsc.capacity() : _mpmc.capacity(); }
+
+	bool empty() const { return !size(); }
+
+	// Approximate number of entries. Good enough for monitoring.
+	uint32_t size() const
+	{
+		return _mode == SPSC ? _spsc.size() : _mpmc.size();
+	}
+
+	bool pop(T& v) { return try_pop(&v, 1); }
+
+	// Pop up to max entries without waiting. Returns number of entries popped.
+	size_t pop(T *v, size_t max) { return try_pop(v, max); }
+
+	bool push(const T& v) { return push(&v, 1) == 1; }
+
+	// Push up to n entries (as many as fit). Returns number of entries pushed.
+	size_t push(const T *v, size_t n)
+	{
+		size_t k = _mode == SPSC ? _spsc.push(v, n) : _mpmc.push(v, n);
+		if (k)
+			notify(k);
+		return k;
+	}
+
+	// Pop with spin-then-block wait.
+	// Returns false if nothing showed up within the wait limits.
+	bool pop_wait(T& v, const wait_strategy& ws) { return pop_wait(&v, 1, ws) == 1; }
+
+	// Pop up to max entries, waiting for at least one.
+	// Returns number of entries popped, 0 if nothing showed up within the wait limits.
+	size_t pop_wait(T *v, size_t max, const wait_strategy& ws)
+	{
+		size_t k;
+		for (unsigned int i = 0; i <= ws.spin; i++) {
+			if ((k = try_pop(v, max)))
+				return k;
+			cpu_relax();
+		}
+
+		if (!ws.block_ns)
+			return 0;
+
+		uint32_t seq = _seq.load(std::memory_order_acquire);
+		_waiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		// Recheck after announcing ourselves, the producer may have missed us
+		k = try_pop(v, max);
+		if (!k) {
+			futex_wait(seq, ws.block_ns);
+			k = try_pop(v, max);
+		}
+
+		_waiters.fetch_sub(1, std::memory_order_relaxed);
+		return k;
+	}
+
+	// Eventfd (non-blocking) that is written on every push while there are
+	// event waiters. Meant for edge-triggered epoll, every push is an event
+	// for every epoll instance watching it, so the counter need not be read.
+	// Returns -1 if the eventfd can't be created.
+	int event_fd()
+	{
+		int fd = _efd.load(std::memory_order_acquire);
+		if (fd >= 0)
+			return fd;
+
+		fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (fd < 0)
+			return -1;
+
+		int none = -1;
+		if (!_efd.compare_exchange_strong(none, fd)) {
+			close(fd);
+			fd = none;
+		}
+		return fd;
+	}
+
+	// Register/unregister a consumer waiting on event_fd().
+	// The consumer must recheck the queue after add_event_waiter(),
+	// the fence pairs with the one in notify() like in pop_wait().
+	void add_event_waiter()
+	{
+		_event_waiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	void remove_event_waiter()
+	{
+		_event_waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// Wake up all blocked consumers (eg on shutdown)
+	void wake_all()
+	{
+		_seq.fetch_add(1, std::memory_order_seq_cst);
+		futex_wake(INT32_MAX);
+	}
+};
+
+typedef notify_queue<buffer> queue;
 
 } // namespace iodme
 
@@ -0,0 +1,126 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_RECLAIMER_HPP
+#define IODME_RECLAIMER_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <atomic>
+#include <deque>
+#include <string>
+
+#include <iodme/thread.hpp>
+#include <iodme/queue.hpp>
+#include <iodme/metrics.hpp>
+
+namespace iodme {
+
+// Retention stage.
+// Keeps an output directory within its byte/file budget by removing the
+// oldest recorded frames and segments. Writers report files as they are
+// completed, the reclaimer removes old ones in the background, ahead of
+// need, so that the write path never waits for unlink() and never runs
+// into a full disk. Turns the sink into a "last N bytes" recorder.
+// Recordings found in the directory at startup count towards the budget
+// and go first. Segments are accounted for once they are closed, so the
+// reserve should cover the open ones.
+// The thread runs in the idle IO class.
+class reclaimer : public iodme::thread {
+public:
+	struct options {
+		uint64_t max_bytes;      // byte budget, 0 - none
+		uint64_t max_files;      // file (or segment) budget, 0 - none
+		uint64_t min_free_bytes; // keep at least this much free space in the filesystem, 0 - don't check
+		uint64_t reserve_bytes;  // headroom for the data being written, kept on top of the budgets
+		uint64_t period_ns;      // how often to check the free space
+	};
+
+	static const options default_options;
+
+private:
+	struct entry {
+		std::string path;
+		uint64_t    size;
+	};
+
+	static const unsigned int ENTRY_QUEUE_DEPTH = 16384;
+
+	std::string _dir;
+	options     _opts;
+	iodme::notify_queue<entry, ENTRY_QUEUE_DEPTH> _q;
+
+	std::deque<entry> _files; // oldest first
+	std::atomic<uint64_t> _used;
+	std::atomic<uint64_t> _count;
+	uint64_t _start_ns;   // CLOCK_REALTIME, files written after this are reported by the writers
+	uint64_t _free_need;  // bytes to free to get back to min_free_bytes (last check)
+	uint64_t _free_check_ns;
+	bool _stuck_warned;   // over budget with nothing left to remove
+	bool _lost_warned;
+	std::atomic<uint64_t> _lost; // files reported while the queue was full (never removed), bumped by the writers
+
+	iodme::metrics::stage_metrics _m; // frames are files here
+	iodme::metrics::histogram&    _unlink_ns;
+
+	void loop();
+	void scan();
+	void check_free();
+	void reclaim();
+	void remove(const entry& e);
+
+public:
+	// Must be created before the writers start, files that already
+	// exist at this point are picked up by scanning the directory.
+	reclaimer(const std::string& name, const std::string& dir, const options& opts = default_options);
+
+	~reclaimer()
+	{
+		join();
+	}
+
+	// Bytes and files currently retained
+	uint64_t used()  const { return _used.load(std::memory_order_relaxed); }
+	uint64_t files() const { return _count.load(std::memory_order_relaxed); }
+
+	// Account for a completed output file (frame or closed segment).
+	// Called from the writer threads, never blocks. Segment 'size'
+	// includes the index.
+	void add(const std::string& path, uint64_t size);
+};
+
+} // namespace iodme
+
+#endif // IODME_RECLAIMER_HPP
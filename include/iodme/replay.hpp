@@ -0,0 +1,136 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_REPLAY_HPP
+#define IODME_REPLAY_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+#include <iodme/thread.hpp>
+#include <iodme/proto.hpp>
+#include <iodme/pacer.hpp>
+#include <iodme/metrics.hpp>
+
+namespace iodme {
+
+// Replay source.
+// Sends a recorded stream (frame files and segments written by file_writer)
+// back to a sink in seqno order. Frames go from the page cache straight into
+// the socket with sendfile(2), they never show up in user memory.
+// Frames are paced like the generator does it (see iodme/pacer.hpp).
+class replay : public iodme::thread {
+public:
+	// Recorded frame
+	struct frame {
+		uint64_t    seqno;
+		std::string path;   // frame file or segment
+		uint64_t    offset; // of the frame in the file
+		uint32_t    size;
+		uint32_t    flags;  // proto::FRAME_CRC32C
+		uint32_t    crc;
+		uint64_t    mtime;  // file modification time (nsec)
+	};
+
+	struct options {
+		iodme::pacer::options pacing; // rate 0 - as fast as possible
+		unsigned int repeat;          // passes over the recording, 0 - until stopped
+	};
+
+	static const options default_options;
+
+private:
+	int   _sk;
+	iodme::proto::hello _hello;
+	std::vector<frame> _frames;
+	options _opts;
+
+	int         _fd;      // currently open file
+	std::string _fd_path;
+
+	iodme::metrics::stage_metrics _m;
+	iodme::metrics::histogram&    _send_ns; // header to last byte handed to the kernel
+	iodme::metrics::histogram&    _late_ns; // wake up past the frame deadline
+	iodme::metrics::counter&      _skipped; // frames skipped to catch up
+
+	void loop();
+	bool open_file(const frame& f);
+	bool send_frame(const frame& f, uint64_t seqno);
+
+	// Shutdown unblocks the sends, socket is closed once the thread is gone
+	void kill()
+	{
+		shutdown(_sk, SHUT_RDWR);
+		iodme::thread::kill();
+	}
+
+public:
+	// Replay 'frames' (see scan()) over the connected socket, which the replay owns.
+	// The hello is sent when the thread starts.
+	replay(int sk, const iodme::proto::hello& hello, const std::vector<frame>& frames,
+			const options& opts = default_options);
+
+	~replay()
+	{
+		kill();
+		join();
+		if (_fd >= 0)
+			close(_fd);
+		close(_sk);
+	}
+
+	// Find recorded frames of the stream in dir, sorted by seqno.
+	// Returns false if the directory can't be read.
+	static bool scan(const std::string& dir, const std::string& name, std::vector<frame>& frames);
+
+	// Names of the streams recorded in dir
+	static std::vector<std::string> streams(const std::string& dir);
+
+	// Average frame rate of the recording estimated from the file modification
+	// times (frames per second). 0 if there is not enough data.
+	static double recorded_rate(const std::vector<frame>& frames);
+
+	// Size of the largest frame
+	static uint32_t max_size(const std::vector<frame>& frames);
+
+	// Frames and bytes sent so far
+	uint64_t frames() const { return _m.frames.get(); }
+	uint64_t bytes() const  { return _m.bytes.get(); }
+};
+
+} // namespace iodme
+
+#endif // IODME_REPLAY_HPP
@@ -0,0 +1,250 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_RING_HPP
+#define IODME_RING_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <memory>
+
+namespace iodme {
+
+static const size_t CACHELINE = 64;
+
+// Round up to the next power of two (min 2)
+static inline size_t ring_capacity(size_t n)
+{
+	size_t c = 2;
+	while (c < n)
+		c <<= 1;
+	return c;
+}
+
+// Bounded single-producer single-consumer ring.
+// Producer and consumer indices live on their own cache lines, each side
+// keeps a cached copy of the other side's index and only re-reads it when
+// the ring looks full (empty). Batches are published with a single store.
+template<typename T>
+class ring_spsc {
+private:
+	std::unique_ptr<T[]> _slots;
+	size_t _mask;
+
+	alignas(CACHELINE) std::atomic<size_t> _head; // next slot to write (producer)
+	size_t _tail_cache;                           // producer's view of the tail
+
+	alignas(CACHELINE) std::atomic<size_t> _tail; // next slot to read (consumer)
+	size_t _head_cache;                           // consumer's view of the head
+
+	char _pad[CACHELINE - sizeof(size_t) * 2];
+
+public:
+	// Capacity is rounded up to a power of two, 0 - no storage
+	explicit ring_spsc(size_t capacity = 0) :
+		_slots(capacity ? new T[ring_capacity(capacity)] : nullptr),
+		_mask(capacity ? ring_capacity(capacity) - 1 : 0),
+		_head(0), _tail_cache(0), _tail(0), _head_cache(0)
+	{}
+
+	ring_spsc(const ring_spsc&) = delete;
+	ring_spsc& operator=(const ring_spsc&) = delete;
+
+	size_t capacity() const { return _slots ? _mask + 1 : 0; }
+
+	// Approximate number of entries
+	size_t size() const
+	{
+		size_t t = _tail.load(std::memory_order_relaxed);
+		size_t h = _head.load(std::memory_order_relaxed);
+		return h - t;
+	}
+
+	bool empty() const { return !size(); }
+
+	// Push up to n entries. Returns number of entries pushed.
+	size_t push(const T *v, size_t n)
+	{
+		size_t h = _head.load(std::memory_order_relaxed);
+		size_t room = capacity() - (h - _tail_cache);
+		if (room < n) {
+			_tail_cache = _tail.load(std::memory_order_acquire);
+			room = capacity() - (h - _tail_cache);
+		}
+		if (n > room)
+			n = room;
+
+		for (size_t i = 0; i < n; i++)
+			_slots[(h + i) & _mask] = v[i];
+		_head.store(h + n, std::memory_order_release);
+		return n;
+	}
+
+	// Pop up to max entries. Returns number of entries popped.
+	size_t pop(T *v, size_t max)
+	{
+		size_t t = _tail.load(std::memory_order_relaxed);
+		size_t avail = _head_cache - t;
+		if (avail < max) {
+			_head_cache = _head.load(std::memory_order_acquire);
+			avail = _head_cache - t;
+		}
+		if (max > avail)
+			max = avail;
+
+		for (size_t i = 0; i < max; i++)
+			v[i] = _slots[(t + i) & _mask];
+		_tail.store(t + max, std::memory_order_release);
+		return max;
+	}
+};
+
+// Bounded multi-producer multi-consumer ring.
+// Each cell carries a sequence number that tells which lap of the ring
+// it is ready for (D. Vyukov's bounded MPMC queue). Producers (consumers)
+// claim a run of consecutive cells with a single CAS on the head (tail),
+// so batches cost one atomic RMW instead of one per entry.
+template<typename T>
+class ring_mpmc {
+private:
+	struct cell {
+		std::atomic<size_t> seq;
+		T v;
+	};
+
+	std::unique_ptr<cell[]> _cells;
+	size_t _mask;
+
+	alignas(CACHELINE) std::atomic<size_t> _head; // next cell to write
+	alignas(CACHELINE) std::atomic<size_t> _tail; // next cell to read
+	char _pad[CACHELINE - sizeof(size_t)];
+
+	// Number of cells starting at pos (up to n) whose sequence is pos + i + ready
+	size_t count_ready(size_t pos, size_t n, size_t ready) const
+	{
+		size_t k = 0;
+		for (; k < n; k++) {
+			const cell& c = _cells[(pos + k) & _mask];
+			if (c.seq.load(std::memory_order_acquire) != pos + k + ready)
+				break;
+		}
+		return k;
+	}
+
+public:
+	// Capacity is rounded up to a power of two, 0 - no storage
+	explicit ring_mpmc(size_t capacity = 0) :
+		_cells(capacity ? new cell[ring_capacity(capacity)] : nullptr),
+		_mask(capacity ? ring_capacity(capacity) - 1 : 0),
+		_head(0), _tail(0)
+	{
+		for (size_t i = 0; i < this->capacity(); i++)
+			_cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	ring_mpmc(const ring_mpmc&) = delete;
+	ring_mpmc& operator=(const ring_mpmc&) = delete;
+
+	size_t capacity() const { return _cells ? _mask + 1 : 0; }
+
+	// Approximate number of entries
+	size_t size() const
+	{
+		size_t t = _tail.load(std::memory_order_relaxed);
+		size_t h = _head.load(std::memory_order_relaxed);
+		return h > t ? h - t : 0;
+	}
+
+	bool empty() const { return !size(); }
+
+	// Push up to n entries. Returns number of entries pushed.
+	size_t push(const T *v, size_t n)
+	{
+		if (!_cells)
+			return 0;
+
+		size_t pos = _head.load(std::memory_order_relaxed);
+		size_t k;
+		do {
+			// Free cells are ready for this lap: seq == pos
+			k = count_ready(pos, n, 0);
+			if (!k) {
+				const cell& c = _cells[pos & _mask];
+				if ((intptr_t) (c.seq.load(std::memory_order_acquire) - pos) < 0)
+					return 0; // full
+				pos = _head.load(std::memory_order_relaxed); // lost the race
+				continue;
+			}
+		} while (!k || !_head.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed));
+
+		for (size_t i = 0; i < k; i++) {
+			cell& c = _cells[(pos + i) & _mask];
+			c.v = v[i];
+			c.seq.store(pos + i + 1, std::memory_order_release);
+		}
+		return k;
+	}
+
+	// Pop up to max entries. Returns number of entries popped.
+	size_t pop(T *v, size_t max)
+	{
+		if (!_cells)
+			return 0;
+
+		size_t pos = _tail.load(std::memory_order_relaxed);
+		size_t k;
+		do {
+			// Filled cells: seq == pos + 1
+			k = count_ready(pos, max, 1);
+			if (!k) {
+				const cell& c = _cells[pos & _mask];
+				if ((intptr_t) (c.seq.load(std::memory_order_acquire) - (pos + 1)) < 0)
+					return 0; // empty
+				pos = _tail.load(std::memory_order_relaxed); // lost the race
+				continue;
+			}
+		} while (!k || !_tail.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed));
+
+		for (size_t i = 0; i < k; i++) {
+			cell& c = _cells[(pos + i) & _mask];
+			v[i] = c.v;
+			c.seq.store(pos + i + _mask + 1, std::memory_order_release);
+		}
+		return k;
+	}
+};
+
+} // namespace iodme
+
+#endif // IODME_RING_HPP
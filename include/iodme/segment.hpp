@@ -0,0 +1,136 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_SEGMENT_HPP
+#define IODME_SEGMENT_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <errno.h>
+
+#include <string>
+
+namespace iodme {
+
+class file_syncer;
+
+// Rolling segment file.
+// Consecutive frames of a stream are appended into a single large file
+// which is rotated by size or age. Frame boundaries are stored in the
+// sidecar index file (<segment>.idx). Index entries are appended as
+// frames are committed, so readers can follow a segment that is still
+// being written.
+class segment {
+public:
+	struct index_entry {
+		enum Flags {
+			CRC32C = (1<<0) // crc is valid
+		};
+
+		uint64_t seqno;
+		uint64_t offset;
+		uint32_t size;  // frame size (without padding)
+		uint32_t flags;
+		uint32_t crc;   // CRC32C of the frame (see iodme/crc32c.hpp)
+		uint32_t reserved;
+	};
+
+private:
+	std::string  _path;
+	int          _fd;
+	int          _idx_fd;
+	int          _errno;
+	unsigned int _open_flags;
+	uint64_t     _offset;
+	uint64_t     _open_ns;
+	size_t       _frames;
+	bool         _idx_failed;
+
+public:
+	segment() : _fd(-1), _idx_fd(-1), _errno(0), _open_flags(0), _offset(0), _open_ns(0),
+		_frames(0), _idx_failed(false) {}
+	~segment() { close(); }
+
+	segment(const segment&) = delete;
+	segment& operator=(const segment&) = delete;
+
+	bool is_open() const { return _fd != -1; }
+	int  fd() const { return _fd; }
+	int  last_errno() const { return _errno; }
+	const std::string& path() const { return _path; }
+	unsigned int open_flags() const { return _open_flags; }
+
+	// Current write offset (aka segment size)
+	uint64_t offset() const { return _offset; }
+
+	// Number of frames in the segment
+	size_t frames() const { return _frames; }
+
+	// Space taken by the segment and its index
+	uint64_t disk_size() const { return _offset + _frames * sizeof(index_entry); }
+
+	uint64_t age_ns(uint64_t now_ns) const { return now_ns - _open_ns; }
+
+	bool open(const std::string& path, unsigned int open_flags, uint64_t now_ns);
+
+	// Switch to regular IO (eg frame can't be padded for O_DIRECT)
+	void drop_directio();
+
+	// Account for a frame that has been written at the current offset.
+	// 'size' is the amount of data written to the file (including padding),
+	// 'frame_size' is the actual frame size.
+	// 'flags' and 'crc' go into the index entry as is.
+	void commit(uint64_t seqno, uint32_t frame_size, uint32_t size, uint32_t flags = 0, uint32_t crc = 0)
+	{
+		record(seqno, _offset, frame_size, flags, crc);
+		_offset += size;
+	}
+
+	// Reserve 'size' bytes at the end of the segment and return their offset.
+	// Used when frames are written concurrently and committed later with record().
+	uint64_t reserve(uint32_t size)
+	{
+		uint64_t off = _offset;
+		_offset += size;
+		return off;
+	}
+
+	// Add index entry for a frame written at the given offset
+	void record(uint64_t seqno, uint64_t offset, uint32_t frame_size, uint32_t flags = 0, uint32_t crc = 0);
+
+	// Write the index, sync and close the segment.
+	// If syncer is given the files are handed over to it instead.
+	bool close(iodme::file_syncer *syncer = 0);
+};
+
+} // namespace iodme
+
+#endif // IODME_SEGMENT_HPP
@@ -0,0 +1,179 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_SEQUENCER_HPP
+#define IODME_SEQUENCER_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <atomic>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <hogl/area.hpp>
+
+#include <iodme/segment.hpp>
+#include <iodme/metrics.hpp>
+
+namespace iodme {
+
+class file_syncer;
+class reclaimer;
+
+// Per-stream in-order commit.
+// Several writers may process frames of the same stream concurrently and
+// complete them in any order. The sequencer publishes completed frames
+// strictly in seqno order:
+//   file per frame - frames are written into <name>.part and renamed to
+//                    their final name when published.
+//   segments       - writers reserve room in a segment shared by all
+//                    writers of the stream and write in parallel, the
+//                    index entry is added when the frame is published.
+// Frames that complete ahead of a missing one are held in the reorder
+// window. A missing frame is given up on (skipped) once the window is
+// full or it has been missing for gap_timeout_ns.
+class sequencer {
+public:
+	struct options {
+		unsigned int window;          // max frames held back per stream
+		uint64_t     gap_timeout_ns;  // max time to wait for a missing frame
+		uint64_t     segment_size;    // rotate shared segments after this many bytes
+		uint64_t     segment_time_ns; // rotate shared segments after this long, 0 - no time limit
+		iodme::file_syncer *syncer;   // hand closed segments over to the sync stage
+		iodme::reclaimer *reclaimer;  // report published files and closed segments for retention
+	};
+
+	static const options default_options;
+
+	// Completed frame
+	struct frame {
+		uint64_t    seqno;
+		bool        ok;     // false - frame is lost (eg write failed)
+
+		// File per frame
+		std::string part;   // file the frame was written into
+		std::string path;   // final name
+
+		// Segment
+		std::shared_ptr<iodme::segment> seg;
+		uint64_t    offset;
+		uint32_t    size;   // frame size (without padding), both layouts
+		uint32_t    flags;  // index entry flags (see segment::index_entry)
+		uint32_t    crc;
+
+		frame() : seqno(0), ok(false), offset(0), size(0), flags(0), crc(0) {}
+	};
+
+	// Per-stream state. Writers look it up once with get_stream()
+	// and hand it back to begin(), reserve() and complete().
+	struct stream {
+		std::string name;
+		std::mutex mutex;
+		uint64_t   next;       // next seqno to publish
+		uint64_t   last;       // last published (or skipped) seqno
+		bool       has_last;
+		unsigned int inflight; // frames begun but not completed
+		uint64_t   gap_ns;     // when the current gap was first seen, 0 - no gap
+		std::map<uint64_t, frame> pending;
+
+		// Shared segments
+		std::shared_ptr<iodme::segment> seg;      // current segment
+		std::map<iodme::segment*, unsigned int> reserved; // frames reserved but not yet published
+		std::vector<std::shared_ptr<iodme::segment>> retired; // rotated segments waiting for their frames
+
+		explicit stream(const char *n) : name(n), next(0), last(0), has_last(false), inflight(0), gap_ns(0) {}
+	};
+
+private:
+	hogl::area *_area;
+	options     _opts;
+
+	std::mutex  _mutex; // protects the stream map
+	std::map<std::string, std::unique_ptr<stream>, std::less<>> _streams;
+
+	std::atomic<uint64_t> _skipped;
+	std::atomic<uint64_t> _expire_ns; // last expire() pass
+
+	iodme::metrics::group _metrics;
+
+	void publish(stream& s, frame& f);
+	void drain(stream& s, std::vector<std::shared_ptr<iodme::segment>>& done,
+			uint64_t now, bool flush = false);
+	void retire(stream& s, std::vector<std::shared_ptr<iodme::segment>>& done);
+	void collect(stream& s, std::vector<std::shared_ptr<iodme::segment>>& done);
+	void close_segments(std::vector<std::shared_ptr<iodme::segment>>& done);
+
+public:
+	explicit sequencer(const std::string& name, const options& opts = default_options);
+	~sequencer();
+
+	sequencer(const sequencer&) = delete;
+	sequencer& operator=(const sequencer&) = delete;
+
+	// Find (or add) the stream. Takes the global lock, writers keep the
+	// result. Streams live as long as the sequencer.
+	stream& get_stream(const char *name);
+
+	// Frame has been picked up by a writer. Must be called right after
+	// the frame is popped off the queue, before any other work on it.
+	void begin(stream& s, uint64_t seqno);
+
+	// Reserve room for a frame in the stream's shared segment.
+	// 'path' and 'open_flags' are used if a new segment has to be opened,
+	// 'size' includes padding. Fills in seg and offset.
+	bool reserve(stream& s, const std::string& path, unsigned int open_flags,
+			uint32_t size, frame& f);
+
+	// Frame is done (written or lost). Publishes it and everything
+	// that was waiting for it.
+	void complete(stream& s, frame& f);
+
+	// Close shared segments that are too old (or all of them)
+	void rotate(bool all);
+
+	// Skip gaps that have timed out. Writers call this periodically,
+	// frames held behind a lost one would wait forever otherwise.
+	// Cheap when there is nothing to do.
+	void expire();
+
+	// Number of frames that were given up on
+	uint64_t skipped() const { return _skipped.load(std::memory_order_relaxed); }
+};
+
+} // namespace iodme
+
+#endif // IODME_SEQUENCER_HPP
@@ -39,6 +39,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sched.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 
@@ -56,9 +57,23 @@ class thread {
 public:
 	bool failed()  const { return _failed;  }
 	bool running() const { return _running; }
+	const std::string& name() const { return _name; }
 	bool start();
 	void kill() { _killed = true; }
 
+	// Restrict the thread to the given CPUs.
+	// Must be called before start().
+	void set_cpus(const cpu_set_t& cpus) { _cpus = cpus; _pin = true; }
+
+	// Scheduling class (SCHED_OTHER, SCHED_FIFO, ...) and priority.
+	// Must be called before start(). By default threads inherit
+	// the policy of the thread that started them.
+	void set_sched(int policy, int prio) { _policy = policy; _prio = prio; }
+
+	// Parse scheduling spec: "<policy>[:<prio>]", where policy is
+	// one of other, batch, idle, fifo, rr. Eg "fifo:90".
+	static bool parse_sched(const std::string& spec, int& policy, int& prio);
+
 	static inline void do_nanosleep(uint64_t nsec)
 	{
 		if (!nsec) return;
@@ -69,6 +84,24 @@ public:
 		nanosleep(&ts, 0);
 	}
 
+	// Sleep until the absolute deadline (nsec, CLOCK_MONOTONIC, see now_ns())
+	static inline void sleep_until(uint64_t deadline_ns)
+	{
+		struct timespec ts = {
+			(time_t) (deadline_ns / 1000000000),
+			(long)   (deadline_ns % 1000000000)
+		};
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+			;
+	}
+
+	static inline uint64_t now_ns()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
 protected:
 	explicit thread(const std::string &name);
 	virtual ~thread();
@@ -82,8 +115,18 @@ protected:
 	pthread_t     _thread;
 	volatile bool _thread_created;
 
+	cpu_set_t     _cpus;
+	bool          _pin;
+	int           _policy; // -1 - inherit
+	int           _prio;
+
 	static void *entry(void *_self);
 	virtual void loop() = 0;
+
+	// Kill and wait for the thread to exit.
+	// Derived classes that touch their members on the way out of loop()
+	// must call this from their destructor.
+	void join();
 };
 
 } // namespace iodme
@@ -0,0 +1,137 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_TRACER_HPP
+#define IODME_TRACER_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <iodme/buffer.hpp>
+#include <iodme/queue.hpp>
+#include <iodme/thread.hpp>
+#include <iodme/metrics.hpp>
+
+namespace iodme {
+
+// Frame lifecycle tracer.
+// Writers hand over the metadata of every frame they release through a
+// lock-free queue. The tracer thread turns the lifecycle timestamps into
+// per-stream latency distributions (exported via iodme::metrics as
+// "trace/<stream>") and optionally dumps raw records into a binary file
+// for offline analysis. Frames are dropped (and counted) if the tracer
+// can't keep up, writers never wait for it.
+class tracer : public iodme::thread {
+public:
+	// Binary trace file record (host byte order)
+	struct record {
+		uint64_t seqno;
+		char     name[32];  // stream name (truncated)
+		uint64_t trace[buffer::T_COUNT];
+	};
+
+	struct options {
+		std::string path; // binary trace file, empty - no dump
+	};
+
+	static const options default_options;
+
+private:
+	// Per-stream latency distributions
+	struct stream {
+		iodme::metrics::group      grp;
+		iodme::metrics::histogram& rx;         // first recv -> handed off
+		iodme::metrics::histogram& queue_wait; // handed off -> writer pop
+		iodme::metrics::histogram& write;      // writer pop -> write end
+		iodme::metrics::histogram& sync;       // write end -> sync end
+		iodme::metrics::histogram& end_to_end; // first recv -> durable (or written)
+
+		explicit stream(const std::string& name) :
+			grp("trace/" + name),
+			rx(grp.add_histogram("rx_ns")),
+			queue_wait(grp.add_histogram("queue_wait_ns")),
+			write(grp.add_histogram("write_ns")),
+			sync(grp.add_histogram("sync_ns")),
+			end_to_end(grp.add_histogram("end_to_end_ns"))
+		{}
+	};
+
+	static const unsigned int FRAME_QUEUE_DEPTH = 4096;
+
+	options _opts;
+	FILE   *_file;              // tracer thread only
+	std::atomic<bool> _dumping; // false once the dump has failed
+
+	// Tracer thread only
+	std::map<std::string, std::unique_ptr<stream>> _streams;
+
+	iodme::notify_queue<buffer::metadata, FRAME_QUEUE_DEPTH> _q;
+
+	iodme::metrics::group    _metrics;
+	std::atomic<uint64_t>    _dropped; // updated by the writers
+	iodme::metrics::counter& _written; // updated by the tracer thread
+
+	void loop();
+	void account(const buffer::metadata& m);
+	void dump(const buffer::metadata& m);
+
+public:
+	explicit tracer(const std::string& name, const options& opts = default_options);
+
+	~tracer()
+	{
+		// Queued records are flushed on the way out of the loop
+		join();
+		if (_file)
+			fclose(_file);
+	}
+
+	bool dumping() const { return _dumping.load(std::memory_order_relaxed); }
+
+	// Account for a released frame. Called from the writer threads, never blocks.
+	// The tracer thread must be running.
+	void frame_done(const buffer::metadata& m)
+	{
+		if (!_q.push(m))
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+};
+
+} // namespace iodme
+
+#endif // IODME_TRACER_HPP
@@ -0,0 +1,109 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#ifndef IODME_URING_HPP
+#define IODME_URING_HPP
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include <linux/io_uring.h>
+
+namespace iodme {
+
+// Minimal io_uring wrapper on top of raw syscalls.
+// We only need a handful of ops and don't want to depend on liburing.
+// Not thread-safe, each thread is supposed to have its own ring.
+class uring {
+private:
+	bool _failed;
+	int  _errno;
+	int  _fd;
+
+	// Submission ring
+	unsigned int *_sq_head;
+	unsigned int *_sq_tail;
+	unsigned int *_sq_mask;
+	unsigned int *_sq_array;
+	unsigned int  _sq_entries;
+	unsigned int  _sqe_tail;   // local tail (not yet published)
+	unsigned int  _sqe_queued; // published but not yet submitted
+	struct io_uring_sqe *_sqes;
+
+	// Completion ring
+	unsigned int *_cq_head;
+	unsigned int *_cq_tail;
+	unsigned int *_cq_mask;
+	struct io_uring_cqe *_cqes;
+
+	void  *_sq_ring;
+	void  *_cq_ring;
+	size_t _sq_ring_size;
+	size_t _cq_ring_size;
+	size_t _sqes_size;
+
+	void unmap();
+
+public:
+	bool failed() const { return _failed; }
+	int  last_errno() const { return _errno; }
+
+	explicit uring(unsigned int depth);
+	~uring();
+
+	// Get next free submission entry (zeroed).
+	// Returns null if submission ring is full.
+	struct io_uring_sqe* get_sqe();
+
+	// Submit all queued entries and optionally wait for completions.
+	// Returns number of submitted entries or -1 on error.
+	int submit(unsigned int wait_nr = 0);
+
+	// Pop next completion (if any)
+	bool pop_cqe(struct io_uring_cqe &cqe);
+
+	// Register a table of (possibly sparse, -1) fixed files
+	bool register_files(const int *fds, unsigned int count);
+
+	// Check that the kernel supports all given ops (IORING_OP_...)
+	bool probe(const uint8_t *ops, unsigned int count);
+
+	// Check that OPENAT/CLOSE can work with direct descriptors (file_index,
+	// 5.15+). Older kernels install a normal fd instead. Uses fixed file
+	// 'slot' (must be registered and free), ring must be idle.
+	bool probe_direct_files(unsigned int slot);
+};
+
+} // namespace iodme
+
+#endif // IODME_URING_HPP
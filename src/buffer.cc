@@ -42,6 +42,7 @@
 #include <new>
 
 #include "iodme/buffer.hpp"
+#include "iodme/numa.hpp"
 
 namespace iodme {
 
@@ -73,7 +74,7 @@ static bool failed_alloc(buffer &b)
 	return false;
 }
 
-bool buffer::alloc(size_t size, unsigned int flags, const char *name)
+bool buffer::alloc(size_t size, unsigned int flags, const char *name, int node)
 {
 	this->reset();
 
@@ -99,6 +100,18 @@ bool buffer::alloc(size_t size, unsigned int flags, const char *name)
 		return failed_alloc(*this);
 
 	this->capacity = size;
+
+	if (node >= 0) {
+		if (!numa::bind(this->base, size, node))
+			return failed_alloc(*this);
+
+		// Fault the pages in now so that they land on the node
+		// and we don't take the faults in the data path.
+		size_t psize = sysconf(_SC_PAGESIZE);
+		for (size_t off = 0; off < size; off += psize)
+			this->base[off] = 0;
+	}
+
 	return true;
 }
 
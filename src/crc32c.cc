@@ -0,0 +1,344 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "iodme/crc32c.hpp"
+
+namespace iodme {
+namespace crc32c {
+
+// Reflected Castagnoli polynomial
+static const uint32_t POLY = 0x82f63b78;
+
+// Interleaved kernels run three independent streams over blocks of
+// these sizes and fold the results. Long blocks cover the bulk of the
+// frame, short ones the remainder.
+static const size_t LONG  = 8192;
+static const size_t SHORT = 256;
+
+// All kernels work on the raw register (no pre/post inversion)
+typedef uint32_t (*kernel_fn)(uint32_t crc, const uint8_t *p, size_t n);
+
+static inline uint64_t load64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// a(x) * b(x) mod P (reflected)
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t) 1 << 31;
+	uint32_t p = 0;
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if (!(a & (m - 1)))
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+	}
+	return p;
+}
+
+// x^n mod P (reflected)
+static uint32_t xpow(uint64_t n)
+{
+	uint32_t p = (uint32_t) 1 << 31; // x^0
+	uint32_t x = (uint32_t) 1 << 30; // x^1
+	for (; n; n >>= 1) {
+		if (n & 1)
+			p = multmodp(x, p);
+		x = multmodp(x, x);
+	}
+	return p;
+}
+
+////
+// Portable: slicing-by-8
+
+struct tables {
+	uint32_t t[8][256];
+
+	tables()
+	{
+		for (unsigned int i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (unsigned int k = 0; k < 8; k++)
+				c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+			t[0][i] = c;
+		}
+		for (unsigned int i = 0; i < 256; i++)
+			for (unsigned int k = 1; k < 8; k++)
+				t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+	}
+};
+
+static const tables& get_tables()
+{
+	static const tables t;
+	return t;
+}
+
+static uint32_t kernel_scalar(uint32_t crc, const uint8_t *p, size_t n)
+{
+	const tables& tb = get_tables();
+	const uint32_t (*t)[256] = tb.t;
+
+	for (; n >= 8; n -= 8, p += 8) {
+		uint64_t v = load64(p) ^ crc;
+		crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^
+			t[5][(v >> 16) & 0xff] ^ t[4][(v >> 24) & 0xff] ^
+			t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^
+			t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+	}
+	for (; n; n--, p++)
+		crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+	return crc;
+}
+
+////
+// Folding constants.
+// Shifting the register forward over n zero bytes multiplies it by
+// x^(8n) mod P. Carry-less multiply of two reflected values yields the
+// product times x, crc32 of the 64-bit product adds x^32, hence the
+// stream combining constants are x^(8n - 33).
+// Wide kernels fold 128-bit chunks of data forward by D bits: the first
+// (higher order) half is multiplied by x^(D + 31), the second one by
+// x^(D - 33), which lines the products up with the chunk D bits ahead.
+
+struct fold {
+	uint64_t k_long;   // shift by LONG bytes
+	uint64_t k_long2;  // shift by 2 * LONG bytes
+	uint64_t k_short;
+	uint64_t k_short2;
+
+	uint64_t k128[2]  __attribute__((aligned(16))); // fold by 128 bits
+	uint64_t k512[2]  __attribute__((aligned(16))); // fold by 512 bits
+	uint64_t k2048[2] __attribute__((aligned(16))); // fold by 2048 bits
+
+	fold() :
+		k_long(xpow(8 * LONG - 33)),
+		k_long2(xpow(8 * 2 * LONG - 33)),
+		k_short(xpow(8 * SHORT - 33)),
+		k_short2(xpow(8 * 2 * SHORT - 33))
+	{
+		k128[0]  = xpow(128 + 31);  k128[1]  = xpow(128 - 33);
+		k512[0]  = xpow(512 + 31);  k512[1]  = xpow(512 - 33);
+		k2048[0] = xpow(2048 + 31); k2048[1] = xpow(2048 - 33);
+	}
+};
+
+static const fold& get_fold()
+{
+	static const fold f;
+	return f;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+static uint32_t kernel_sse42(uint32_t crc, const uint8_t *p, size_t n)
+{
+	uint64_t c = crc;
+	for (; n >= 8; n -= 8, p += 8)
+		c = _mm_crc32_u64(c, load64(p));
+	crc = c;
+	for (; n; n--, p++)
+		crc = _mm_crc32_u8(crc, *p);
+	return crc;
+}
+
+// Combine three streams: c0 and c1 shifted forward over the blocks that follow them
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t fold3(uint64_t c0, uint64_t k0, uint64_t c1, uint64_t k1, uint64_t c2)
+{
+	__m128i p0 = _mm_clmulepi64_si128(_mm_cvtsi64_si128(c0), _mm_cvtsi64_si128(k0), 0x00);
+	__m128i p1 = _mm_clmulepi64_si128(_mm_cvtsi64_si128(c1), _mm_cvtsi64_si128(k1), 0x00);
+	uint64_t v = _mm_cvtsi128_si64(_mm_xor_si128(p0, p1));
+	return _mm_crc32_u64(0, v) ^ (uint32_t) c2;
+}
+
+// Three crc32 streams hide the instruction latency (3 cycles, 1 per cycle throughput)
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t blocks3(uint32_t crc, const uint8_t *&p, size_t &n, size_t len, uint64_t k, uint64_t k2)
+{
+	for (; n >= 3 * len; n -= 3 * len, p += 3 * len) {
+		uint64_t c0 = crc, c1 = 0, c2 = 0;
+		for (size_t i = 0; i < len; i += 8) {
+			c0 = _mm_crc32_u64(c0, load64(p + i));
+			c1 = _mm_crc32_u64(c1, load64(p + len + i));
+			c2 = _mm_crc32_u64(c2, load64(p + 2 * len + i));
+		}
+		crc = fold3(c0, k2, c1, k, c2);
+	}
+	return crc;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t kernel_sse42_pclmul(uint32_t crc, const uint8_t *p, size_t n)
+{
+	const fold& f = get_fold();
+	crc = blocks3(crc, p, n, LONG, f.k_long, f.k_long2);
+	crc = blocks3(crc, p, n, SHORT, f.k_short, f.k_short2);
+	return kernel_sse42(crc, p, n);
+}
+
+#define AVX512_CRC "avx512f,avx512vl,vpclmulqdq,pclmul,sse4.2"
+
+__attribute__((target(AVX512_CRC)))
+static inline __m128i fold128(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+}
+
+__attribute__((target(AVX512_CRC)))
+static inline __m512i fold512(__m512i x, __m512i k, __m512i data)
+{
+	return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00),
+			_mm512_clmulepi64_epi128(x, k, 0x11), data, 0x96);
+}
+
+// Four 512-bit accumulators (256 bytes per round) folded with VPCLMULQDQ.
+// Once the data is in, accumulators are folded into a single 128-bit
+// chunk which is reduced with two crc32 steps.
+__attribute__((target(AVX512_CRC)))
+static uint32_t kernel_avx512(uint32_t crc, const uint8_t *p, size_t n)
+{
+	if (n < 512)
+		return kernel_sse42_pclmul(crc, p, n);
+
+	const fold& f = get_fold();
+
+	// Initial value goes into the first 32 bits of the data
+	__m512i z[4];
+	z[0] = _mm512_xor_si512(_mm512_loadu_si512(p), _mm512_set_epi64(0, 0, 0, 0, 0, 0, 0, crc));
+	for (unsigned int i = 1; i < 4; i++)
+		z[i] = _mm512_loadu_si512(p + i * 64);
+	p += 256; n -= 256;
+
+	__m512i k = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i *) f.k2048));
+	for (; n >= 256; p += 256, n -= 256)
+		for (unsigned int i = 0; i < 4; i++)
+			z[i] = fold512(z[i], k, _mm512_loadu_si512(p + i * 64));
+
+	k = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i *) f.k512));
+	__m512i a = z[0];
+	for (unsigned int i = 1; i < 4; i++)
+		a = fold512(a, k, z[i]);
+
+	__m128i k1 = _mm_load_si128((const __m128i *) f.k128);
+	__m128i x = _mm512_extracti32x4_epi32(a, 0);
+	x = _mm_xor_si128(fold128(x, k1), _mm512_extracti32x4_epi32(a, 1));
+	x = _mm_xor_si128(fold128(x, k1), _mm512_extracti32x4_epi32(a, 2));
+	x = _mm_xor_si128(fold128(x, k1), _mm512_extracti32x4_epi32(a, 3));
+
+	for (; n >= 16; p += 16, n -= 16)
+		x = _mm_xor_si128(fold128(x, k1), _mm_loadu_si128((const __m128i *) p));
+
+	uint64_t c = _mm_crc32_u64(0, _mm_cvtsi128_si64(x));
+	c = _mm_crc32_u64(c, _mm_extract_epi64(x, 1));
+	return kernel_sse42(c, p, n);
+}
+
+#elif defined(__aarch64__)
+
+__attribute__((target("+crc")))
+static uint32_t kernel_armv8(uint32_t crc, const uint8_t *p, size_t n)
+{
+	for (; n >= 8; n -= 8, p += 8)
+		crc = __crc32cd(crc, load64(p));
+	for (; n; n--, p++)
+		crc = __crc32cb(crc, *p);
+	return crc;
+}
+
+#endif
+
+struct kernel {
+	kernel_fn   fn;
+	const char *name;
+};
+
+static kernel pick_kernel()
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+			__builtin_cpu_supports("vpclmulqdq") && __builtin_cpu_supports("pclmul")) {
+		get_fold();
+		return { kernel_avx512, "avx512-vpclmul" };
+	}
+	if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+		get_fold();
+		return { kernel_sse42_pclmul, "sse42-pclmul" };
+	}
+	if (__builtin_cpu_supports("sse4.2"))
+		return { kernel_sse42, "sse42" };
+#elif defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		return { kernel_armv8, "armv8-crc" };
+#endif
+	get_tables();
+	return { kernel_scalar, "scalar" };
+}
+
+static const kernel& get_kernel()
+{
+	static const kernel k = pick_kernel();
+	return k;
+}
+
+const char *kernel_name()
+{
+	return get_kernel().name;
+}
+
+uint32_t update(uint32_t crc, const void *data, size_t n)
+{
+	return ~get_kernel().fn(~crc, (const uint8_t *) data, n);
+}
+
+} // namespace crc32c
+} // namespace iodme
@@ -0,0 +1,211 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <hogl/post.hpp>
+
+#include "iodme/file-syncer.hpp"
+
+namespace iodme {
+
+const file_syncer::options file_syncer::default_options = {
+	.policy = SYNC_RANGE,
+	.group_time_ns = 10 * 1000000ULL,
+	.group_bytes = 256 * 1024 * 1024ULL,
+	.max_unsynced = 1024 * 1024 * 1024ULL,
+	.in_poll_period_ns = 100000
+};
+
+// Take room in the un-synced window, if there is any.
+// Allow at least one file in flight regardless of the size.
+bool file_syncer::reserve(uint64_t size)
+{
+	uint64_t u = _unsynced.load(std::memory_order_relaxed);
+	while (!u || u + size <= _opts.max_unsynced) {
+		if (_unsynced.compare_exchange_weak(u, u + size, std::memory_order_relaxed))
+			return true;
+	}
+	return false;
+}
+
+void file_syncer::sync(int fd, uint64_t size)
+{
+	// Start writeback now, by the time we get to fsync most of it is done
+	sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+
+	// Bounded window. Block until the syncer gives some of it back.
+	// Same protocol as notify_queue::pop_wait(), the fence pairs with finish().
+	bool ok = reserve(size);
+	while (!ok && !_killed) {
+		uint32_t seq = _window_seq.load(std::memory_order_acquire);
+		_window_waiters.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		// Recheck after announcing ourselves, the syncer may have missed us
+		ok = reserve(size);
+		if (!ok) {
+			struct timespec ts = {
+				(time_t) (default_wait.block_ns / 1000000000),
+				(long)   (default_wait.block_ns % 1000000000)
+			};
+			syscall(SYS_futex, (uint32_t *) &_window_seq, FUTEX_WAIT_PRIVATE, seq, &ts, NULL, 0);
+		}
+
+		_window_waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	// Shutting down, the file still gets synced
+	if (!ok)
+		_unsynced.fetch_add(size, std::memory_order_relaxed);
+
+	entry e = { fd, size };
+	while (!_q.push(e)) {
+		// Should not happen with a sane window size
+		iodme::thread::do_nanosleep(_opts.in_poll_period_ns);
+	}
+}
+
+bool file_syncer::do_sync(const entry& e)
+{
+	_m.syscalls.add();
+	if (fdatasync(e.fd) < 0) {
+		hogl::post(_area, _area->ERROR, "fdatasync failed: fd %d %s(%d)", e.fd, strerror(errno), errno);
+		return false;
+	}
+	return true;
+}
+
+// Drop cached pages and close the file.
+// Only the files that made it to the disk count as done.
+void file_syncer::finish(const entry& e, bool ok)
+{
+	posix_fadvise(e.fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(e.fd);
+	_unsynced.fetch_sub(e.size, std::memory_order_relaxed);
+
+	// Let the blocked writers recheck the window (file sizes differ, wake them all)
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (_window_waiters.load(std::memory_order_relaxed)) {
+		_window_seq.fetch_add(1, std::memory_order_relaxed);
+		syscall(SYS_futex, (uint32_t *) &_window_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
+
+	if (!ok) {
+		_m.errors.add();
+		return;
+	}
+	_m.frames.add();
+	_m.bytes.add(e.size);
+}
+
+// Sync the batch file by file. Writeback was started on hand-off, so by now
+// most of it is done and the syncs mostly wait for the stragglers and commit
+// the metadata. Unlike syncfs() this does not flush unrelated data and
+// reports errors per file.
+void file_syncer::commit_batch()
+{
+	hogl::post(_area, _area->DEBUG, "group-commit: files %u bytes %llu", _batch.size(), _batch_bytes);
+
+	uint64_t start = iodme::thread::now_ns();
+
+	std::vector<bool> ok;
+	for (auto& e : _batch)
+		ok.push_back(do_sync(e));
+
+	_fsync_ns.record(iodme::thread::now_ns() - start);
+
+	for (size_t i = 0; i < _batch.size(); i++)
+		finish(_batch[i], ok[i]);
+
+	_batch.clear();
+	_batch_bytes = 0;
+}
+
+void file_syncer::loop()
+{
+	hogl::post(_area, _area->INFO, "syncer loop: policy %s group-time %llu group-bytes %llu max-unsynced %llu",
+			_opts.policy == SYNC_GROUP ? "group" : "range",
+			_opts.group_time_ns, _opts.group_bytes, _opts.max_unsynced);
+
+	entry e;
+	while (1) {
+		// Don't sleep past the group commit deadline
+		iodme::wait_strategy ws = default_wait;
+		if (_opts.policy == SYNC_GROUP && !_batch.empty()) {
+			uint64_t elapsed = iodme::thread::now_ns() - _batch_start_ns;
+			ws.block_ns = elapsed < _opts.group_time_ns ? _opts.group_time_ns - elapsed : 0;
+		}
+
+		bool got = _killed ? _q.pop(e) : _q.pop_wait(e, ws);
+		if (!got && _killed && _batch.empty())
+			break;
+
+		if (_opts.policy == SYNC_RANGE) {
+			if (!got)
+				continue;
+
+			uint64_t start = iodme::thread::now_ns();
+			bool ok = do_sync(e);
+			_fsync_ns.record(iodme::thread::now_ns() - start);
+			finish(e, ok);
+			continue;
+		}
+
+		// Group commit
+		uint64_t now = iodme::thread::now_ns();
+		if (got) {
+			if (_batch.empty())
+				_batch_start_ns = now;
+			_batch.push_back(e);
+			_batch_bytes += e.size;
+		}
+
+		if (!_batch.empty() && (_killed || _batch_bytes >= _opts.group_bytes ||
+					now - _batch_start_ns >= _opts.group_time_ns)) {
+			commit_batch();
+			continue;
+		}
+	}
+}
+
+} // namespace iodme
@@ -32,12 +32,15 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/xattr.h>
 
 #include <hogl/area.hpp>
 #include <hogl/mask.hpp>
@@ -45,68 +48,182 @@
 
 #include "iodme/mover.hpp"
 #include "iodme/file-writer.hpp"
+#include "iodme/crc32c.hpp"
 
 #include <string>
 
 namespace iodme {
 
-bool file_writer::do_write(iodme::mover& dme, buffer& b)
-{
-	unsigned int open_flags = O_CREAT | O_TRUNC | O_WRONLY |
-				(_flags & DIRECTIO ? O_DIRECT : 0);
+const file_writer::options file_writer::default_options = {
+	.flags = 0,
+	.in_wait = default_wait,
+	.io_depth = 32,
+	.segment_size = 1024ULL * 1024 * 1024,
+	.segment_time_ns = 0,
+	.syncer = 0,
+	.sequencer = 0,
+	.tracer = 0,
+	.reclaimer = 0
+};
 
-	std::string ofile(_odir);
+std::string file_writer::output_name(const std::string& odir, const char *name, uint64_t seqno)
+{
+	std::string ofile(odir);
 		ofile += '/';
-		ofile += b.meta->name;
+		ofile += name;
 		ofile += '.';
 		char seqno_str[128] {0};
-		std::sprintf(seqno_str, "%06lu", b.meta->seqno);
+		std::sprintf(seqno_str, "%06lu", seqno);
 		ofile += seqno_str;
+	return ofile;
+}
 
-	// See if we need to pad the data for O_DIRECT
-	uint32_t pad = 0;
-	if ((open_flags & O_DIRECT)) {
-		pad = b.size % directio_block;
-		if (pad) {
-			pad = directio_block - pad;
-			if (pad > b.room()) {
-				// This is unlikely since all our buffers are multiple of 1KB
-				// So either we don't need the pad or we always have room for it.
-				hogl::post(_area, _area->WARN, "no room for direct-io pad; doing regular-io %s: %s(%d).",
-					ofile, strerror(errno), errno);
-				open_flags &= ~O_DIRECT;
-			} else {
-				memset(b.end(), 0, pad);
-				b.put(pad);
-			}
-		}
+// Parse the seqno part of a file name. Returns false if it's not all digits.
+static bool parse_seqno(const char *s, size_t len, uint64_t& seqno)
+{
+	if (!len)
+		return false;
+	seqno = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (s[i] < '0' || s[i] > '9')
+			return false;
+		seqno = seqno * 10 + (s[i] - '0');
 	}
+	return true;
+}
 
-	hogl::post(_area, _area->DEBUG, "open-start %s size %llu pad %u", ofile, b.size, pad);
+// Inverse of output_name(), segments have the .seg suffix
+bool file_writer::parse_output_name(const std::string& file, std::string& name, uint64_t& seqno, bool& seg)
+{
+	std::string base = file;
+	seg = false;
+	if (base.size() > 4 && !base.compare(base.size() - 4, 4, ".seg")) {
+		base.resize(base.size() - 4);
+		seg = true;
+	}
 
-	int fd = open(ofile.c_str(), open_flags, 0666);
-	if (fd < 0) {
-		hogl::post(_area, _area->ERROR, "failed open output file %s: %s(%d).",
-				ofile, strerror(errno), errno);
+	size_t dot = base.rfind('.');
+	if (dot == std::string::npos || !dot)
 		return false;
+	if (!parse_seqno(base.c_str() + dot + 1, base.size() - dot - 1, seqno))
+		return false;
+
+	name = base.substr(0, dot);
+	return true;
+}
+
+const char *file_writer::CRC_XATTR = "user.iodme.crc32c";
+
+bool file_writer::set_crc_xattr(int fd, const std::string& path, uint32_t crc)
+{
+	char v[16];
+	int n = snprintf(v, sizeof(v), "%08x", crc);
+	if (fd != -1)
+		return fsetxattr(fd, CRC_XATTR, v, n, 0) == 0;
+	return setxattr(path.c_str(), CRC_XATTR, v, n, 0) == 0;
+}
+
+// Keep the frame checksum (if any) with the output file
+void file_writer::store_crc(int fd, const std::string& path, const buffer& b)
+{
+	if (!(b.meta->flags & buffer::metadata::HAS_CRC) || _xattr_failed)
+		return;
+
+	if (!set_crc_xattr(fd, path, b.meta->crc)) {
+		hogl::post(_area, _area->WARN, "failed to store checksum of %s: %s(%d); checksums won't be kept",
+				path, strerror(errno), errno);
+		_xattr_failed = true;
+	}
+}
+
+// Check the data against the checksum that came with the frame.
+// Frames without one get it computed here. Corrupted frames are still
+// written (with the original checksum), so that they can be found later.
+void file_writer::check_crc(buffer& b)
+{
+	uint64_t start = now_ns();
+	uint32_t crc = iodme::crc32c::compute(b.base, b.size);
+	_crc_ns.record(now_ns() - start);
+
+	if (!(b.meta->flags & buffer::metadata::HAS_CRC)) {
+		b.meta->crc = crc;
+		b.meta->flags |= buffer::metadata::HAS_CRC;
+		return;
+	}
+
+	if (crc != b.meta->crc) {
+		hogl::post(_area, _area->ERROR, "checksum mismatch: stream %s seqno %llu crc %08x expected %08x",
+				b.meta->name, b.meta->seqno, crc, b.meta->crc);
+		_crc_errors.add();
+	}
+}
+
+std::string file_writer::output_name(const buffer& b) const
+{
+	return output_name(_odir, b.meta->name, b.meta->seqno);
+}
+
+// Sequencer lookups take a global lock, keep the streams we've seen
+iodme::sequencer::stream& file_writer::seq_stream(const buffer& b)
+{
+	auto it = _seq_streams.find(b.meta->name);
+	if (it == _seq_streams.end())
+		it = _seq_streams.emplace(b.meta->name, &_seq->get_stream(b.meta->name)).first;
+	return *it->second;
+}
+
+// See if we need to pad the data for O_DIRECT.
+// Clears O_DIRECT from open_flags if the pad does not fit.
+uint32_t file_writer::add_directio_pad(buffer& b, unsigned int& open_flags, const std::string& ofile)
+{
+	if (!(open_flags & O_DIRECT))
+		return 0;
+
+	uint32_t pad = b.size % directio_block;
+	if (pad) {
+		pad = directio_block - pad;
+		if (pad > b.room()) {
+			// This is unlikely since all our buffers are multiple of 1KB
+			// So either we don't need the pad or we always have room for it.
+			hogl::post(_area, _area->WARN, "no room for direct-io pad; doing regular-io %s: %s(%d).",
+				ofile, strerror(errno), errno);
+			open_flags &= ~O_DIRECT;
+			return 0;
+		}
+
+		memset(b.end(), 0, pad);
+		b.put(pad);
 	}
 
+	return pad;
+}
+
+// Write buffer data into the fd.
+// If offset is -1 the data is written at the current file position.
+// Shared fds (file position is used by other writers) get positional writes only.
+bool file_writer::write_data(iodme::mover& dme, int fd, buffer& b, off_t offset, int& w_errno, bool shared_fd)
+{
 	struct iovec iov;
 	iov.iov_base = b.base;
 	iov.iov_len  = b.size;
 
-	hogl::post(_area, _area->DEBUG, "write-start %s", ofile);
+	uint64_t start = now_ns();
+	_m.syscalls.add();
 
 	bool w = true;
-	int  w_errno;
-	if (b.fd != -1) {
-		w = dme.do_write(fd, b.fd, b.size);
-		w_errno = errno;
-	} else if (_flags & SPLICE) {
-		w = dme.do_write(fd, &iov, 1);
+	if ((b.fd != -1 || (_flags & SPLICE)) && !shared_fd) {
+		// Splice and sendfile use the file position
+		if (offset != -1 && lseek(fd, offset, SEEK_SET) < 0) {
+			w_errno = errno;
+			return false;
+		}
+		if (b.fd != -1)
+			w = dme.do_write(fd, b.fd, b.size);
+		else
+			w = dme.do_write(fd, &iov, 1);
 		w_errno = errno;
 	} else {
-		ssize_t n = writev(fd, &iov, 1);
+		ssize_t n = offset == -1 ? writev(fd, &iov, 1) : pwritev(fd, &iov, 1, offset);
 		w_errno = errno;
 		if (n != b.size) {
 			if (n != -1) {
@@ -117,16 +234,77 @@ bool file_writer::do_write(iodme::mover& dme, buffer& b)
 		}
 	}
 
+	uint64_t end = now_ns();
+	_write_ns.record(end - start);
+	if (w) {
+		b.meta->trace[buffer::T_WRITE_END] = end;
+		_m.frames.add();
+		_m.bytes.add(b.size);
+	} else
+		_m.errors.add();
+
+	return w;
+}
+
+bool file_writer::do_write(iodme::mover& dme, buffer& b)
+{
+	unsigned int open_flags = O_CREAT | O_TRUNC | O_WRONLY |
+				(_flags & DIRECTIO ? O_DIRECT : 0);
+
+	// Sequenced frames are written under a temporary name and
+	// renamed when the sequencer publishes them
+	std::string ofile = output_name(b);
+	if (_seq)
+		ofile += ".part";
+
+	uint32_t pad = add_directio_pad(b, open_flags, ofile);
+	uint32_t fsize = b.size - pad;
+
+	hogl::post(_area, _area->DEBUG, "open-start %s size %llu pad %u", ofile, b.size, pad);
+
+	int fd = open(ofile.c_str(), open_flags, 0666);
+	if (fd < 0) {
+		hogl::post(_area, _area->ERROR, "failed open output file %s: %s(%d).",
+				ofile, strerror(errno), errno);
+		_m.errors.add();
+		if (_seq) {
+			iodme::sequencer::frame f;
+			f.seqno = b.meta->seqno;
+			_seq->complete(seq_stream(b), f);
+		}
+		return false;
+	}
+
+	hogl::post(_area, _area->DEBUG, "write-start %s", ofile);
+
+	int  w_errno;
+	bool w = write_data(dme, fd, b, -1, w_errno);
+
 	hogl::post(_area, _area->DEBUG, "write-end %s", ofile);
 
-	// Sync and drop cached pages
-	fsync(fd);
-	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	if (w)
+		store_crc(fd, ofile, b);
 
-	// Drop the pad (if any)
-	if (pad)
-		pad = ftruncate(fd, b.size - pad);
-	close(fd);
+	if (w && _syncer) {
+		// Drop the pad (if any) and let the syncer take it from here
+		if (pad)
+			pad = ftruncate(fd, fsize);
+		_syncer->sync(fd, fsize);
+	} else {
+		// Sync and drop cached pages
+		uint64_t sync_start = now_ns();
+		fsync(fd);
+		uint64_t sync_end = now_ns();
+		_fsync_ns.record(sync_end - sync_start);
+		if (w)
+			b.meta->trace[buffer::T_SYNC_END] = sync_end;
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+		// Drop the pad (if any)
+		if (pad)
+			pad = ftruncate(fd, b.size - pad);
+		close(fd);
+	}
 
 	hogl::post(_area, _area->DEBUG, "close-end %s", ofile);
 
@@ -135,13 +313,433 @@ bool file_writer::do_write(iodme::mover& dme, buffer& b)
 		unlink(ofile.c_str());
 	}
 
+	if (_seq) {
+		// Sequencer reports the file for retention once it's published
+		iodme::sequencer::frame f;
+		f.seqno = b.meta->seqno;
+		f.ok    = w;
+		f.part  = ofile;
+		f.path  = output_name(b);
+		f.size  = fsize;
+		_seq->complete(seq_stream(b), f);
+	} else if (w && _reclaimer)
+		_reclaimer->add(ofile, fsize);
+
+	return w;
+}
+
+void file_writer::close_segment(iodme::segment& seg)
+{
+	hogl::post(_area, _area->INFO, "segment-close %s frames %u size %llu", seg.path(), seg.frames(), seg.offset());
+
+	if (!seg.close(_syncer))
+		hogl::post(_area, _area->ERROR, "failed to close segment %s: %s(%d)",
+				seg.path(), strerror(seg.last_errno()), seg.last_errno());
+
+	if (_reclaimer)
+		_reclaimer->add(seg.path(), seg.disk_size());
+}
+
+// Close segments that are too old (or all of them)
+void file_writer::rotate_segments(bool all)
+{
+	uint64_t now = iodme::thread::now_ns();
+	for (auto& s : _segments) {
+		iodme::segment& seg = *s.second;
+		if (!seg.is_open())
+			continue;
+		if (all || (_seg_time_ns && seg.age_ns(now) >= _seg_time_ns))
+			close_segment(seg);
+	}
+}
+
+bool file_writer::do_append(iodme::mover& dme, buffer& b)
+{
+	uint64_t now = iodme::thread::now_ns();
+
+	std::unique_ptr<iodme::segment>& sp = _segments[b.meta->name];
+	if (!sp)
+		sp.reset(new iodme::segment());
+	iodme::segment& seg = *sp;
+
+	// Rotate if this frame does not fit or the segment is too old
+	if (seg.is_open() && seg.frames() &&
+			(seg.offset() + b.size > _seg_size || (_seg_time_ns && seg.age_ns(now) >= _seg_time_ns)))
+		close_segment(seg);
+
+	if (!seg.is_open()) {
+		std::string path = output_name(b) + ".seg";
+		if (!seg.open(path, (_flags & DIRECTIO ? O_DIRECT : 0), now)) {
+			hogl::post(_area, _area->ERROR, "failed open segment file %s: %s(%d).",
+					path, strerror(seg.last_errno()), seg.last_errno());
+			return false;
+		}
+		hogl::post(_area, _area->INFO, "segment-open %s", path);
+	}
+
+	// Padding stays in the segment, which keeps all frame offsets aligned for O_DIRECT
+	uint32_t frame_size = b.size;
+	unsigned int open_flags = seg.open_flags();
+	uint32_t pad = add_directio_pad(b, open_flags, seg.path());
+	if ((seg.open_flags() & O_DIRECT) && !(open_flags & O_DIRECT))
+		seg.drop_directio();
+
+	hogl::post(_area, _area->DEBUG, "append-start %s seqno %llu offset %llu size %u pad %u",
+			seg.path(), b.meta->seqno, seg.offset(), frame_size, pad);
+
+	int  w_errno;
+	bool w = write_data(dme, seg.fd(), b, seg.offset(), w_errno);
+
+	hogl::post(_area, _area->DEBUG, "append-end %s", seg.path());
+
+	if (!w) {
+		// Drop partially written data
+		hogl::post(_area, _area->ERROR, "append failed: %s(%d) : seqno %llu segment %s",
+				strerror(w_errno), w_errno, b.meta->seqno, seg.path());
+		if (ftruncate(seg.fd(), seg.offset()) < 0)
+			close_segment(seg);
+		return false;
+	}
+
+	// Keep the writeback streaming, segment is synced when it's closed
+	if (_syncer)
+		sync_file_range(seg.fd(), seg.offset(), b.size, SYNC_FILE_RANGE_WRITE);
+
+	bool has_crc = b.meta->flags & buffer::metadata::HAS_CRC;
+	seg.commit(b.meta->seqno, frame_size, b.size,
+			has_crc ? (uint32_t) iodme::segment::index_entry::CRC32C : 0, b.meta->crc);
+	return true;
+}
+
+// Append into the segment shared by all writers of the stream.
+// Room is reserved upfront so that writers can write in parallel,
+// the sequencer indexes the frames in order.
+bool file_writer::do_append_shared(iodme::mover& dme, buffer& b)
+{
+	iodme::sequencer::stream& s = seq_stream(b);
+	iodme::sequencer::frame f;
+	f.seqno = b.meta->seqno;
+	f.size  = b.size;
+	if (b.meta->flags & buffer::metadata::HAS_CRC) {
+		f.flags = iodme::segment::index_entry::CRC32C;
+		f.crc   = b.meta->crc;
+	}
+
+	std::string path = output_name(b) + ".seg";
+
+	// Padding keeps all frame offsets in the segment aligned for O_DIRECT.
+	// Frames that can't be padded can't go into a shared O_DIRECT segment.
+	unsigned int open_flags = (_flags & DIRECTIO ? O_DIRECT : 0);
+	uint32_t pad = add_directio_pad(b, open_flags, path);
+	if ((_flags & DIRECTIO) && !(open_flags & O_DIRECT)) {
+		hogl::post(_area, _area->ERROR, "can't pad frame for direct-io: seqno %llu", f.seqno);
+		_seq->complete(s, f);
+		return false;
+	}
+
+	if (!_seq->reserve(s, path, open_flags, b.size, f)) {
+		_seq->complete(s, f);
+		return false;
+	}
+
+	hogl::post(_area, _area->DEBUG, "append-start %s seqno %llu offset %llu size %u pad %u",
+			f.seg->path(), f.seqno, f.offset, f.size, pad);
+
+	int  w_errno;
+	bool w = write_data(dme, f.seg->fd(), b, f.offset, w_errno, true);
+
+	hogl::post(_area, _area->DEBUG, "append-end %s", f.seg->path());
+
+	if (!w) {
+		// Reserved range is left unused, index won't point to it
+		hogl::post(_area, _area->ERROR, "append failed: %s(%d) : seqno %llu segment %s",
+				strerror(w_errno), w_errno, f.seqno, f.seg->path());
+	} else if (_syncer) {
+		// Keep the writeback streaming, segment is synced when it's closed
+		sync_file_range(f.seg->fd(), f.offset, b.size, SYNC_FILE_RANGE_WRITE);
+	}
+
+	f.ok = w;
+	_seq->complete(s, f);
 	return w;
 }
 
+// Queue linked open -> write -> fsync -> fadvise -> close for a single frame.
+// Each frame owns a fixed file slot, so the ops can be chained without
+// knowing the fd upfront. Hard links make sure the close runs even if
+// the write fails.
+bool file_writer::submit_frame(iodme::uring& ring, unsigned int slot, uring_frame& f)
+{
+	unsigned int open_flags = O_CREAT | O_TRUNC | O_WRONLY |
+				(_flags & DIRECTIO ? O_DIRECT : 0);
+
+	f.ofile   = output_name(f.b);
+	if (_seq)
+		f.ofile += ".part";
+	f.pad     = add_directio_pad(f.b, open_flags, f.ofile);
+	f.pending = 0;
+	f.err     = 0;
+	f.start   = now_ns();
+
+	struct io_uring_sqe *sqe[5];
+	for (unsigned int i = 0; i < 5; i++) {
+		sqe[i] = ring.get_sqe();
+		if (!sqe[i]) {
+			// Should not happen, the ring is sized for io-depth frames
+			hogl::post(_area, _area->ERROR, "uring submission queue overflow");
+			return false;
+		}
+		sqe[i]->user_data = slot;
+	}
+
+	sqe[0]->opcode = IORING_OP_OPENAT;
+	sqe[0]->fd     = AT_FDCWD;
+	sqe[0]->addr   = (uint64_t) f.ofile.c_str();
+	sqe[0]->len    = 0666;
+	sqe[0]->open_flags = open_flags;
+	sqe[0]->file_index = slot + 1;
+
+	sqe[1]->opcode = IORING_OP_WRITE;
+	sqe[1]->fd     = slot;
+	sqe[1]->addr   = (uint64_t) f.b.base;
+	sqe[1]->len    = f.b.size;
+	sqe[1]->off    = 0;
+
+	sqe[2]->opcode = IORING_OP_FSYNC;
+	sqe[2]->fd     = slot;
+
+	sqe[3]->opcode = IORING_OP_FADVISE;
+	sqe[3]->fd     = slot;
+	sqe[3]->fadvise_advice = POSIX_FADV_DONTNEED;
+
+	sqe[4]->opcode = IORING_OP_CLOSE;
+	sqe[4]->file_index = slot + 1;
+
+	for (unsigned int i = 0; i < 4; i++)
+		sqe[i]->flags |= IOSQE_IO_HARDLINK;
+	for (unsigned int i = 1; i < 4; i++)
+		sqe[i]->flags |= IOSQE_FIXED_FILE;
+
+	// Stash the op index in the upper bits for error reporting
+	for (unsigned int i = 0; i < 5; i++)
+		sqe[i]->user_data |= (uint64_t) i << 32;
+
+	f.pending = 5;
+
+	hogl::post(_area, _area->DEBUG, "uring-submit %s slot %u size %llu pad %u", f.ofile, slot, f.b.size, f.pad);
+	return true;
+}
+
+// Hand the buffer back for reuse
+void file_writer::release(buffer& b)
+{
+	b.meta->trace[buffer::T_RELEASED] = now_ns();
+	if (_tracer)
+		_tracer->frame_done(*b.meta);
+
+	b.clear();
+	_out_q.push(b);
+}
+
+void file_writer::complete_frame(uring_frame& f)
+{
+	hogl::post(_area, _area->DEBUG, "uring-complete %s", f.ofile);
+
+	// Write and fsync are linked, both are done by now
+	uint64_t end = now_ns();
+	_write_ns.record(end - f.start);
+	if (!f.err) {
+		f.b.meta->trace[buffer::T_WRITE_END] = end;
+		f.b.meta->trace[buffer::T_SYNC_END]  = end;
+		_m.frames.add();
+		_m.bytes.add(f.b.size - f.pad);
+	} else
+		_m.errors.add();
+
+	// Drop the pad (if any)
+	if (f.pad && !f.err) {
+		if (truncate(f.ofile.c_str(), f.b.size - f.pad) < 0)
+			hogl::post(_area, _area->WARN, "failed to drop direct-io pad %s: %s(%d)", f.ofile, strerror(errno), errno);
+	}
+
+	if (!f.err)
+		store_crc(-1, f.ofile, f.b);
+
+	if (f.err) {
+		hogl::post(_area, _area->ERROR, "write failed: %s(%d) : removing %s", strerror(f.err), f.err, f.ofile);
+		unlink(f.ofile.c_str());
+	}
+
+	if (_seq) {
+		iodme::sequencer::frame sf;
+		sf.seqno = f.b.meta->seqno;
+		sf.ok    = !f.err;
+		sf.part  = f.ofile;
+		sf.path  = output_name(f.b);
+		sf.size  = f.b.size - f.pad;
+		_seq->complete(seq_stream(f.b), sf);
+	} else if (!f.err && _reclaimer)
+		_reclaimer->add(f.ofile, f.b.size - f.pad);
+
+	// Return for reuse
+	release(f.b);
+	f.b.reset();
+}
+
+// Make sure the kernel can run our op chains: all ops are there and
+// OPENAT/CLOSE take direct descriptors. Registers the fixed file slots.
+bool file_writer::setup_uring(iodme::uring& ring)
+{
+	static const uint8_t ops[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_FSYNC,
+		IORING_OP_FADVISE, IORING_OP_CLOSE };
+
+	if (ring.failed()) {
+		hogl::post(_area, _area->WARN, "io_uring setup failed: %s(%d); falling back to sync writes",
+				strerror(ring.last_errno()), ring.last_errno());
+		return false;
+	}
+
+	if (!ring.probe(ops, sizeof(ops))) {
+		hogl::post(_area, _area->WARN, "io_uring ops are not supported: %s(%d); falling back to sync writes",
+				strerror(ring.last_errno()), ring.last_errno());
+		return false;
+	}
+
+	// Sparse table of fixed files, one per slot
+	std::vector<int> files(_io_depth, -1);
+	if (!ring.register_files(files.data(), files.size())) {
+		hogl::post(_area, _area->WARN, "failed to register uring files: %s(%d); falling back to sync writes",
+				strerror(ring.last_errno()), ring.last_errno());
+		return false;
+	}
+
+	if (!ring.probe_direct_files(0)) {
+		hogl::post(_area, _area->WARN, "io_uring direct descriptors are not supported: %s(%d); falling back to sync writes",
+				strerror(ring.last_errno()), ring.last_errno());
+		return false;
+	}
+
+	return true;
+}
+
+void file_writer::loop_uring(iodme::uring& ring)
+{
+	static const char *op_name[] = { "open", "write", "fsync", "fadvise", "close" };
+
+	std::vector<uring_frame>  frames(_io_depth);
+	std::vector<buffer>       batch(_io_depth); // frames picked up from the input queue
+	std::vector<unsigned int> free_slots;
+	for (unsigned int i = 0; i < _io_depth; i++)
+		free_slots.push_back(_io_depth - 1 - i);
+
+	unsigned int inflight = 0;
+
+	while (!_killed || inflight) {
+		// Queue as many new frames as we have slots for, picked up in one go
+		unsigned int queued = 0;
+		size_t n = 0;
+		if (!_killed && !free_slots.empty()) {
+			// Block for input only if there is nothing else to do
+			n = inflight ? _in_q.pop(batch.data(), free_slots.size()) :
+					_in_q.pop_wait(batch.data(), free_slots.size(), _in_wait);
+		}
+
+		// Tell the sequencer about the whole batch before anything else,
+		// so that it does not give up on frames we're holding
+		if (_seq) {
+			for (size_t i = 0; i < n; i++)
+				_seq->begin(seq_stream(batch[i]), batch[i].meta->seqno);
+			_seq->expire();
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			unsigned int slot = free_slots.back();
+			uring_frame& f = frames[slot];
+			f.b = batch[i];
+
+			f.b.meta->trace[buffer::T_WR_POP] = now_ns();
+			if (_flags & CHECKSUM)
+				check_crc(f.b);
+
+			hogl::post(_area, _area->INFO, "in-buff: base %p size %u room %u capacity %u seqno %llu name %s",
+				f.b.base, f.b.size, f.b.room(), f.b.capacity, f.b.meta->seqno, f.b.meta->name);
+
+			if (!submit_frame(ring, slot, f)) {
+				if (_seq) {
+					iodme::sequencer::frame sf;
+					sf.seqno = f.b.meta->seqno;
+					_seq->complete(seq_stream(f.b), sf);
+				}
+				release(f.b);
+				f.b.reset();
+				continue;
+			}
+
+			free_slots.pop_back();
+			inflight++; queued++;
+		}
+
+		if (!inflight)
+			continue;
+
+		// Block for completions only if there is nothing new to pick up
+		bool wait = !queued && (_killed || free_slots.empty() || _in_q.empty());
+		_m.syscalls.add();
+		if (ring.submit(wait ? 1 : 0) < 0) {
+			hogl::post(_area, _area->ERROR, "uring submit failed: %s(%d)",
+				strerror(ring.last_errno()), ring.last_errno());
+			_failed = true;
+			break;
+		}
+
+		struct io_uring_cqe cqe;
+		while (ring.pop_cqe(cqe)) {
+			unsigned int slot = cqe.user_data & 0xffffffff;
+			unsigned int op   = cqe.user_data >> 32;
+			uring_frame& f = frames[slot];
+
+			int err = 0;
+			if (cqe.res < 0)
+				err = -cqe.res;
+			else if (op == 1 && (uint32_t) cqe.res != f.b.size) {
+				hogl::post(_area, _area->ERROR, "partial write: %u -> %d", f.b.size, cqe.res);
+				err = EIO;
+			}
+
+			if (err && !f.err) {
+				hogl::post(_area, _area->DEBUG, "uring %s failed %s: %s(%d)", op_name[op % 5], f.ofile, strerror(err), err);
+				f.err = err;
+			}
+
+			if (--f.pending)
+				continue;
+
+			complete_frame(f);
+			free_slots.push_back(slot);
+			inflight--;
+		}
+	}
+}
+
 void file_writer::loop()
 {
 	hogl::post(_area, _area->INFO, "data writer loop");
 
+	if ((_flags & URING) && _syncer)
+		hogl::post(_area, _area->INFO, "io_uring mode syncs in the submission chain; syncer is not used");
+
+	if ((_flags & URING) && (_flags & SEGMENT)) {
+		hogl::post(_area, _area->WARN, "io_uring mode does not support segments; using sync writes");
+	} else if (_flags & URING) {
+		// Ring has to fit all ops (5 per frame) for all frames in flight
+		iodme::uring ring(_io_depth * 5);
+		if (setup_uring(ring)) {
+			hogl::post(_area, _area->INFO, "using io_uring: io-depth %u", _io_depth);
+			loop_uring(ring);
+			return;
+		}
+	}
+
 	iodme::mover dme;
 	if (dme.failed()) {
 		hogl::post(_area, _area->ERROR, "data mover engine failed to init");
@@ -152,21 +750,41 @@ void file_writer::loop()
 
 	while (!_killed) {
 		// Get new buffer if we don't have any
-		if (!_in_q.pop(b)) {
-			// wait for buffers to be available
-			iodme::thread::do_nanosleep(_in_pp_ns);
+		if (!_in_q.pop_wait(b, _in_wait)) {
+			if (_seq)
+				_seq->expire();
+			if ((_flags & SEGMENT) && _seq)
+				_seq->rotate(false);
+			else if (_flags & SEGMENT)
+				rotate_segments(false);
 			continue;
 		}
 
+		// Sequencer must know we hold the frame before anything else
+		if (_seq) {
+			_seq->begin(seq_stream(b), b.meta->seqno);
+			_seq->expire();
+		}
+
+		b.meta->trace[buffer::T_WR_POP] = now_ns();
+		if (_flags & CHECKSUM)
+			check_crc(b);
+
 		hogl::post(_area, _area->INFO, "in-buff: base %p size %u room %u capacity %u seqno %llu name %s",
 				b.base, b.size, b.room(), b.capacity, b.meta->seqno, b.meta->name);
 
-		do_write(dme, b);
+		if ((_flags & SEGMENT) && _seq)
+			do_append_shared(dme, b);
+		else if (_flags & SEGMENT)
+			do_append(dme, b);
+		else
+			do_write(dme, b);
 
 		// Return for reuse
-		b.clear();
-		_out_q.push(b);
+		release(b);
 	}
+
+	rotate_segments(true);
 }
 
 } // namespace iodme
@@ -0,0 +1,331 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <algorithm>
+#include <mutex>
+#include <set>
+
+#include <hogl/post.hpp>
+
+#include "iodme/metrics.hpp"
+
+namespace iodme {
+namespace metrics {
+
+// ---- histogram ----
+
+histogram::histogram() :
+	_count(0),
+	_sum(0),
+	_max(0)
+{
+	for (unsigned int i = 0; i < BUCKETS; i++)
+		_buckets[i].store(0, std::memory_order_relaxed);
+}
+
+uint64_t histogram::bucket_max(unsigned int i)
+{
+	if (i < SUB_COUNT)
+		return i;
+	unsigned int e = (i >> SUB_BITS) + SUB_BITS - 1;
+	uint64_t m = SUB_COUNT + (i & (SUB_COUNT - 1));
+	uint64_t lo = m << (e - SUB_BITS);
+	return lo + (1ULL << (e - SUB_BITS)) - 1;
+}
+
+void histogram::read(snapshot& s) const
+{
+	s.buckets.resize(BUCKETS);
+	for (unsigned int i = 0; i < BUCKETS; i++)
+		s.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+	s.count = _count.load(std::memory_order_relaxed);
+	s.sum   = _sum.load(std::memory_order_relaxed);
+	s.max   = _max.load(std::memory_order_relaxed);
+}
+
+uint64_t histogram::snapshot::percentile(double p) const
+{
+	// Buckets and count are read separately, use the bucket total
+	uint64_t total = 0;
+	for (auto n : buckets)
+		total += n;
+	if (!total)
+		return 0;
+
+	uint64_t rank = (uint64_t) (p / 100.0 * total + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	uint64_t n = 0;
+	for (unsigned int i = 0; i < buckets.size(); i++) {
+		n += buckets[i];
+		if (n >= rank)
+			return std::min(bucket_max(i), max);
+	}
+	return max;
+}
+
+// ---- registry ----
+
+std::mutex& registry::mutex()
+{
+	static std::mutex m;
+	return m;
+}
+
+static std::set<group*>& registry_groups()
+{
+	static std::set<group*> g;
+	return g;
+}
+
+void registry::add(group *g)
+{
+	std::lock_guard<std::mutex> lock(mutex());
+	registry_groups().insert(g);
+}
+
+void registry::remove(group *g)
+{
+	std::lock_guard<std::mutex> lock(mutex());
+	registry_groups().erase(g);
+}
+
+bool registry::read(const std::string& grp, const std::string& name, uint64_t& v)
+{
+	std::lock_guard<std::mutex> lock(mutex());
+	for (group *g : registry_groups()) {
+		if (g->_name != grp)
+			continue;
+		for (auto& c : g->_counters)
+			if (c.first == name) {
+				v = c.second->get();
+				return true;
+			}
+	}
+	return false;
+}
+
+bool registry::read(const std::string& grp, const std::string& name, histogram::snapshot& s)
+{
+	std::lock_guard<std::mutex> lock(mutex());
+	for (group *g : registry_groups()) {
+		if (g->_name != grp)
+			continue;
+		for (auto& h : g->_histograms)
+			if (h.first == name) {
+				h.second->read(s);
+				return true;
+			}
+	}
+	return false;
+}
+
+static void json_key(std::string& out, const std::string& key)
+{
+	out += '"';
+	for (char c : key) {
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+	out += "\":";
+}
+
+std::string registry::json()
+{
+	static const double pct[] = { 50, 90, 99, 99.9 };
+	static const char *pct_name[] = { "p50", "p90", "p99", "p999" };
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	std::string out("{");
+	json_key(out, "timestamp");
+	out += std::to_string(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+	out += ',';
+	json_key(out, "stages");
+	out += '{';
+
+	std::lock_guard<std::mutex> lock(mutex());
+
+	bool first_group = true;
+	for (group *g : registry_groups()) {
+		if (!first_group) out += ',';
+		first_group = false;
+
+		json_key(out, g->_name);
+		out += '{';
+
+		bool first = true;
+		for (auto& c : g->_counters) {
+			if (!first) out += ',';
+			first = false;
+			json_key(out, c.first);
+			out += std::to_string(c.second->get());
+		}
+
+		for (auto& v : g->_gauges) {
+			if (!first) out += ',';
+			first = false;
+			json_key(out, v.first);
+			out += std::to_string(v.second());
+		}
+
+		for (auto& h : g->_histograms) {
+			histogram::snapshot s;
+			h.second->read(s);
+
+			if (!first) out += ',';
+			first = false;
+			json_key(out, h.first);
+			out += '{';
+			json_key(out, "count"); out += std::to_string(s.count); out += ',';
+			json_key(out, "sum");   out += std::to_string(s.sum);   out += ',';
+			json_key(out, "max");   out += std::to_string(s.max);
+			for (unsigned int i = 0; i < sizeof(pct) / sizeof(pct[0]); i++) {
+				out += ',';
+				json_key(out, pct_name[i]);
+				out += std::to_string(s.percentile(pct[i]));
+			}
+			out += '}';
+		}
+
+		out += '}';
+	}
+
+	out += "}}\n";
+	return out;
+}
+
+// ---- group ----
+
+group::group(const std::string& name) :
+	_name(name)
+{
+	registry::add(this);
+}
+
+group::~group()
+{
+	registry::remove(this);
+}
+
+counter& group::add_counter(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(registry::mutex());
+	_counters.push_back(std::make_pair(name, std::unique_ptr<counter>(new counter())));
+	return *_counters.back().second;
+}
+
+histogram& group::add_histogram(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(registry::mutex());
+	_histograms.push_back(std::make_pair(name, std::unique_ptr<histogram>(new histogram())));
+	return *_histograms.back().second;
+}
+
+void group::add_gauge(const std::string& name, const gauge& g)
+{
+	std::lock_guard<std::mutex> lock(registry::mutex());
+	_gauges.push_back(std::make_pair(name, g));
+}
+
+// ---- exporter ----
+
+const exporter::options exporter::default_options = {
+	.path = "/tmp/iodme-metrics.json",
+	.period_ns = 1000000000ULL
+};
+
+bool exporter::dump()
+{
+	std::string data = registry::json();
+	std::string tmp  = _opts.path + ".tmp";
+
+	int fd = open(tmp.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd < 0) {
+		hogl::post(_area, _area->ERROR, "failed to open %s: %s(%d)", tmp, strerror(errno), errno);
+		return false;
+	}
+
+	ssize_t n = write(fd, data.data(), data.size());
+	int w_errno = errno;
+	close(fd);
+
+	if (n != (ssize_t) data.size()) {
+		hogl::post(_area, _area->ERROR, "failed to write %s: %s(%d)", tmp, strerror(w_errno), w_errno);
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	if (rename(tmp.c_str(), _opts.path.c_str()) < 0) {
+		hogl::post(_area, _area->ERROR, "failed to rename %s: %s(%d)", tmp, strerror(errno), errno);
+		return false;
+	}
+
+	return true;
+}
+
+void exporter::loop()
+{
+	hogl::post(_area, _area->INFO, "metrics exporter: path %s period %llu nsec", _opts.path, _opts.period_ns);
+
+	uint64_t next = now_ns() + _opts.period_ns;
+	while (!_killed) {
+		// Sleep in small steps to respond to kill quickly
+		uint64_t now = now_ns();
+		if (now < next) {
+			do_nanosleep(std::min<uint64_t>(next - now, 10 * 1000000ULL));
+			continue;
+		}
+
+		dump();
+		next += _opts.period_ns;
+		if (next < now)
+			next = now + _opts.period_ns;
+	}
+
+	dump();
+}
+
+} // namespace metrics
+} // namespace iodme
@@ -0,0 +1,347 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include <hogl/post.hpp>
+
+#include "iodme/mirror.hpp"
+
+namespace iodme {
+
+const mirror::options mirror::default_options = {
+	.pipe_size = 0
+};
+
+// Max amount of data written into a file mirror at a time
+static const size_t FILE_CHUNK = 64 * 1024;
+
+// File writes that take longer than this count as stalls
+static const uint64_t FILE_STALL_NS = 10 * 1000000ULL;
+
+// Pipe slot accounting. Spliced socket data is made of skb fragments,
+// MSS sized on Ethernet. Assume at least this much data per slot.
+static const unsigned int SLOT_MIN_BYTES = 1024;
+static const unsigned int PIPE_SLOT_SIZE = 4096; // pipe size per slot (page)
+
+// Worst case number of slots a frame takes: header, data, and a partial
+// fragment at each end
+unsigned int mirror::frame_slots(uint64_t len)
+{
+	return 1 + (len + SLOT_MIN_BYTES - 1) / SLOT_MIN_BYTES + 1;
+}
+
+mirror::mirror(const std::string& name, const std::string& dest, int fd,
+		const iodme::proto::hello& h, const options& opts) :
+	thread(std::string("IODME-MIRROR") + std::to_string(fd)),
+	_dest(dest),
+	_fd(fd),
+	_pipe_size(0),
+	_pipe_slots(0),
+	_opts(opts),
+	_broken(false),
+	_in_frame(false),
+	_queued(0),
+	_slots(0),
+	_m(std::string("IODME-MIRROR") + std::to_string(fd) + "/" + name),
+	_skipped(_m.grp.add_counter("skipped")),
+	_overruns(_m.grp.add_counter("overruns"))
+{
+	_pipe_fd[0] = _pipe_fd[1] = -1;
+	_file_fd[0] = _file_fd[1] = -1;
+
+	if (pipe(_pipe_fd) < 0) {
+		hogl::post(_area, _area->ERROR, "failed to create mirror pipe: %s(%d)", strerror(errno), errno);
+		_failed = true;
+		return;
+	}
+
+	struct stat st;
+	if (fstat(_fd, &st) == 0 && S_ISREG(st.st_mode) && pipe(_file_fd) < 0) {
+		hogl::post(_area, _area->ERROR, "failed to create mirror file pipe: %s(%d)", strerror(errno), errno);
+		_failed = true;
+		return;
+	}
+
+	// Receiver never waits for the mirror
+	fcntl(_pipe_fd[1], F_SETFL, O_NONBLOCK);
+
+	// Splicing into a blocked socket holds the pipe lock, which would stall
+	// the receiver's tee(). Mirror thread polls instead.
+	fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+
+	// Pipe is all the buffering the destination gets, make it as large as allowed,
+	// but at least large enough for a frame and the hello
+	uint64_t need = (uint64_t) (frame_slots(h.frame_size) + 1) * PIPE_SLOT_SIZE;
+	uint64_t size = _opts.pipe_size ? _opts.pipe_size : max_pipe_size();
+	size = std::max(size, need);
+	if (size > INT32_MAX || fcntl(_pipe_fd[1], F_SETPIPE_SZ, (int) size) < 0) {
+		hogl::post(_area, _area->WARN, "failed to set mirror pipe size %llu: %s(%d)", size, strerror(errno), errno);
+		fcntl(_pipe_fd[1], F_SETPIPE_SZ, max_pipe_size());
+	}
+	_pipe_size  = fcntl(_pipe_fd[1], F_GETPIPE_SZ);
+	_pipe_slots = _pipe_size / PIPE_SLOT_SIZE;
+
+	// Every frame would be skipped
+	if (_pipe_size < need) {
+		hogl::post(_area, _area->ERROR, "mirror pipe (%u bytes) can't hold a frame of %u bytes, %llu bytes needed",
+				_pipe_size, h.frame_size, need);
+		_failed = true;
+		return;
+	}
+
+	// Pipe is empty, small writes are atomic
+	iodme::proto::hello w = h;
+	iodme::proto::encode_hello(w);
+	if (write(_pipe_fd[1], &w, sizeof(w)) != sizeof(w)) {
+		hogl::post(_area, _area->ERROR, "failed to queue mirror hello: %s(%d)", strerror(errno), errno);
+		_failed = true;
+		return;
+	}
+	_queued = sizeof(w);
+	_held.push_back({ _queued, 1 });
+	_slots  = 1;
+
+	_m.grp.add_gauge("slots", [this]() { return _slots.load(std::memory_order_relaxed); });
+}
+
+mirror::~mirror()
+{
+	// Whatever hasn't been drained by now is dropped
+	finish();
+	shutdown(_fd, SHUT_RDWR);
+	join();
+
+	close(_pipe_fd[0]);
+	if (_file_fd[0] >= 0) {
+		close(_file_fd[0]);
+		close(_file_fd[1]);
+	}
+	close(_fd);
+}
+
+void mirror::stop(const char *why)
+{
+	if (_broken.exchange(true))
+		return;
+
+	hogl::post(_area, _area->WARN, "stopping mirror to %s: %s", _dest, why);
+
+	// Unblock the mirror thread (sockets only, files just get a truncated frame at the end)
+	shutdown(_fd, SHUT_RDWR);
+}
+
+// Give back the slots of the frames the mirror thread has drained
+void mirror::release()
+{
+	int pending = 0;
+	ioctl(_pipe_fd[0], FIONREAD, &pending);
+
+	uint64_t drained = _queued - pending;
+	unsigned int slots = _slots.load(std::memory_order_relaxed);
+	while (!_held.empty() && _held.front().end <= drained) {
+		slots -= _held.front().slots;
+		_held.pop_front();
+	}
+	_slots.store(slots, std::memory_order_relaxed);
+}
+
+bool mirror::begin(const iodme::proto::frame_header& fh)
+{
+	_in_frame = false;
+	if (broken() || _pipe_fd[1] < 0)
+		return false;
+
+	// Either the whole frame fits or it's skipped.
+	// Partial frames can't be taken back out of the pipe.
+	release();
+
+	unsigned int need = frame_slots(fh.length);
+	unsigned int slots = _slots.load(std::memory_order_relaxed);
+	if (need > _pipe_slots - slots) {
+		_skipped.add();
+		return false;
+	}
+
+	iodme::proto::frame_header w = fh;
+	iodme::proto::encode_header(w);
+	if (write(_pipe_fd[1], &w, sizeof(w)) != sizeof(w)) {
+		_skipped.add();
+		return false;
+	}
+
+	_queued += sizeof(w);
+	_held.push_back({ _queued + fh.length, need });
+	_slots.store(slots + need, std::memory_order_relaxed);
+
+	_in_frame = true;
+	return true;
+}
+
+void mirror::tee(int pipe_fd, size_t n)
+{
+	if (!_in_frame)
+		return;
+
+	// Tee always starts at the head of the input pipe, short tee can't be resumed
+	ssize_t r = ::tee(pipe_fd, _pipe_fd[1], n, SPLICE_F_NONBLOCK);
+	if (r > 0)
+		_queued += r;
+	if (r != (ssize_t) n) {
+		_in_frame = false;
+		_overruns.add();
+		stop(r < 0 ? "no room in the pipe" : "pipe overrun");
+	}
+}
+
+void mirror::finish()
+{
+	if (_pipe_fd[1] < 0)
+		return;
+	close(_pipe_fd[1]);
+	_pipe_fd[1] = -1;
+}
+
+// File destination. The source pipe lock is held only while the chunk is moved
+// into the private pipe, the (blocking) file write holds the private pipe lock.
+void mirror::loop_file()
+{
+	size_t held = 0; // bytes in the private pipe
+	while (!_killed) {
+		if (!held) {
+			ssize_t r = splice(_pipe_fd[0], NULL, _file_fd[1], NULL, FILE_CHUNK,
+					SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (r < 0) {
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN) {
+					struct pollfd pfd = { _pipe_fd[0], POLLIN, 0 };
+					poll(&pfd, 1, 100);
+					continue;
+				}
+				hogl::post(_area, _area->ERROR, "mirror pipe failed: %s(%d)", strerror(errno), errno);
+				_m.errors.add();
+				_failed = true;
+				break;
+			}
+			if (!r)
+				break; // receiver is done and the pipe is drained
+			held = r;
+		}
+
+		uint64_t start = now_ns();
+		ssize_t r = splice(_file_fd[0], NULL, _fd, NULL, held, SPLICE_F_MOVE);
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR) continue;
+			if (!_killed && !broken()) {
+				hogl::post(_area, _area->ERROR, "mirror to %s failed: %s(%d)", _dest,
+						strerror(r < 0 ? errno : EIO), r < 0 ? errno : EIO);
+				_m.errors.add();
+				_failed = true;
+			}
+			stop("destination failed");
+			break;
+		}
+
+		// Destination can't keep up (eg dirty page throttling)
+		if (now_ns() - start > FILE_STALL_NS)
+			_m.stalls.add();
+
+		held -= r;
+		_m.syscalls.add();
+		_m.bytes.add(r);
+	}
+}
+
+// Socket destination, non-blocking splice straight from the pipe
+void mirror::loop_socket()
+{
+	while (!_killed) {
+		ssize_t r = splice(_pipe_fd[0], NULL, _fd, NULL, _pipe_size,
+				SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) {
+				// Wait for data in the pipe or room in the destination
+				int queued = 0;
+				ioctl(_pipe_fd[0], FIONREAD, &queued);
+
+				struct pollfd pfd;
+				pfd.fd     = queued ? _fd : _pipe_fd[0];
+				pfd.events = queued ? POLLOUT : POLLIN;
+				if (queued)
+					_m.stalls.add();
+				poll(&pfd, 1, 100);
+				continue;
+			}
+			if (!_killed && !broken()) {
+				hogl::post(_area, _area->ERROR, "mirror to %s failed: %s(%d)", _dest, strerror(errno), errno);
+				_m.errors.add();
+				_failed = true;
+			}
+			stop("destination failed");
+			break;
+		}
+		if (!r)
+			break; // receiver is done and the pipe is drained
+
+		_m.syscalls.add();
+		_m.bytes.add(r);
+	}
+}
+
+// Forward the pipe contents to the destination until the receiver is done
+void mirror::loop()
+{
+	hogl::post(_area, _area->INFO, "mirror to %s: pipe size %u%s", _dest, _pipe_size,
+			_file_fd[0] >= 0 ? " (file)" : "");
+
+	if (_file_fd[0] >= 0)
+		loop_file();
+	else
+		loop_socket();
+
+	hogl::post(_area, _area->INFO, "mirror to %s done", _dest);
+}
+
+} // namespace iodme
@@ -143,5 +143,44 @@ bool mover::do_write(int fd, int in_fd, size_t len)
 	return true;
 }
 
+// Splice in_fd -> pipe -> fd
+bool mover::do_splice(int fd, int in_fd, size_t len, size_t& moved, const std::vector<tee_sink *> *tees)
+{
+	moved = 0;
+
+	while (moved < len) {
+		ssize_t n, r;
+
+		// Fill the pipe from the input
+		n = splice(in_fd, NULL, _pipe_fd[1], NULL, std::min<size_t>(len - moved, _pipe_size),
+				SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			_errno = errno;
+			return false;
+		}
+		if (!n)
+			break; // EOF
+
+		// Hand out references to the pages before they leave the pipe
+		if (tees)
+			for (auto t : *tees)
+				t->tee(_pipe_fd[0], n);
+
+		// Drain the pipe into the output
+		while (n) {
+			r = splice(_pipe_fd[0], NULL, fd, NULL, n, SPLICE_F_MOVE);
+			if (r < 0) {
+				if (errno == EINTR) continue;
+				_errno = errno;
+				return false;
+			}
+			n -= r; moved += r;
+		}
+	}
+
+	return true;
+}
+
 } // namespace iodme
 
@@ -0,0 +1,388 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+
+#include <hogl/post.hpp>
+
+#include "iodme/netrx-reactor.hpp"
+#include "iodme/netrx.hpp"
+#include "iodme/payload.hpp"
+#include "iodme/crc32c.hpp"
+
+namespace iodme {
+
+bool netrx_reactor::set_events(conn& c, uint32_t events)
+{
+	struct epoll_event ev;
+	ev.events   = events;
+	ev.data.ptr = &c;
+	if (epoll_ctl(_epfd, EPOLL_CTL_MOD, c.sk, &ev) < 0) {
+		hogl::post(_area, _area->ERROR, "epoll_ctl failed: sk %d %s(%d)", c.sk, strerror(errno), errno);
+		return false;
+	}
+	return true;
+}
+
+void netrx_reactor::do_accept()
+{
+	while (1) {
+		int sk = accept4(_lsk, NULL, NULL, SOCK_NONBLOCK);
+		if (sk < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				hogl::post(_area, _area->ERROR, "accept failed: %s(%d).", strerror(errno), errno);
+			return;
+		}
+
+		std::unique_ptr<conn> c(new conn());
+		c->sk    = sk;
+		c->state = conn::HELLO;
+		c->got   = 0;
+		c->name  = std::string("data-stream-") + std::to_string(sk);
+
+		struct epoll_event ev;
+		ev.events   = EPOLLIN | EPOLLRDHUP;
+		ev.data.ptr = c.get();
+		if (epoll_ctl(_epfd, EPOLL_CTL_ADD, sk, &ev) < 0) {
+			hogl::post(_area, _area->ERROR, "epoll_ctl failed: sk %d %s(%d)", sk, strerror(errno), errno);
+			close(sk);
+			continue;
+		}
+
+		hogl::post(_area, _area->INFO, "new connection: sk %d", sk);
+		_conns[sk] = std::move(c);
+	}
+}
+
+// Tear down the connection. Partial frames are dropped.
+void netrx_reactor::drop(conn& c)
+{
+	hogl::post(_area, _area->INFO, "closing connection: sk %d stream %s", c.sk, c.name.c_str());
+
+	if (c.b.base) {
+		c.b.clear();
+		_in_q.push(c.b);
+	}
+
+	_starved.erase(std::remove(_starved.begin(), _starved.end(), &c), _starved.end());
+
+	epoll_ctl(_epfd, EPOLL_CTL_DEL, c.sk, NULL);
+	close(c.sk);
+	_conns.erase(c.sk);
+}
+
+// Attach a clean buffer to the frame.
+// If none are available stop polling the socket until one shows up.
+bool netrx_reactor::start_frame(conn& c)
+{
+	if (!_in_q.pop(c.b)) {
+		if (c.state != conn::WAIT_BUFFER) {
+			hogl::post(_area, _area->DEBUG, "waiting for buffer: stream %s", c.name.c_str());
+			_m.stalls.add();
+			c.state = conn::WAIT_BUFFER;
+			_starved.push_back(&c);
+			set_events(c, 0); // hangups and errors are still reported
+		}
+		return false;
+	}
+
+	if (c.fh.length > c.b.capacity) {
+		hogl::post(_area, _area->ERROR, "frame %llu is too large: length %u buffer capacity %u",
+				c.fh.seqno, c.fh.length, c.b.capacity);
+		_m.errors.add();
+		c.state = conn::HEADER;
+		return false;
+	}
+
+	if (c.state == conn::WAIT_BUFFER)
+		set_events(c, EPOLLIN | EPOLLRDHUP);
+
+	netrx::init_frame(c.b, c.name, c.fh.seqno);
+	c.b.meta->timestamp = c.fh.timestamp;
+	c.b.meta->trace[buffer::T_FIRST_RECV] = c.start; // frame header
+	netrx::set_crc(c.b, c.fh);
+	c.crc   = 0;
+	c.state = conn::PAYLOAD;
+
+	hogl::post(_area, _area->INFO, "new-frame: stream %s base %p capacity %u seqno %llu",
+			c.name.c_str(), c.b.base, c.b.capacity, c.b.meta->seqno);
+	return true;
+}
+
+// Read whatever is available, up to the end of the current frame.
+// Returns false if the connection is done.
+bool netrx_reactor::do_input(conn& c)
+{
+	while (1) {
+		uint8_t *p;
+		size_t   len;
+
+		switch (c.state) {
+		case conn::HELLO:
+			p   = (uint8_t *) &c.hello + c.got;
+			len = sizeof(c.hello) - c.got;
+			break;
+		case conn::HEADER:
+			p   = (uint8_t *) &c.fh + c.got;
+			len = sizeof(c.fh) - c.got;
+			break;
+		case conn::PAYLOAD:
+			p   = c.b.end();
+			len = c.fh.length - c.b.size;
+			break;
+		default:
+			return true;
+		}
+
+		ssize_t r = len ? recv(c.sk, p, len, 0) : 0;
+		if (len)
+			_m.syscalls.add();
+		if (r < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			if (errno == EINTR)
+				continue;
+			hogl::post(_area, _area->ERROR, "recv failed: stream %s %s(%d)", c.name.c_str(), strerror(errno), errno);
+			_m.errors.add();
+			return false;
+		}
+
+		if (!r && len) {
+			hogl::post(_area, _area->INFO, "client closed connection: stream %s", c.name.c_str());
+			return false;
+		}
+
+		switch (c.state) {
+		case conn::HELLO:
+			c.got += r;
+			if (c.got < sizeof(c.hello))
+				break;
+
+			if (!iodme::proto::decode_hello(c.hello) || !iodme::proto::valid_name(c.hello.name)) {
+				hogl::post(_area, _area->ERROR, "handshake failed: sk %d", c.sk);
+				return false;
+			}
+
+			if (c.hello.frame_size > _max_frame_size) {
+				hogl::post(_area, _area->ERROR, "stream %s frame-size %u does not fit into buffer size %u",
+						c.hello.name, c.hello.frame_size, _max_frame_size);
+				return false;
+			}
+
+			hogl::post(_area, _area->INFO, "hello: sk %d name %s frame-size %u rate-mhz %u",
+					c.sk, c.hello.name, c.hello.frame_size, c.hello.rate_mhz);
+
+			{
+				unsigned int rcvbuf = c.hello.frame_size * 2;
+				if (setsockopt(c.sk, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+					hogl::post(_area, _area->WARN, "Failed to set socket rcvbuf depth: %s(%d).",
+						strerror(errno), errno);
+			}
+
+			c.name  = c.hello.name;
+			c.state = conn::HEADER;
+			c.got   = 0;
+			break;
+
+		case conn::HEADER:
+			c.got += r;
+			if (c.got < sizeof(c.fh))
+				break;
+
+			if (!iodme::proto::decode_header(c.fh)) {
+				hogl::post(_area, _area->ERROR, "bad frame header: stream %s", c.name.c_str());
+				_m.errors.add();
+				return false;
+			}
+			c.got   = 0;
+			c.start = now_ns();
+
+			if (!start_frame(c))
+				return c.state == conn::WAIT_BUFFER;
+			break;
+
+		case conn::PAYLOAD:
+			// Checksum the data as it comes in, while it's still in the cache
+			if (_flags & CHECKSUM)
+				c.crc = iodme::crc32c::update(c.crc, c.b.end(), r);
+			c.b.put(r);
+			if (c.b.size < c.fh.length)
+				break;
+
+			// Complete frame, send it down the pipe.
+			// Yield to other connections after each frame.
+			c.b.meta->trace[buffer::T_RX_DONE] = now_ns();
+			_recv_ns.record(c.b.meta->trace[buffer::T_RX_DONE] - c.start);
+
+			if (_flags & VERIFY) {
+				size_t bad = iodme::payload::verify(c.b.base, c.b.size, c.fh.seqno);
+				if (bad) {
+					hogl::post(_area, _area->WARN, "stream %s frame %llu : %u corrupted blocks",
+							c.name.c_str(), c.fh.seqno, bad);
+					_verify_errors.add();
+				}
+			}
+
+			if ((_flags & CHECKSUM) && (c.b.meta->flags & buffer::metadata::HAS_CRC) && c.crc != c.b.meta->crc) {
+				hogl::post(_area, _area->WARN, "stream %s frame %llu : checksum mismatch",
+						c.name.c_str(), c.fh.seqno);
+				_crc_errors.add();
+			}
+
+			_m.frames.add();
+			_m.bytes.add(c.b.size);
+			_out_q.push(c.b); c.b.reset();
+			c.state = conn::HEADER;
+			return true;
+
+		default:
+			break;
+		}
+	}
+}
+
+// Feed starved streams in arrival order
+void netrx_reactor::feed_starved()
+{
+	while (!_starved.empty()) {
+		conn *c = _starved.front();
+		if (!start_frame(*c)) {
+			if (c->state != conn::WAIT_BUFFER)
+				drop(*c);
+			else
+				break; // out of buffers
+			continue;
+		}
+		_starved.erase(_starved.begin());
+	}
+}
+
+void netrx_reactor::loop()
+{
+	hogl::post(_area, _area->INFO, "reactor loop: max-frame-size %u", _max_frame_size);
+
+	_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epfd < 0) {
+		hogl::post(_area, _area->ERROR, "epoll_create failed: %s(%d)", strerror(errno), errno);
+		_failed = true;
+		return;
+	}
+
+	struct epoll_event ev;
+	ev.events   = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _lsk, &ev) < 0) {
+		hogl::post(_area, _area->ERROR, "epoll_ctl failed: %s(%d)", strerror(errno), errno);
+		_failed = true;
+		close(_epfd);
+		return;
+	}
+
+	// Clean queue wakes us up when buffers come back (edge triggered, see notify_queue)
+	int qfd = _in_q.event_fd();
+	ev.events   = EPOLLIN | EPOLLET;
+	ev.data.ptr = &_in_q;
+	if (qfd < 0 || epoll_ctl(_epfd, EPOLL_CTL_ADD, qfd, &ev) < 0) {
+		hogl::post(_area, _area->WARN, "no buffer queue events, streams waiting for buffers are polled: %s(%d)",
+				strerror(errno), errno);
+		qfd = -1;
+	}
+
+	const unsigned int max_events = 64;
+	struct epoll_event events[max_events];
+
+	while (!_killed) {
+		feed_starved();
+
+		// Announce ourselves and recheck, the buffers may have come back in the meantime
+		if (qfd >= 0 && !_starved.empty() && !_buffer_wait) {
+			_in_q.add_event_waiter();
+			_buffer_wait = true;
+			feed_starved();
+		} else if (_starved.empty() && _buffer_wait) {
+			_in_q.remove_event_waiter();
+			_buffer_wait = false;
+		}
+
+		// Timeout is only a fallback, unless there are no queue events
+		int timeout_ms = (qfd < 0 && !_starved.empty()) ? 1 : 100;
+
+		int n = epoll_wait(_epfd, events, max_events, timeout_ms);
+		if (n < 0 && errno != EINTR) {
+			hogl::post(_area, _area->ERROR, "epoll_wait failed: %s(%d)", strerror(errno), errno);
+			_failed = true;
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.ptr == &_in_q)
+				continue; // buffers came back, starved streams are fed next round
+
+			conn *c = (conn *) events[i].data.ptr;
+			if (!c) {
+				do_accept();
+				continue;
+			}
+
+			bool ok = true;
+			if (events[i].events & EPOLLIN)
+				ok = do_input(*c);
+			else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				ok = false;
+
+			if (!ok)
+				drop(*c);
+		}
+	}
+
+	if (_buffer_wait) {
+		_in_q.remove_event_waiter();
+		_buffer_wait = false;
+	}
+
+	while (!_conns.empty())
+		drop(*_conns.begin()->second);
+
+	close(_epfd);
+}
+
+} // namespace iodme
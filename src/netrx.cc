@@ -40,29 +40,302 @@
 #include <sys/socket.h>
 #include <sys/uio.h>
 
+#include <algorithm>
+
 #include <hogl/post.hpp>
 
 #include "iodme/netrx.hpp"
+#include "iodme/file-writer.hpp"
+#include "iodme/payload.hpp"
+#include "iodme/crc32c.hpp"
 
 namespace iodme {
 
+const netrx::options netrx::default_options = {
+	.flags = 0,
+	.odir = "/tmp",
+	.frame_size = 4 * 1024 * 1024,
+	.syncer = 0,
+	.in_wait = default_wait,
+	.reclaimer = 0
+};
+
+// Log receive error or EOF
+void netrx::recv_failed(const char *what)
+{
+	if (errno == ECONNRESET && !_killed) {
+		hogl::post(_area, _area->INFO, "client closed connection");
+		return;
+	}
+
+	if (!_killed) {
+		hogl::post(_area, _area->ERROR, "%s failed. %s(%d)", what, strerror(errno), errno);
+		_m.errors.add();
+		_failed = true;
+	}
+}
+
+// Checksummed frames are received in chunks of this size (CHECKSUM mode)
+static const size_t CRC_CHUNK = 256 * 1024;
+
+// Receive the frame in chunks and checksum each one while it's still in the cache
+bool netrx::recv_crc(uint8_t *data, size_t len, uint32_t& crc, uint64_t& calls)
+{
+	for (size_t off = 0; off < len; off += CRC_CHUNK) {
+		size_t n = std::min(CRC_CHUNK, len - off);
+		if (!iodme::proto::recv_all(_sk, data + off, n, &calls))
+			return false;
+		crc = iodme::crc32c::update(crc, data + off, n);
+	}
+	return true;
+}
+
+// Record the stream straight to disk.
+// Data goes socket -> pipe -> page cache without touching user memory.
+void netrx::loop_splice(iodme::mover& dme)
+{
+	bool raw = _opts.flags & RAW;
+
+	hogl::post(_area, _area->INFO, "splicing data stream %s into %s: %s",
+			_name, _opts.odir, raw ? "raw" : "framed");
+
+	uint64_t next_seqno = 0;
+	bool crc_failed = false; // filesystem can't store checksums
+
+	while (!_killed) {
+		uint64_t seqno = next_seqno++;
+		size_t   len   = _opts.frame_size;
+		iodme::proto::frame_header fh = {};
+
+		if (!raw) {
+			if (!iodme::proto::recv_header(_sk, fh)) {
+				recv_failed("recv frame header");
+				break;
+			}
+			seqno = fh.seqno;
+			len   = fh.length;
+		}
+
+		uint64_t start = now_ns();
+
+		std::string ofile = file_writer::output_name(_opts.odir, _name.c_str(), seqno);
+
+		int fd = open(ofile.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0666);
+		if (fd < 0) {
+			hogl::post(_area, _area->ERROR, "failed open output file %s: %s(%d).",
+					ofile, strerror(errno), errno);
+			_failed = true;
+			break;
+		}
+
+		hogl::post(_area, _area->DEBUG, "splice-start %s", ofile);
+
+		// Mirrors that have room get a reference to the frame pages
+		_tees.clear();
+		if (!raw)
+			for (auto &m : _mirrors)
+				if (m->begin(fh))
+					_tees.push_back(m.get());
+
+		size_t moved;
+		bool w = dme.do_splice(fd, _sk, len, moved, &_tees);
+
+		for (auto &m : _mirrors)
+			m->end();
+
+		hogl::post(_area, _area->DEBUG, "splice-end %s: %u bytes", ofile, moved);
+
+		// Framed streams never keep partial frames
+		if (!w || !moved || (!raw && moved < len)) {
+			close(fd);
+			unlink(ofile.c_str());
+
+			if (!w) {
+				hogl::post(_area, _area->ERROR, "splice failed: %s(%d) : removing %s",
+						strerror(dme.last_errno()), dme.last_errno(), ofile);
+				_m.errors.add();
+				_failed = true;
+			} else
+				hogl::post(_area, _area->INFO, "client closed connection");
+			break;
+		}
+
+		_recv_ns.record(now_ns() - start);
+		_m.frames.add();
+		_m.bytes.add(moved);
+
+		// Data never shows up in user memory, so the checksum is kept as is
+		if ((fh.flags & iodme::proto::FRAME_CRC32C) && !crc_failed) {
+			if (!file_writer::set_crc_xattr(fd, ofile, fh.crc)) {
+				hogl::post(_area, _area->WARN, "failed to store checksum of %s: %s(%d); checksums won't be kept",
+						ofile, strerror(errno), errno);
+				crc_failed = true;
+			}
+		}
+
+		if (_opts.syncer) {
+			_opts.syncer->sync(fd, moved);
+		} else {
+			// Sync and drop cached pages
+			uint64_t sync_start = now_ns();
+			fsync(fd);
+			_fsync_ns.record(now_ns() - sync_start);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+
+		if (_opts.reclaimer)
+			_opts.reclaimer->add(ofile, moved);
+
+		hogl::post(_area, _area->INFO, "new-frame: seqno %llu size %u", seqno, moved);
+
+		if (moved < len) {
+			hogl::post(_area, _area->INFO, "client closed connection");
+			break;
+		}
+	}
+
+	finish_mirrors();
+}
+
+// Max time mirrors get to drain after the end of the stream
+static const uint64_t MIRROR_DRAIN_NS = 5 * 1000000000ULL;
+
+// Let the mirrors drain what's left of the stream.
+// Stuck ones are dropped when netrx goes away.
+void netrx::finish_mirrors()
+{
+	for (auto &m : _mirrors)
+		m->finish();
+
+	uint64_t deadline = now_ns() + MIRROR_DRAIN_NS;
+	for (auto &m : _mirrors)
+		while (m->running() && !_killed && now_ns() < deadline)
+			do_nanosleep(1000 * 1000);
+}
+
+// Receive exactly one frame per buffer
+void netrx::loop_framed()
+{
+	iodme::buffer b;
+
+	uint64_t calls = 0;
+
+	while (!_killed) {
+		iodme::proto::frame_header fh;
+		if (!iodme::proto::recv_header(_sk, fh)) {
+			recv_failed("recv frame header");
+			break;
+		}
+
+		uint64_t start = now_ns();
+
+		// Get new buffer
+		if (!_in_q.pop(b)) {
+			_m.stalls.add();
+			while (!_killed && !_in_q.pop_wait(b, _opts.in_wait)) {
+				// wait for buffers to be available
+				hogl::post(_area, _area->DEBUG, "waiting for buffer");
+			}
+		}
+		if (_killed)
+			break;
+
+		if (fh.length > b.capacity) {
+			hogl::post(_area, _area->ERROR, "frame %llu is too large: length %u buffer capacity %u",
+					fh.seqno, fh.length, b.capacity);
+			_m.errors.add();
+			_failed = true;
+			break;
+		}
+
+		uint64_t seqno = fh.seqno;
+		new_frame(b, seqno);
+		b.meta->timestamp = fh.timestamp;
+		b.meta->trace[buffer::T_FIRST_RECV] = start; // frame header
+		set_crc(b, fh);
+
+		hogl::post(_area, _area->DEBUG, "calling recv: sk %d frame-length %u", _sk, fh.length);
+
+		calls = 1; // header
+		uint32_t crc = 0;
+		bool r = (_opts.flags & CHECKSUM) ?
+				recv_crc(b.base, fh.length, crc, calls) :
+				iodme::proto::recv_all(_sk, b.base, fh.length, &calls);
+		if (!r) {
+			recv_failed("recv");
+			break;
+		}
+		b.put(fh.length);
+
+		b.meta->trace[buffer::T_RX_DONE] = now_ns();
+		_recv_ns.record(b.meta->trace[buffer::T_RX_DONE] - start);
+
+		if (_opts.flags & VERIFY) {
+			size_t bad = iodme::payload::verify(b.base, b.size, fh.seqno);
+			if (bad) {
+				hogl::post(_area, _area->WARN, "frame %llu : %u corrupted blocks", fh.seqno, bad);
+				_verify_errors.add();
+			}
+		}
+
+		if ((_opts.flags & CHECKSUM) && (b.meta->flags & buffer::metadata::HAS_CRC) && crc != b.meta->crc) {
+			hogl::post(_area, _area->WARN, "frame %llu : checksum mismatch", fh.seqno);
+			_crc_errors.add();
+		}
+
+		_m.syscalls.add(calls);
+		_m.frames.add();
+		_m.bytes.add(fh.length);
+
+		_out_q.push(b); b.reset();
+	}
+
+	// Return unused buffer (partial frames are dropped)
+	if (b.base) {
+		b.clear();
+		_in_q.push(b);
+	}
+}
+
 void netrx::loop()
 {
 	hogl::post(_area, _area->INFO, "start data stream %s loop", _name);
 
+	if (_opts.flags & SPLICE) {
+		iodme::mover dme;
+		if (dme.failed()) {
+			hogl::post(_area, _area->ERROR, "data mover engine failed to init");
+			_failed = true;
+			return;
+		}
+		loop_splice(dme);
+		return;
+	}
+
+	if (_opts.flags & RAW)
+		loop_raw();
+	else
+		loop_framed();
+}
+
+void netrx::loop_raw()
+{
 	uint64_t seqno = 0;
+	uint64_t start = 0; // first recv into the current buffer
 	iodme::buffer b;
 
 	while (!_killed) {
 		// Get new buffer if we don't have any
 		if (!b.base) {
-			if (!_in_q.pop(b)) {
+			if (!_in_q.pop_wait(b, _opts.in_wait)) {
 				// wait for buffers to be available
 				hogl::post(_area, _area->DEBUG, "waiting for buffer");
-				iodme::thread::do_nanosleep(1000000);
+				_m.stalls.add();
 				continue;
 			}
 			new_frame(b, seqno);
+			start = now_ns();
 		}
 
 		hogl::post(_area, _area->DEBUG, "calling recv: sk %d buff-room %u", _sk, b.room());
@@ -70,9 +343,11 @@ void netrx::loop()
 		// Receive into the tail of the buffer
 		ssize_t r = recv(_sk, b.end(), b.room(), 0);
 		int r_errno = errno;
+		_m.syscalls.add();
 
 		if (r < 0) {
 			hogl::post(_area, _area->ERROR, "recv failed. %s(%d)", strerror(r_errno), r_errno);
+			_m.errors.add();
 			_failed = true;
 			break;
 		}
@@ -82,34 +357,46 @@ void netrx::loop()
 			break;
 		}
 
+		if (!b.size)
+			b.meta->trace[buffer::T_FIRST_RECV] = now_ns();
 		b.put(r);
+		_m.bytes.add(r);
 
 		hogl::post(_area, _area->DEBUG, "recv: %u bytes -- buffer: size %u, room %u", r, b.size, b.room());
 
 		if (!b.room()) {
 			// No more room in the buffer, send it down the pipe
 			hogl::post(_area, _area->WARN, "ran out of buffer space, potential stall");
+			b.meta->trace[buffer::T_RX_DONE] = now_ns();
+			_recv_ns.record(b.meta->trace[buffer::T_RX_DONE] - start);
+			_m.frames.add();
 			_out_q.push(b); b.reset();
 			continue;
 		}
 
 		// See if it's time to get a new buffer
-		// FIXME: enforce frame boundaries
+		// Raw streams carry no frame boundaries (see loop_framed())
 		if (b.room() < (b.capacity / 8)) {
 			iodme::buffer nb;
 			if (_in_q.pop(nb)) {
 				// Cool. Got a new buffer. 
 				// Send the old one off and use new.
+				b.meta->trace[buffer::T_RX_DONE] = now_ns();
+				_recv_ns.record(b.meta->trace[buffer::T_RX_DONE] - start);
+				_m.frames.add();
 				_out_q.push(b);
 				b = nb;
 				new_frame(b, seqno);
+				start = now_ns();
 			}
 		}
 	}
 
 	// Flush the last buffer (if needed)
-	if (b.size)
+	if (b.size) {
+		b.meta->trace[buffer::T_RX_DONE] = now_ns();
 		_out_q.push(b);
+	}
 }
 
 } // namespace iodme
@@ -32,6 +32,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
@@ -39,6 +40,8 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
 
 #include <hogl/post.hpp>
 
@@ -46,37 +49,235 @@
 
 namespace iodme {
 
-void nettx::loop()
+void nettx::release(buffer& b)
 {
-	buffer b;
-	while (!_killed) {
-		if (!_q.pop(b)) {
-			// FIXME: might be good to add condition var
-			usleep(100);
-			continue;
-		}
+	if (!_free_q) {
+		b.free();
+		return;
+	}
 
-		hogl::post(_area, _area->DEBUG, "sending chunk %llu size %u", b.meta->seqno, b.size);
+	if (b.base) {
+		b.clear();
+		_free_q->push(b);
+		b.reset();
+	}
+}
 
-		ssize_t r = send(_sk, b.base, b.size, 0);
+// Send the whole frame.
+// Each successful send() call with MSG_ZEROCOPY consumes one notification id.
+bool nettx::send_frame(conn& c, buffer& b)
+{
+	uint32_t off = 0;
+	while (off < b.size) {
+		ssize_t r = send(c.sk, b.base + off, b.size - off, c.send_flags);
 		if (_killed)
-			break;
+			return false;
+		_m.syscalls.add();
 
 		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS && (c.send_flags & MSG_ZEROCOPY)) {
+				// Ran out of optmem for pinned pages. Wait for some completions.
+				_m.stalls.add();
+				reap_zc_all(10);
+				continue;
+			}
 			hogl::post(_area, _area->ERROR, "send failed. %s(%d)", strerror(errno), errno);
+			_m.errors.add();
 			_failed = true;
-			break;
+			return false;
 		}
 
-		if (r != (ssize_t) b.size) {
+		if (c.send_flags & MSG_ZEROCOPY)
+			c.zc_next_id++;
+
+		if (r != (ssize_t) (b.size - off) && !(c.send_flags & MSG_ZEROCOPY)) {
 			// This shouldn't happen, so just issue a warning for now
-			hogl::post(_area, _area->WARN, "incomplete send: %llu -> %d", b.size, r);
+			hogl::post(_area, _area->WARN, "incomplete send: %llu -> %d", b.size - off, r);
 		}
 
-		b.free();
+		off += r;
+	}
+
+	return true;
+}
+
+// Read zerocopy completions from the socket error queue and release
+// the frames that the kernel no longer references.
+// Returns false if nothing was reaped.
+bool nettx::reap_zc(conn& c)
+{
+	bool reaped = false;
+
+	while (1) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(c.sk, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+			      (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+
+			struct sock_extended_err *serr = (struct sock_extended_err *) CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			// Completed range of ids is [ee_info, ee_data]. TCP completes them in order.
+			if ((int32_t) (serr->ee_data + 1 - c.zc_done) > 0)
+				c.zc_done = serr->ee_data + 1;
+
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				if (!_zc_copied++)
+					hogl::post(_area, _area->WARN, "kernel fell back to copying for zerocopy sends");
+			}
+			reaped = true;
+		}
+	}
+
+	while (!c.zc_pending.empty() && (int32_t) (c.zc_done - c.zc_pending.front().last_id) > 0) {
+		release(c.zc_pending.front().b);
+		c.zc_pending.pop_front();
+		_zc_pending--;
+	}
+
+	return reaped;
+}
+
+// Reap completions on all connections with frames in flight,
+// waiting up to timeout_ms for some to show up.
+void nettx::reap_zc_all(int timeout_ms)
+{
+	if (timeout_ms) {
+		std::vector<struct pollfd> pfds;
+		for (auto& c : _conns)
+			if (c && !c->zc_pending.empty())
+				pfds.push_back({ c->sk, 0, 0 }); // POLLERR is always reported
+		poll(pfds.data(), pfds.size(), timeout_ms);
+	}
+
+	for (auto& c : _conns)
+		if (c && !c->zc_pending.empty())
+			reap_zc(*c);
+}
+
+// Enable zerocopy and send the hello
+bool nettx::setup(conn& c)
+{
+	c.send_flags = 0;
+	if (_flags & ZEROCOPY) {
+		int one = 1;
+		if (setsockopt(c.sk, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+			hogl::post(_area, _area->WARN, "failed to enable zerocopy: %s(%d); using regular sends",
+					strerror(errno), errno);
+		} else
+			c.send_flags |= MSG_ZEROCOPY;
+	}
+
+	if (!(_flags & RAW)) {
+		hogl::post(_area, _area->INFO, "hello: name %s frame-size %u rate-mhz %u",
+				c.hello.name, c.hello.frame_size, c.hello.rate_mhz);
+
+		if (!iodme::proto::send_hello(c.sk, c.hello)) {
+			hogl::post(_area, _area->ERROR, "failed to send hello. %s(%d)", strerror(errno), errno);
+			return false;
+		}
 	}
 
-	b.free();
+	return true;
+}
+
+void nettx::loop()
+{
+	for (auto& c : _conns) {
+		if (c && !setup(*c)) {
+			_failed = true;
+			return;
+		}
+	}
+
+	buffer b;
+	while (!_killed) {
+		// Zerocopy completions need attention, so don't block for long
+		bool got;
+		if (_zc_pending) {
+			got = _q.pop(b);
+			if (!got) reap_zc_all(1);
+		} else
+			got = _q.pop_wait(b, _wait);
+		if (!got)
+			continue;
+
+		uint32_t stream = b.meta->stream;
+		if (stream >= _conns.size() || !_conns[stream]) {
+			hogl::post(_area, _area->ERROR, "dropping frame %llu : unknown stream %u", b.meta->seqno, stream);
+			_m.errors.add();
+			release(b);
+			continue;
+		}
+		conn& c = *_conns[stream];
+
+		hogl::post(_area, _area->DEBUG, "sending chunk %llu size %u stream %u", b.meta->seqno, b.size, stream);
+
+		uint64_t start = now_ns();
+
+		if (!(_flags & RAW)) {
+			bool has_crc = b.meta->flags & buffer::metadata::HAS_CRC;
+			iodme::proto::frame_header fh = {
+				iodme::proto::FRAME_MAGIC, b.size, b.meta->seqno, b.meta->timestamp,
+				has_crc ? b.meta->crc : 0, has_crc ? (uint32_t) iodme::proto::FRAME_CRC32C : 0 };
+			_m.syscalls.add();
+			if (!iodme::proto::send_header(c.sk, fh, MSG_MORE)) {
+				if (!_killed) {
+					hogl::post(_area, _area->ERROR, "send failed. %s(%d)", strerror(errno), errno);
+					_m.errors.add();
+					_failed = true;
+				}
+				break;
+			}
+		}
+
+		if (!send_frame(c, b))
+			break;
+
+		_send_ns.record(now_ns() - start);
+		_m.frames.add();
+		_m.bytes.add(b.size);
+
+		if (c.send_flags & MSG_ZEROCOPY) {
+			// Kernel still references the pages
+			zc_frame f = { b, c.zc_next_id - 1 };
+			c.zc_pending.push_back(f);
+			_zc_pending++;
+			b.reset();
+			reap_zc(c);
+			continue;
+		}
+
+		release(b);
+	}
+
+	release(b);
+
+	// Give the kernel a chance to complete outstanding sends.
+	// The sockets are shut down by the time we get here if we were killed,
+	// in which case the pages are released when skbs are freed.
+	for (unsigned int i = 0; i < 100 && _zc_pending && !_killed; i++)
+		reap_zc_all(10);
+
+	for (auto& c : _conns) {
+		while (c && !c->zc_pending.empty()) {
+			release(c->zc_pending.front().b);
+			c->zc_pending.pop_front();
+		}
+	}
+	_zc_pending = 0;
 }
 
 } // namespace iodme
@@ -0,0 +1,160 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include <string>
+
+#include "iodme/numa.hpp"
+
+// Not all libc versions expose these
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1<<1)
+#endif
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+namespace iodme {
+namespace numa {
+
+bool parse_cpulist(const char *str, cpu_set_t& cpus)
+{
+	CPU_ZERO(&cpus);
+
+	const char *p = str;
+	while (*p && *p != '\n') {
+		char *end;
+		unsigned long first = strtoul(p, &end, 10);
+		if (end == p)
+			return false;
+
+		unsigned long last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p || last < first)
+				return false;
+		}
+
+		for (unsigned long c = first; c <= last && c < CPU_SETSIZE; c++)
+			CPU_SET(c, &cpus);
+
+		p = end;
+		if (*p == ',')
+			p++;
+	}
+
+	return true;
+}
+
+static bool read_cpulist(const std::string& path, cpu_set_t& cpus)
+{
+	FILE *f = fopen(path.c_str(), "r");
+	if (!f)
+		return false;
+
+	char buf[4096];
+	bool r = fgets(buf, sizeof(buf), f) && parse_cpulist(buf, cpus);
+	fclose(f);
+	return r;
+}
+
+int num_nodes()
+{
+	// Node list uses the same format as CPU lists
+	cpu_set_t nodes;
+	if (!read_cpulist("/sys/devices/system/node/possible", nodes))
+		return 1;
+
+	int n = 0;
+	for (int i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &nodes)) n = i + 1;
+	return n ? n : 1;
+}
+
+bool node_cpus(int node, cpu_set_t& cpus)
+{
+	return read_cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", cpus);
+}
+
+int node_of_cpu(int cpu)
+{
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return -1;
+
+	int n = num_nodes();
+	for (int i = 0; i < n; i++) {
+		cpu_set_t cpus;
+		if (node_cpus(i, cpus) && CPU_ISSET(cpu, &cpus))
+			return i;
+	}
+	return -1;
+}
+
+int socket_node(int sk)
+{
+	int cpu = -1;
+	socklen_t len = sizeof(cpu);
+	if (getsockopt(sk, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0)
+		return -1;
+	return node_of_cpu(cpu);
+}
+
+bool bind(void *addr, size_t len, int node)
+{
+	const unsigned int bits = sizeof(unsigned long) * 8;
+	unsigned long mask[1024 / bits] = { 0 };
+
+	if (node < 0 || node >= 1024) {
+		errno = EINVAL;
+		return false;
+	}
+	mask[node / bits] |= 1UL << (node % bits);
+
+	return syscall(SYS_mbind, addr, len, MPOL_BIND, mask, sizeof(mask) * 8 + 1, MPOL_MF_MOVE) == 0;
+}
+
+} // namespace numa
+} // namespace iodme
@@ -0,0 +1,197 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "iodme/pacer.hpp"
+
+namespace iodme {
+
+const pacer::options pacer::default_options = {
+	.profile   = CONSTANT,
+	.catchup   = CATCHUP_BURST,
+	.rate      = 30,
+	.burst     = 1,
+	.ramp_from = 0,
+	.ramp_time = 0,
+	.min_size  = 0,
+	.max_size  = 0,
+	.seed      = 1
+};
+
+pacer::pacer(const options& opts) :
+	_opts(opts),
+	_start(0),
+	_n(0),
+	_t(0),
+	_t_next(0),
+	_rng(opts.seed),
+	_interval(opts.rate > 0 ? opts.rate / 1e9 : 1),
+	_size(opts.min_size && opts.min_size < opts.max_size ? opts.min_size : opts.max_size, opts.max_size)
+{
+	if (!_opts.burst)
+		_opts.burst = 1;
+}
+
+// Offset of the slot from the start of the schedule (nsec).
+// Computed from scratch for each slot, rounding errors don't accumulate.
+double pacer::offset(uint64_t n)
+{
+	double period = 1e9 / _opts.rate;
+
+	switch (_opts.profile) {
+	case BURST:
+		return (n / _opts.burst) * _opts.burst * period;
+
+	case RAMP: {
+		// Rate changes linearly from r0 to r1 over T seconds:
+		// n(t) = r0 * t + (r1 - r0) * t^2 / 2T
+		double r0 = _opts.ramp_from, r1 = _opts.rate, T = _opts.ramp_time;
+		double n_ramp = (r0 + r1) / 2 * T;
+		if (T <= 0 || n >= n_ramp)
+			return (T > 0 ? T * 1e9 : 0) + (n - (T > 0 ? n_ramp : 0)) * period;
+
+		double a = (r1 - r0) / (2 * T);
+		if (fabs(a) < 1e-9)
+			return n / r0 * 1e9;
+		return (-r0 + sqrt(r0 * r0 + 4 * a * n)) / (2 * a) * 1e9;
+	}
+
+	default:
+		return n * period;
+	}
+}
+
+void pacer::advance()
+{
+	_n++;
+	_t = _t_next;
+	_t_next = _opts.profile == POISSON ? _t + _interval(_rng) : offset(_n + 1);
+}
+
+void pacer::start(uint64_t now)
+{
+	_start  = now;
+	_n      = 0;
+	_t      = 0;
+	_t_next = _opts.profile == POISSON ? _interval(_rng) : offset(1);
+}
+
+pacer::slot pacer::next(uint64_t now)
+{
+	slot s = { now, 0, 0 };
+	if (_opts.max_size)
+		s.size = _size(_rng);
+
+	if (_opts.rate <= 0)
+		return s;
+
+	if (_start + (uint64_t) _t < now) {
+		switch (_opts.catchup) {
+		case CATCHUP_SKIP:
+			while (_start + (uint64_t) _t_next <= now) {
+				advance();
+				s.skipped++;
+			}
+			break;
+
+		case CATCHUP_RESET:
+			_start = now - (uint64_t) _t;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	s.deadline = _start + (uint64_t) _t;
+	advance();
+	return s;
+}
+
+// Parse ':' separated number, advances the pointer
+static bool parse_arg(const char *&p, double& v)
+{
+	if (*p != ':')
+		return false;
+	char *end;
+	v = strtod(++p, &end);
+	if (end == p)
+		return false;
+	p = end;
+	return true;
+}
+
+bool pacer::parse_profile(const std::string& spec, options& opts)
+{
+	std::string name = spec.substr(0, spec.find(':'));
+	const char *p = spec.c_str() + name.size();
+
+	if (name == "constant") {
+		opts.profile = CONSTANT;
+	} else if (name == "poisson") {
+		opts.profile = POISSON;
+	} else if (name == "burst") {
+		double n;
+		if (!parse_arg(p, n) || n < 1)
+			return false;
+		opts.profile = BURST;
+		opts.burst = n;
+	} else if (name == "ramp") {
+		double from, secs;
+		if (!parse_arg(p, from) || !parse_arg(p, secs) || from < 0 || secs < 0)
+			return false;
+		opts.profile   = RAMP;
+		opts.ramp_from = from;
+		opts.ramp_time = secs;
+	} else
+		return false;
+
+	return *p == '\0';
+}
+
+bool pacer::parse_catchup(const std::string& str, CatchUp& c)
+{
+	if (str == "burst")
+		c = CATCHUP_BURST;
+	else if (str == "skip")
+		c = CATCHUP_SKIP;
+	else if (str == "reset")
+		c = CATCHUP_RESET;
+	else
+		return false;
+	return true;
+}
+
+} // namespace iodme
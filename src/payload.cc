@@ -0,0 +1,370 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "iodme/payload.hpp"
+#include "iodme/crc32c.hpp"
+
+namespace iodme {
+namespace payload {
+
+// Generator state: 8 xorshift128+ lanes
+static const unsigned int LANES = 8;
+static const size_t STEP = LANES * sizeof(uint64_t); // bytes per round
+
+// Fills below this size are likely to be consumed from the cache,
+// larger ones bypass it with non-temporal stores.
+static const size_t NT_MIN = 1024 * 1024;
+
+// Checksummed fills go in chunks that stay in L2 until the checksum is done
+static const size_t CRC_CHUNK = 64 * 1024;
+
+struct state {
+	uint64_t s0[LANES] __attribute__((aligned(64)));
+	uint64_t s1[LANES] __attribute__((aligned(64)));
+};
+
+// Generate nsteps * STEP bytes.
+// Non-temporal stores are not fenced, see store_fence().
+typedef void (*kernel_fn)(state& st, uint8_t *dst, size_t nsteps, bool nt);
+
+static inline uint64_t splitmix64(uint64_t& x)
+{
+	uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static void seed(state& st, uint64_t a, uint64_t b)
+{
+	uint64_t x = a * 0x9e3779b97f4a7c15ULL ^ b;
+	for (unsigned int l = 0; l < LANES; l++) {
+		st.s0[l] = splitmix64(x);
+		st.s1[l] = splitmix64(x) | 1; // never all zero
+	}
+}
+
+static void kernel_scalar(state& st, uint8_t *dst, size_t nsteps, bool)
+{
+	for (size_t i = 0; i < nsteps; i++, dst += STEP) {
+		uint64_t out[LANES];
+		for (unsigned int l = 0; l < LANES; l++) {
+			uint64_t x = st.s0[l];
+			uint64_t y = st.s1[l];
+			st.s0[l] = y;
+			x ^= x << 23;
+			st.s1[l] = x ^ y ^ (x >> 17) ^ (y >> 26);
+			out[l] = st.s1[l] + y;
+		}
+		memcpy(dst, out, STEP);
+	}
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static void kernel_avx2(state& st, uint8_t *dst, size_t nsteps, bool nt)
+{
+	__m256i x0 = _mm256_load_si256((const __m256i *) &st.s0[0]);
+	__m256i x1 = _mm256_load_si256((const __m256i *) &st.s0[4]);
+	__m256i y0 = _mm256_load_si256((const __m256i *) &st.s1[0]);
+	__m256i y1 = _mm256_load_si256((const __m256i *) &st.s1[4]);
+
+	nt = nt && !((uintptr_t) dst & 31);
+
+	for (size_t i = 0; i < nsteps; i++, dst += STEP) {
+		__m256i t0 = _mm256_xor_si256(x0, _mm256_slli_epi64(x0, 23));
+		__m256i t1 = _mm256_xor_si256(x1, _mm256_slli_epi64(x1, 23));
+		x0 = y0; x1 = y1;
+		y0 = _mm256_xor_si256(_mm256_xor_si256(t0, y0),
+				_mm256_xor_si256(_mm256_srli_epi64(t0, 17), _mm256_srli_epi64(y0, 26)));
+		y1 = _mm256_xor_si256(_mm256_xor_si256(t1, y1),
+				_mm256_xor_si256(_mm256_srli_epi64(t1, 17), _mm256_srli_epi64(y1, 26)));
+
+		__m256i o0 = _mm256_add_epi64(y0, x0);
+		__m256i o1 = _mm256_add_epi64(y1, x1);
+		if (nt) {
+			_mm256_stream_si256((__m256i *) dst, o0);
+			_mm256_stream_si256((__m256i *) (dst + 32), o1);
+		} else {
+			_mm256_storeu_si256((__m256i *) dst, o0);
+			_mm256_storeu_si256((__m256i *) (dst + 32), o1);
+		}
+	}
+
+	_mm256_store_si256((__m256i *) &st.s0[0], x0);
+	_mm256_store_si256((__m256i *) &st.s0[4], x1);
+	_mm256_store_si256((__m256i *) &st.s1[0], y0);
+	_mm256_store_si256((__m256i *) &st.s1[4], y1);
+}
+
+__attribute__((target("avx512f")))
+static void kernel_avx512(state& st, uint8_t *dst, size_t nsteps, bool nt)
+{
+	__m512i x = _mm512_load_si512(st.s0);
+	__m512i y = _mm512_load_si512(st.s1);
+
+	nt = nt && !((uintptr_t) dst & 63);
+
+	for (size_t i = 0; i < nsteps; i++, dst += STEP) {
+		__m512i t = _mm512_xor_si512(x, _mm512_slli_epi64(x, 23));
+		x = y;
+		y = _mm512_xor_si512(_mm512_xor_si512(t, y),
+				_mm512_xor_si512(_mm512_srli_epi64(t, 17), _mm512_srli_epi64(y, 26)));
+
+		__m512i o = _mm512_add_epi64(y, x);
+		if (nt)
+			_mm512_stream_si512((__m512i *) dst, o);
+		else
+			_mm512_storeu_si512(dst, o);
+	}
+
+	_mm512_store_si512(st.s0, x);
+	_mm512_store_si512(st.s1, y);
+}
+
+#elif defined(__aarch64__)
+
+static void kernel_neon(state& st, uint8_t *dst, size_t nsteps, bool)
+{
+	uint64x2_t x[4], y[4];
+	for (unsigned int v = 0; v < 4; v++) {
+		x[v] = vld1q_u64(&st.s0[v * 2]);
+		y[v] = vld1q_u64(&st.s1[v * 2]);
+	}
+
+	for (size_t i = 0; i < nsteps; i++, dst += STEP) {
+		for (unsigned int v = 0; v < 4; v++) {
+			uint64x2_t t = veorq_u64(x[v], vshlq_n_u64(x[v], 23));
+			x[v] = y[v];
+			y[v] = veorq_u64(veorq_u64(t, y[v]),
+					veorq_u64(vshrq_n_u64(t, 17), vshrq_n_u64(y[v], 26)));
+			vst1q_u64((uint64_t *) (dst + v * 16), vaddq_u64(y[v], x[v]));
+		}
+	}
+
+	for (unsigned int v = 0; v < 4; v++) {
+		vst1q_u64(&st.s0[v * 2], x[v]);
+		vst1q_u64(&st.s1[v * 2], y[v]);
+	}
+}
+
+#endif
+
+// Order non-temporal stores before the frame is handed over
+static inline void store_fence()
+{
+#if defined(__x86_64__)
+	_mm_sfence();
+#endif
+}
+
+struct kernel {
+	kernel_fn   fn;
+	const char *name;
+};
+
+static kernel pick_kernel()
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx512f"))
+		return { kernel_avx512, "avx512" };
+	if (__builtin_cpu_supports("avx2"))
+		return { kernel_avx2, "avx2" };
+#elif defined(__aarch64__)
+	return { kernel_neon, "neon" };
+#endif
+	return { kernel_scalar, "scalar" };
+}
+
+static const kernel& get_kernel()
+{
+	static const kernel k = pick_kernel();
+	return k;
+}
+
+const char *kernel_name()
+{
+	return get_kernel().name;
+}
+
+// Generate n bytes of the stream, the tail is done via a bounce step
+static void generate(state& st, uint8_t *dst, size_t n, bool nt)
+{
+	const kernel& k = get_kernel();
+
+	size_t nsteps = n / STEP;
+	k.fn(st, dst, nsteps, nt);
+
+	size_t tail = n - nsteps * STEP;
+	if (tail) {
+		uint8_t tmp[STEP] __attribute__((aligned(64)));
+		k.fn(st, tmp, 1, false);
+		memcpy(dst + nsteps * STEP, tmp, tail);
+	}
+}
+
+// Block is seeded from its stamp and begins with it (truncated if the block is shorter).
+// The first step goes through a bounce buffer so that the stamp does not
+// land on top of a non-temporal store.
+static void generate_block(uint8_t *dst, size_t len, uint64_t seqno, uint64_t offset, bool nt)
+{
+	state st;
+	seed(st, seqno, offset);
+
+	uint8_t head[STEP] __attribute__((aligned(64)));
+	get_kernel().fn(st, head, 1, false);
+
+	stamp s = { seqno, offset };
+	memcpy(head, &s, sizeof(s));
+
+	size_t n = std::min(len, STEP);
+	memcpy(dst, head, n);
+	generate(st, dst + n, len - n, nt);
+}
+
+static const uint8_t *pattern_block()
+{
+	static uint8_t block[STAMP_BLOCK_SIZE] __attribute__((aligned(64)));
+	static bool init = [] {
+		state st;
+		seed(st, 0, 0);
+		generate(st, block, sizeof(block), false);
+		return true;
+	}();
+	(void) init;
+	return block;
+}
+
+// Fill [off, off + len) of the frame. RANDOM state carries over between
+// consecutive ranges, all but the last range must be multiples of STAMP_BLOCK_SIZE.
+static void fill_range(Kind k, state& st, uint8_t *dst, size_t off, size_t len, uint64_t seqno, bool nt)
+{
+	size_t end = off + len;
+
+	switch (k) {
+	case ZERO:
+		memset(dst + off, 0, len);
+		break;
+
+	case PATTERN: {
+		const uint8_t *p = pattern_block();
+		for (; off < end; off += STAMP_BLOCK_SIZE)
+			memcpy(dst + off, p, std::min<size_t>(STAMP_BLOCK_SIZE, end - off));
+		break;
+	}
+
+	case RANDOM:
+		generate(st, dst + off, len, nt);
+		break;
+
+	case STAMPED:
+		for (; off < end; off += STAMP_BLOCK_SIZE)
+			generate_block(dst + off, std::min<size_t>(STAMP_BLOCK_SIZE, end - off), seqno, off, nt);
+		break;
+	}
+}
+
+void fill(Kind k, uint8_t *dst, size_t n, uint64_t seqno)
+{
+	bool nt = n >= NT_MIN;
+
+	state st;
+	seed(st, seqno, ~0ULL);
+	fill_range(k, st, dst, 0, n, seqno, nt);
+
+	if (nt)
+		store_fence();
+}
+
+uint32_t fill_crc(Kind k, uint8_t *dst, size_t n, uint64_t seqno)
+{
+	state st;
+	seed(st, seqno, ~0ULL);
+
+	uint32_t crc = 0;
+	for (size_t off = 0; off < n; off += CRC_CHUNK) {
+		size_t len = std::min(CRC_CHUNK, n - off);
+		fill_range(k, st, dst, off, len, seqno, false);
+		crc = iodme::crc32c::update(crc, dst + off, len);
+	}
+	return crc;
+}
+
+size_t verify(const uint8_t *src, size_t n, uint64_t seqno)
+{
+	uint8_t expect[STAMP_BLOCK_SIZE] __attribute__((aligned(64)));
+
+	size_t bad = 0;
+	for (size_t off = 0; off < n; off += STAMP_BLOCK_SIZE) {
+		size_t len = std::min<size_t>(STAMP_BLOCK_SIZE, n - off);
+		generate_block(expect, len, seqno, off, false);
+		if (memcmp(src + off, expect, len))
+			bad++;
+	}
+	return bad;
+}
+
+bool parse_kind(const std::string& str, Kind& k)
+{
+	if (str == "zero")    { k = ZERO;    return true; }
+	if (str == "pattern") { k = PATTERN; return true; }
+	if (str == "random")  { k = RANDOM;  return true; }
+	if (str == "stamped") { k = STAMPED; return true; }
+	return false;
+}
+
+const char *kind_name(Kind k)
+{
+	switch (k) {
+	case ZERO:    return "zero";
+	case PATTERN: return "pattern";
+	case RANDOM:  return "random";
+	case STAMPED: return "stamped";
+	}
+	return "unknown";
+}
+
+} // namespace payload
+} // namespace iodme
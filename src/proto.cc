@@ -0,0 +1,180 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "iodme/proto.hpp"
+
+namespace iodme {
+namespace proto {
+
+hello make_hello(const std::string& name, uint32_t frame_size, float rate)
+{
+	hello h;
+	memset(&h, 0, sizeof(h));
+	h.magic      = HELLO_MAGIC;
+	h.version    = VERSION;
+	h.frame_size = frame_size;
+	h.rate_mhz   = rate * 1000;
+
+	size_t n = name.copy(h.name, sizeof(h.name) - 1);
+	h.name[n] = '\0';
+	return h;
+}
+
+static bool send_all(int sk, const void *data, size_t len, int flags)
+{
+	const uint8_t *p = (const uint8_t *) data;
+	while (len) {
+		ssize_t r = send(sk, p, len, flags);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		p += r; len -= r;
+	}
+	return true;
+}
+
+bool recv_all(int sk, void *data, size_t len, uint64_t *calls)
+{
+	uint8_t *p = (uint8_t *) data;
+	while (len) {
+		ssize_t r = recv(sk, p, len, MSG_WAITALL);
+		if (calls)
+			(*calls)++;
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		if (!r) {
+			errno = ECONNRESET;
+			return false;
+		}
+		p += r; len -= r;
+	}
+	return true;
+}
+
+void encode_hello(hello& h)
+{
+	h.magic      = htole32(h.magic);
+	h.version    = htole16(h.version);
+	h.flags      = htole16(h.flags);
+	h.frame_size = htole32(h.frame_size);
+	h.rate_mhz   = htole32(h.rate_mhz);
+}
+
+bool send_hello(int sk, const hello& h)
+{
+	hello w = h;
+	encode_hello(w);
+	return send_all(sk, &w, sizeof(w), 0);
+}
+
+bool recv_hello(int sk, hello& h)
+{
+	if (!recv_all(sk, &h, sizeof(h)))
+		return false;
+	return decode_hello(h);
+}
+
+bool decode_hello(hello& h)
+{
+	h.magic      = le32toh(h.magic);
+	h.version    = le16toh(h.version);
+	h.flags      = le16toh(h.flags);
+	h.frame_size = le32toh(h.frame_size);
+	h.rate_mhz   = le32toh(h.rate_mhz);
+	h.name[sizeof(h.name) - 1] = '\0';
+
+	if (h.magic != HELLO_MAGIC || h.version != VERSION) {
+		errno = EPROTO;
+		return false;
+	}
+	return true;
+}
+
+void encode_header(frame_header& fh)
+{
+	fh.magic     = htole32(fh.magic);
+	fh.length    = htole32(fh.length);
+	fh.seqno     = htole64(fh.seqno);
+	fh.timestamp = htole64(fh.timestamp);
+	fh.crc       = htole32(fh.crc);
+	fh.flags     = htole32(fh.flags);
+}
+
+bool send_header(int sk, const frame_header& fh, int flags)
+{
+	frame_header w = fh;
+	encode_header(w);
+	return send_all(sk, &w, sizeof(w), flags);
+}
+
+bool recv_header(int sk, frame_header& fh)
+{
+	if (!recv_all(sk, &fh, sizeof(fh)))
+		return false;
+	return decode_header(fh);
+}
+
+bool decode_header(frame_header& fh)
+{
+	fh.magic     = le32toh(fh.magic);
+	fh.length    = le32toh(fh.length);
+	fh.seqno     = le64toh(fh.seqno);
+	fh.timestamp = le64toh(fh.timestamp);
+	fh.crc       = le32toh(fh.crc);
+	fh.flags     = le32toh(fh.flags);
+
+	if (fh.magic != FRAME_MAGIC) {
+		errno = EPROTO;
+		return false;
+	}
+	return true;
+}
+
+bool valid_name(const char *name)
+{
+	return name[0] && !strchr(name, '/') && strcmp(name, ".") && strcmp(name, "..");
+}
+
+} // namespace proto
+} // namespace iodme
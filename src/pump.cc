@@ -32,42 +32,125 @@
 
 #include <stdint.h>
 #include <errno.h>
+#include <time.h>
 
 #include <hogl/post.hpp>
 
 #include "iodme/pump.hpp"
+#include "iodme/payload.hpp"
+#include "iodme/crc32c.hpp"
 
 namespace iodme {
 
-void pump::loop()
+// Produce the frame for the current slot of the stream
+void pump::make_frame(stream& s)
 {
-	hogl::post(_area, _area->INFO, "loop: frame-size %u interval-nsec %llu", _size, _interval_nsec);
-
-	uint64_t seqno = 0;
-	while (!_killed) {
-		do_nanosleep(_interval_nsec);
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
 
-		iodme::buffer::metadata m;
-		m.seqno = seqno++;
+	iodme::buffer b;
+	if (_free_q && !_free_q->pop(b)) {
+		// Paced streams keep the schedule, unpaced ones go as fast as the buffers come back
+		if (s.pacer.opts().rate > 0) {
+			hogl::post(_area, _area->WARN, "dropping frame %llu : no free buffers", s.seqno);
+			_dropped.add();
+			s.seqno++;
+			return;
+		}
 
-		iodme::buffer b;
+		_m.stalls.add();
+		while (!_free_q->pop_wait(b, default_wait)) {
+			if (_killed)
+				return;
+		}
+	} else if (!_free_q) {
+		iodme::buffer::metadata m = { 0 };
 		if (!b.alloc(_size)) {
-			hogl::post(_area, _area->WARN, "dropping frame %llu : malloc fail", m.seqno);
-			continue;
+			hogl::post(_area, _area->WARN, "dropping frame %llu : malloc fail", s.seqno);
+			_m.errors.add();
+			s.seqno++;
+			return;
 		}
 		if (!b.add_metadata(m)) {
-			hogl::post(_area, _area->WARN, "dropping frame %llu : malloc(metadata) fail", m.seqno);
-			continue;
+			hogl::post(_area, _area->WARN, "dropping frame %llu : malloc(metadata) fail", s.seqno);
+			_m.errors.add();
+			b.free();
+			s.seqno++;
+			return;
 		}
+	}
 
-		// FIXME: populate chunk with pseudo-randon data
-		memset(b.base, 0, b.capacity);
-		b.size = b.capacity;
+	b.meta->seqno = s.seqno++;
+	b.meta->timestamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	b.meta->stream = s.id;
+	size_t n = s.name.copy(b.meta->name, sizeof(b.meta->name) - 1);
+	b.meta->name[n] = '\0';
 
-		if (!_q.push(b)) {
+	uint64_t start = now_ns();
+	b.size = s.slot.size && s.slot.size < b.capacity ? s.slot.size : b.capacity;
+	b.meta->flags = 0;
+	if (_checksum) {
+		b.meta->crc = iodme::payload::fill_crc(_payload, b.base, b.size, b.meta->seqno);
+		b.meta->flags |= buffer::metadata::HAS_CRC;
+	} else
+		iodme::payload::fill(_payload, b.base, b.size, b.meta->seqno);
+	_fill_ns.record(now_ns() - start);
+
+	if (!s.q->push(b)) {
+		hogl::post(_area, _area->WARN, "dropping frame %llu : full queue", b.meta->seqno);
+		if (_free_q)
+			_free_q->push(b);
+		else
 			b.free();
-			hogl::post(_area, _area->WARN, "dropping frame %llu : full queue", m.seqno);
-		}
+		_dropped.add();
+		return;
+	}
+
+	_m.frames.add();
+	_m.bytes.add(b.size);
+}
+
+void pump::loop()
+{
+	if (_streams.empty()) {
+		hogl::post(_area, _area->ERROR, "no streams to generate");
+		_failed = true;
+		return;
+	}
+
+	hogl::post(_area, _area->INFO, "loop: frame-size %u streams %u %s payload %s(%s) checksum %s",
+			_size, _streams.size(),
+			_free_q ? "pre-allocated" : "alloc per frame",
+			iodme::payload::kind_name(_payload), iodme::payload::kernel_name(),
+			_checksum ? iodme::crc32c::kernel_name() : "off");
+
+	// Frames are due on absolute deadlines, time spent below doesn't shift the schedule
+	uint64_t now = now_ns();
+	for (auto& s : _streams) {
+		const iodme::pacer::options& po = s.pacer.opts();
+		hogl::post(_area, _area->INFO, "stream %u %s: rate %.3f profile %u catch-up %u",
+				s.id, s.name, po.rate, po.profile, po.catchup);
+
+		s.pacer.start(now);
+		s.slot = s.pacer.next(now);
+	}
+
+	while (!_killed) {
+		// Stream with the earliest deadline goes next
+		stream *s = &_streams[0];
+		for (auto& x : _streams)
+			if (x.slot.deadline < s->slot.deadline)
+				s = &x;
+
+		if (s->slot.skipped)
+			_skipped.add(s->slot.skipped);
+
+		sleep_until(s->slot.deadline);
+		_late_ns.record(now_ns() - s->slot.deadline);
+
+		make_frame(*s);
+
+		s->slot = s->pacer.next(now_ns());
 	}
 }
 
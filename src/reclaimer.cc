@@ -0,0 +1,283 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <hogl/post.hpp>
+
+#include "iodme/reclaimer.hpp"
+#include "iodme/file-writer.hpp"
+
+namespace iodme {
+
+const reclaimer::options reclaimer::default_options = {
+	.max_bytes = 0,
+	.max_files = 0,
+	.min_free_bytes = 0,
+	.reserve_bytes = 0,
+	.period_ns = 100 * 1000000ULL
+};
+
+// See ioprio_set(2), glibc has no wrapper
+static const int IOPRIO_WHO_PROCESS = 1;
+static const int IOPRIO_CLASS_IDLE  = 3;
+static const int IOPRIO_CLASS_SHIFT = 13;
+
+static uint64_t realtime_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+reclaimer::reclaimer(const std::string& name, const std::string& dir, const options& opts) :
+	iodme::thread(name),
+	_dir(dir),
+	_opts(opts),
+	_used(0),
+	_count(0),
+	_start_ns(realtime_ns()),
+	_free_need(0),
+	_free_check_ns(0),
+	_stuck_warned(false),
+	_lost_warned(false),
+	_lost(0),
+	_m(name),
+	_unlink_ns(_m.grp.add_histogram("unlink_ns"))
+{
+	_m.grp.add_gauge("used",  [this]() { return used(); });
+	_m.grp.add_gauge("files", [this]() { return files(); });
+	_m.grp.add_gauge("lost",  [this]() { return _lost.load(std::memory_order_relaxed); });
+}
+
+void reclaimer::add(const std::string& path, uint64_t size)
+{
+	entry e = { path, size };
+	if (!_q.push(e))
+		_lost.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Pick up recordings that were there before we started, oldest first
+void reclaimer::scan()
+{
+	struct found {
+		uint64_t mtime;
+		uint64_t seqno;
+		entry    e;
+	};
+	std::vector<found> v;
+
+	DIR *d = opendir(_dir.c_str());
+	if (!d) {
+		hogl::post(_area, _area->ERROR, "failed to open %s: %s(%d)", _dir, strerror(errno), errno);
+		_m.errors.add();
+		return;
+	}
+
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		std::string name;
+		uint64_t seqno;
+		bool seg;
+		if (!iodme::file_writer::parse_output_name(de->d_name, name, seqno, seg))
+			continue;
+
+		std::string path = _dir + "/" + de->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		// Newer files belong to the writers
+		uint64_t mtime = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+		if (mtime >= _start_ns)
+			continue;
+
+		uint64_t size = st.st_size;
+		if (seg && stat((path + ".idx").c_str(), &st) == 0)
+			size += st.st_size;
+
+		v.push_back({ mtime, seqno, { path, size } });
+	}
+	closedir(d);
+
+	std::sort(v.begin(), v.end(), [](const found& a, const found& b) {
+		return a.mtime != b.mtime ? a.mtime < b.mtime : a.seqno < b.seqno;
+	});
+
+	for (auto& f : v) {
+		_files.push_back(f.e);
+		_used.fetch_add(f.e.size, std::memory_order_relaxed);
+	}
+	_count.store(_files.size(), std::memory_order_relaxed);
+
+	hogl::post(_area, _area->INFO, "found %u files %llu bytes in %s", v.size(), used(), _dir);
+}
+
+// Free space is checked once per period, statvfs() is not free
+void reclaimer::check_free()
+{
+	if (!_opts.min_free_bytes)
+		return;
+
+	uint64_t now = iodme::thread::now_ns();
+	if (now - _free_check_ns < _opts.period_ns)
+		return;
+	_free_check_ns = now;
+
+	struct statvfs st;
+	_m.syscalls.add();
+	if (statvfs(_dir.c_str(), &st) < 0) {
+		hogl::post(_area, _area->ERROR, "statvfs %s failed: %s(%d)", _dir, strerror(errno), errno);
+		_m.errors.add();
+		_free_need = 0;
+		return;
+	}
+
+	uint64_t avail = (uint64_t) st.f_bavail * st.f_frsize;
+	uint64_t want  = _opts.min_free_bytes + _opts.reserve_bytes;
+	_free_need = avail < want ? want - avail : 0;
+}
+
+void reclaimer::remove(const entry& e)
+{
+	hogl::post(_area, _area->DEBUG, "unlink %s size %llu", e.path, e.size);
+
+	uint64_t start = iodme::thread::now_ns();
+
+	// Already gone is fine (eg removed by hand)
+	_m.syscalls.add();
+	int r = unlink(e.path.c_str());
+	if (r < 0 && errno != ENOENT) {
+		hogl::post(_area, _area->ERROR, "failed to remove %s: %s(%d)", e.path, strerror(errno), errno);
+		_m.errors.add();
+	}
+
+	size_t n = e.path.size();
+	if (n > 4 && !e.path.compare(n - 4, 4, ".seg")) {
+		_m.syscalls.add();
+		unlink((e.path + ".idx").c_str());
+	}
+
+	_unlink_ns.record(iodme::thread::now_ns() - start);
+
+	if (!r) {
+		_m.frames.add();
+		_m.bytes.add(e.size);
+	}
+}
+
+// Remove the oldest files until we're back within the budgets (with the reserve on top)
+void reclaimer::reclaim()
+{
+	check_free();
+
+	uint64_t need = _free_need;
+	uint64_t u = used();
+	if (_opts.max_bytes && u + _opts.reserve_bytes > _opts.max_bytes)
+		need = std::max(need, u + _opts.reserve_bytes - _opts.max_bytes);
+
+	uint64_t excess = 0;
+	if (_opts.max_files && _files.size() > _opts.max_files)
+		excess = _files.size() - _opts.max_files;
+
+	while ((need || excess) && !_files.empty()) {
+		entry& e = _files.front();
+		remove(e);
+
+		need -= std::min(need, e.size);
+		if (excess)
+			excess--;
+		if (_free_need)
+			_free_need -= std::min(_free_need, e.size);
+
+		_used.fetch_sub(e.size, std::memory_order_relaxed);
+		_files.pop_front();
+	}
+	_count.store(_files.size(), std::memory_order_relaxed);
+
+	if (need || excess) {
+		if (!_stuck_warned)
+			hogl::post(_area, _area->WARN, "over budget with nothing left to remove: need %llu bytes", need);
+		_stuck_warned = true;
+	} else
+		_stuck_warned = false;
+
+	if (_lost.load(std::memory_order_relaxed) && !_lost_warned) {
+		hogl::post(_area, _area->WARN, "reclaimer queue overflow, some files won't be removed");
+		_lost_warned = true;
+	}
+}
+
+void reclaimer::loop()
+{
+	hogl::post(_area, _area->INFO, "reclaimer loop: dir %s max-bytes %llu max-files %llu min-free %llu reserve %llu",
+			_dir, _opts.max_bytes, _opts.max_files, _opts.min_free_bytes, _opts.reserve_bytes);
+
+	// Stay out of the writers' way
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+		hogl::post(_area, _area->WARN, "failed to set idle io priority: %s(%d)", strerror(errno), errno);
+
+	scan();
+
+	// No point spinning here
+	iodme::wait_strategy ws = { 0, _opts.period_ns ? _opts.period_ns : default_wait.block_ns };
+
+	entry batch[64];
+	while (1) {
+		size_t n = _killed ? _q.pop(batch, 64) : _q.pop_wait(batch, 64, ws);
+		for (size_t i = 0; i < n; i++) {
+			_files.push_back(std::move(batch[i]));
+			_used.fetch_add(_files.back().size, std::memory_order_relaxed);
+		}
+		_count.store(_files.size(), std::memory_order_relaxed);
+
+		reclaim();
+
+		if (!n && _killed)
+			break;
+	}
+}
+
+} // namespace iodme
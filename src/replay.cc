@@ -0,0 +1,308 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/xattr.h>
+
+#include <algorithm>
+#include <set>
+
+#include <hogl/post.hpp>
+
+#include "iodme/replay.hpp"
+#include "iodme/segment.hpp"
+#include "iodme/file-writer.hpp"
+
+namespace iodme {
+
+const replay::options replay::default_options = {
+	.pacing = iodme::pacer::default_options,
+	.repeat = 1
+};
+
+replay::replay(int sk, const iodme::proto::hello& hello, const std::vector<frame>& frames,
+		const options& opts) :
+	thread(std::string("IODME-REPLAY") + std::to_string(sk)),
+	_sk(sk),
+	_hello(hello),
+	_frames(frames),
+	_opts(opts),
+	_fd(-1),
+	_m(std::string("IODME-REPLAY") + std::to_string(sk) + "/" + hello.name),
+	_send_ns(_m.grp.add_histogram("send_ns")),
+	_late_ns(_m.grp.add_histogram("late_ns")),
+	_skipped(_m.grp.add_counter("skipped"))
+{}
+
+static uint64_t mtime_ns(const struct stat& st)
+{
+	return st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+}
+
+// Add frames listed in the segment index
+static void scan_segment(const std::string& path, uint64_t mtime, std::vector<replay::frame>& frames)
+{
+	int fd = open((path + ".idx").c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	iodme::segment::index_entry e;
+	while (read(fd, &e, sizeof(e)) == sizeof(e)) {
+		uint32_t flags = (e.flags & iodme::segment::index_entry::CRC32C) ? iodme::proto::FRAME_CRC32C : 0;
+		frames.push_back({ e.seqno, path, e.offset, e.size, flags, e.crc, mtime });
+	}
+	close(fd);
+}
+
+bool replay::scan(const std::string& dir, const std::string& name, std::vector<frame>& frames)
+{
+	DIR *d = opendir(dir.c_str());
+	if (!d)
+		return false;
+
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		std::string n;
+		uint64_t seqno;
+		bool seg;
+		if (!iodme::file_writer::parse_output_name(de->d_name, n, seqno, seg) || n != name)
+			continue;
+
+		std::string path = dir + "/" + de->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		if (seg) {
+			scan_segment(path, mtime_ns(st), frames);
+			continue;
+		}
+
+		// Frame checksum (if any) is kept in an xattr
+		frame f = { seqno, path, 0, (uint32_t) st.st_size, 0, 0, mtime_ns(st) };
+		char v[16] = { 0 };
+		if (getxattr(path.c_str(), iodme::file_writer::CRC_XATTR, v, sizeof(v) - 1) == 8) {
+			f.crc   = strtoul(v, 0, 16);
+			f.flags = iodme::proto::FRAME_CRC32C;
+		}
+		frames.push_back(f);
+	}
+	closedir(d);
+
+	std::sort(frames.begin(), frames.end(),
+			[](const frame& a, const frame& b) { return a.seqno < b.seqno; });
+	return true;
+}
+
+std::vector<std::string> replay::streams(const std::string& dir)
+{
+	std::set<std::string> names;
+
+	DIR *d = opendir(dir.c_str());
+	if (d) {
+		struct dirent *de;
+		while ((de = readdir(d))) {
+			std::string n;
+			uint64_t seqno;
+			bool seg;
+			if (iodme::file_writer::parse_output_name(de->d_name, n, seqno, seg))
+				names.insert(n);
+		}
+		closedir(d);
+	}
+
+	return std::vector<std::string>(names.begin(), names.end());
+}
+
+double replay::recorded_rate(const std::vector<frame>& frames)
+{
+	if (frames.size() < 2)
+		return 0;
+
+	// Segment mtime is the time of its last frame, so only the frames after
+	// the first file count
+	uint64_t first = UINT64_MAX, last = 0;
+	for (auto& f : frames) {
+		first = std::min(first, f.mtime);
+		last  = std::max(last, f.mtime);
+	}
+
+	size_t n = 0;
+	for (auto& f : frames)
+		if (f.mtime != first)
+			n++;
+
+	if (!n || last == first)
+		return 0;
+	return n * 1e9 / (last - first);
+}
+
+uint32_t replay::max_size(const std::vector<frame>& frames)
+{
+	uint32_t s = 0;
+	for (auto& f : frames)
+		s = std::max(s, f.size);
+	return s;
+}
+
+// Frames of a segment share the file
+bool replay::open_file(const frame& f)
+{
+	if (_fd >= 0 && _fd_path == f.path)
+		return true;
+
+	if (_fd >= 0)
+		close(_fd);
+	_fd_path.clear();
+
+	_fd = open(f.path.c_str(), O_RDONLY);
+	if (_fd < 0) {
+		hogl::post(_area, _area->ERROR, "failed to open %s: %s(%d)", f.path, strerror(errno), errno);
+		return false;
+	}
+	posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	_fd_path = f.path;
+	return true;
+}
+
+bool replay::send_frame(const frame& f, uint64_t seqno)
+{
+	if (!open_file(f))
+		return false;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	uint64_t start = now_ns();
+
+	iodme::proto::frame_header fh;
+	fh.magic     = iodme::proto::FRAME_MAGIC;
+	fh.length    = f.size;
+	fh.seqno     = seqno;
+	fh.timestamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	fh.crc       = f.crc;
+	fh.flags     = f.flags;
+
+	if (!iodme::proto::send_header(_sk, fh, MSG_MORE)) {
+		if (!_killed)
+			hogl::post(_area, _area->ERROR, "send header failed. %s(%d)", strerror(errno), errno);
+		return false;
+	}
+
+	uint64_t calls = 1;
+	off_t    off   = f.offset;
+	size_t   left  = f.size;
+	while (left) {
+		ssize_t r = sendfile(_sk, _fd, &off, left);
+		calls++;
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			if (!_killed)
+				hogl::post(_area, _area->ERROR, "sendfile %s failed. %s(%d)", f.path, strerror(errno), errno);
+			return false;
+		}
+		if (!r) {
+			hogl::post(_area, _area->ERROR, "frame %llu is truncated: %s", f.seqno, f.path);
+			return false;
+		}
+		left -= r;
+	}
+
+	_send_ns.record(now_ns() - start);
+	_m.syscalls.add(calls);
+	_m.frames.add();
+	_m.bytes.add(f.size);
+	return true;
+}
+
+void replay::loop()
+{
+	hogl::post(_area, _area->INFO, "replay %s: frames %u rate %.3f profile %u repeat %u",
+			_hello.name, _frames.size(), _opts.pacing.rate, _opts.pacing.profile, _opts.repeat);
+
+	if (!iodme::proto::send_hello(_sk, _hello)) {
+		hogl::post(_area, _area->ERROR, "send hello failed. %s(%d)", strerror(errno), errno);
+		_m.errors.add();
+		_failed = true;
+		return;
+	}
+
+	if (_frames.empty())
+		return;
+
+	// Each pass continues the seqnos, so that the sink doesn't overwrite the frames
+	uint64_t span = _frames.back().seqno - _frames.front().seqno + 1;
+
+	iodme::pacer pacer(_opts.pacing);
+	pacer.start(now_ns());
+	iodme::pacer::slot slot = pacer.next(now_ns());
+
+	for (unsigned int pass = 0; !_killed && (!_opts.repeat || pass < _opts.repeat); pass++) {
+		for (size_t i = 0; i < _frames.size() && !_killed; ) {
+			// Catching up by skipping frames
+			if (slot.skipped) {
+				_skipped.add(slot.skipped);
+				i += std::min<size_t>(slot.skipped, _frames.size() - i - 1);
+			}
+
+			sleep_until(slot.deadline);
+			_late_ns.record(now_ns() - slot.deadline);
+
+			const frame& f = _frames[i];
+			if (!send_frame(f, f.seqno + pass * span)) {
+				if (!_killed) {
+					_m.errors.add();
+					_failed = true;
+				}
+				return;
+			}
+
+			slot = pacer.next(now_ns());
+			i++;
+		}
+	}
+
+	hogl::post(_area, _area->INFO, "replay %s done: frames %llu bytes %llu", _hello.name, frames(), bytes());
+}
+
+} // namespace iodme
@@ -0,0 +1,125 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "iodme/segment.hpp"
+#include "iodme/file-syncer.hpp"
+
+namespace iodme {
+
+bool segment::open(const std::string& path, unsigned int open_flags, uint64_t now_ns)
+{
+	close();
+
+	_fd = ::open(path.c_str(), open_flags | O_CREAT | O_TRUNC | O_WRONLY, 0666);
+	if (_fd < 0) {
+		_errno = errno;
+		return false;
+	}
+
+	// Index is small, plain buffered writes are good enough
+	std::string ipath = path + ".idx";
+	_idx_fd = ::open(ipath.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0666);
+	if (_idx_fd < 0) {
+		_errno = errno;
+		::close(_fd);
+		_fd = -1;
+		unlink(path.c_str());
+		return false;
+	}
+
+	_path    = path;
+	_open_flags = open_flags;
+	_offset  = 0;
+	_open_ns = now_ns;
+	_frames  = 0;
+	_idx_failed = false;
+	return true;
+}
+
+void segment::drop_directio()
+{
+	_open_flags &= ~O_DIRECT;
+	int fl = fcntl(_fd, F_GETFL);
+	if (fl != -1)
+		fcntl(_fd, F_SETFL, fl & ~O_DIRECT);
+}
+
+void segment::record(uint64_t seqno, uint64_t offset, uint32_t frame_size, uint32_t flags, uint32_t crc)
+{
+	index_entry e = { seqno, offset, frame_size, flags, crc, 0 };
+	ssize_t n = write(_idx_fd, &e, sizeof(e));
+	if (n != sizeof(e) && !_idx_failed) {
+		_errno = n < 0 ? errno : EIO;
+		_idx_failed = true;
+	}
+	_frames++;
+}
+
+bool segment::close(iodme::file_syncer *syncer)
+{
+	if (_fd == -1)
+		return true;
+
+	bool ok = !_idx_failed;
+
+	if (syncer) {
+		syncer->sync(_fd, _offset);
+	} else {
+		// Sync and drop cached pages
+		if (fsync(_fd) < 0) {
+			_errno = errno;
+			ok = false;
+		}
+		posix_fadvise(_fd, 0, 0, POSIX_FADV_DONTNEED);
+		::close(_fd);
+	}
+	_fd = -1;
+
+	if (syncer) {
+		syncer->sync(_idx_fd, _frames * sizeof(index_entry));
+	} else {
+		fsync(_idx_fd);
+		::close(_idx_fd);
+	}
+	_idx_fd = -1;
+
+	return ok;
+}
+
+} // namespace iodme
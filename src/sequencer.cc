@@ -0,0 +1,309 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <hogl/post.hpp>
+
+#include "iodme/sequencer.hpp"
+#include "iodme/file-syncer.hpp"
+#include "iodme/reclaimer.hpp"
+#include "iodme/thread.hpp"
+
+namespace iodme {
+
+const sequencer::options sequencer::default_options = {
+	.window = 64,
+	.gap_timeout_ns = 1000 * 1000000ULL,
+	.segment_size = 1024ULL * 1024 * 1024,
+	.segment_time_ns = 0,
+	.syncer = 0,
+	.reclaimer = 0
+};
+
+sequencer::sequencer(const std::string& name, const options& opts) :
+	_opts(opts),
+	_skipped(0),
+	_expire_ns(0),
+	_metrics(name)
+{
+	_area = hogl::add_area(name.c_str());
+	_metrics.add_gauge("skipped", [this]() { return skipped(); });
+}
+
+sequencer::~sequencer()
+{
+	// Writers are gone. Publish whatever is left (skipping the gaps)
+	// and close all segments.
+	std::vector<std::shared_ptr<iodme::segment>> done;
+	uint64_t now = iodme::thread::now_ns();
+
+	for (auto& it : _streams) {
+		stream& s = *it.second;
+		s.inflight = 0;
+		drain(s, done, now, true);
+		if (s.seg)
+			retire(s, done);
+	}
+
+	close_segments(done);
+}
+
+sequencer::stream& sequencer::get_stream(const char *name)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _streams.find(name);
+	if (it == _streams.end())
+		it = _streams.emplace(name, std::unique_ptr<stream>(new stream(name))).first;
+	return *it->second;
+}
+
+void sequencer::begin(stream& s, uint64_t seqno)
+{
+	std::lock_guard<std::mutex> lock(s.mutex);
+
+	bool idle = !s.inflight && s.pending.empty();
+
+	if (idle && (!s.has_last || seqno <= s.last)) {
+		// New stream or the sender started over
+		if (s.has_last)
+			hogl::post(_area, _area->INFO, "stream %s restarted: seqno %llu last %llu", s.name, seqno, s.last);
+		s.next = seqno;
+		s.has_last = false;
+	} else if (!s.has_last && seqno < s.next) {
+		// Nothing published yet, writers picked up the frames out of order
+		s.next = seqno;
+	}
+
+	s.inflight++;
+}
+
+// Move rotated segments that have no more frames outstanding to the done list
+void sequencer::collect(stream& s, std::vector<std::shared_ptr<iodme::segment>>& done)
+{
+	for (auto it = s.retired.begin(); it != s.retired.end(); ) {
+		auto r = s.reserved.find(it->get());
+		if (r != s.reserved.end() && r->second) {
+			++it;
+			continue;
+		}
+		if (r != s.reserved.end())
+			s.reserved.erase(r);
+		done.push_back(*it);
+		it = s.retired.erase(it);
+	}
+}
+
+// Rotate the current segment. It's closed once all its frames are published.
+void sequencer::retire(stream& s, std::vector<std::shared_ptr<iodme::segment>>& done)
+{
+	if (s.seg) {
+		s.retired.push_back(s.seg);
+		s.seg.reset();
+	}
+	collect(s, done);
+}
+
+void sequencer::close_segments(std::vector<std::shared_ptr<iodme::segment>>& done)
+{
+	for (auto& seg : done) {
+		hogl::post(_area, _area->INFO, "segment-close %s frames %u size %llu", seg->path(), seg->frames(), seg->offset());
+
+		if (!seg->close(_opts.syncer))
+			hogl::post(_area, _area->ERROR, "failed to close segment %s: %s(%d)",
+					seg->path(), strerror(seg->last_errno()), seg->last_errno());
+
+		if (_opts.reclaimer)
+			_opts.reclaimer->add(seg->path(), seg->disk_size());
+	}
+	done.clear();
+}
+
+bool sequencer::reserve(stream& s, const std::string& path, unsigned int open_flags,
+		uint32_t size, frame& f)
+{
+	std::vector<std::shared_ptr<iodme::segment>> done;
+
+	{
+		std::lock_guard<std::mutex> lock(s.mutex);
+
+		uint64_t now = iodme::thread::now_ns();
+
+		// Rotate if this frame does not fit or the segment is too old
+		if (s.seg && s.seg->offset() &&
+				(s.seg->offset() + size > _opts.segment_size ||
+				 (_opts.segment_time_ns && s.seg->age_ns(now) >= _opts.segment_time_ns)))
+			retire(s, done);
+
+		if (!s.seg) {
+			std::shared_ptr<iodme::segment> seg(new iodme::segment());
+			if (!seg->open(path, open_flags, now)) {
+				hogl::post(_area, _area->ERROR, "failed open segment file %s: %s(%d).",
+						path, strerror(seg->last_errno()), seg->last_errno());
+				errno = seg->last_errno();
+				return false;
+			}
+			hogl::post(_area, _area->INFO, "segment-open %s", path);
+			s.seg = seg;
+		}
+
+		f.seg    = s.seg;
+		f.offset = s.seg->reserve(size);
+		s.reserved[s.seg.get()]++;
+	}
+
+	close_segments(done);
+	return true;
+}
+
+void sequencer::publish(stream& s, frame& f)
+{
+	if (f.seg) {
+		if (f.ok)
+			f.seg->record(f.seqno, f.offset, f.size, f.flags, f.crc);
+		s.reserved[f.seg.get()]--;
+		f.seg.reset();
+	} else if (f.ok) {
+		if (rename(f.part.c_str(), f.path.c_str()) < 0)
+			hogl::post(_area, _area->ERROR, "failed to publish %s: %s(%d)", f.path, strerror(errno), errno);
+		else if (_opts.reclaimer)
+			_opts.reclaimer->add(f.path, f.size);
+	}
+
+	hogl::post(_area, _area->DEBUG, "publish: stream %s seqno %llu ok %u", s.name, f.seqno, f.ok);
+}
+
+// Publish in-order frames from the reorder window.
+// A writer may still hold the missing frame even if nothing is in flight
+// (popped but not begun yet), so gaps are skipped only when the window is
+// full or the gap times out (or we're flushing).
+void sequencer::drain(stream& s, std::vector<std::shared_ptr<iodme::segment>>& done,
+		uint64_t now, bool flush)
+{
+	while (!s.pending.empty()) {
+		auto it = s.pending.begin();
+		uint64_t seqno = it->first;
+
+		if (seqno > s.next) {
+			if (!s.gap_ns)
+				s.gap_ns = now;
+			if (!flush && s.pending.size() <= _opts.window && now - s.gap_ns < _opts.gap_timeout_ns)
+				break;
+
+			hogl::post(_area, _area->WARN, "stream %s: skipping frames %llu-%llu", s.name, s.next, seqno - 1);
+			_skipped.fetch_add(seqno - s.next, std::memory_order_relaxed);
+		}
+		s.gap_ns = 0;
+
+		publish(s, it->second);
+		s.pending.erase(it);
+
+		s.last = seqno;
+		s.has_last = true;
+		s.next = seqno + 1;
+	}
+
+	collect(s, done);
+}
+
+void sequencer::complete(stream& s, frame& f)
+{
+	std::vector<std::shared_ptr<iodme::segment>> done;
+
+	{
+		std::lock_guard<std::mutex> lock(s.mutex);
+
+		if (s.inflight)
+			s.inflight--;
+
+		if (s.has_last && f.seqno <= s.last) {
+			// Already skipped over. Keep the data but it's out of order now.
+			hogl::post(_area, _area->WARN, "stream %s: late frame %llu (last %llu)", s.name, f.seqno, s.last);
+			publish(s, f);
+		} else {
+			s.pending[f.seqno] = f;
+		}
+
+		drain(s, done, iodme::thread::now_ns());
+	}
+
+	close_segments(done);
+}
+
+void sequencer::expire()
+{
+	uint64_t now  = iodme::thread::now_ns();
+	uint64_t last = _expire_ns.load(std::memory_order_relaxed);
+
+	// A few passes per timeout are good enough, only one writer does it
+	if (now - last < _opts.gap_timeout_ns / 4 ||
+			!_expire_ns.compare_exchange_strong(last, now, std::memory_order_relaxed))
+		return;
+
+	std::vector<std::shared_ptr<iodme::segment>> done;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto& it : _streams) {
+			stream& s = *it.second;
+			std::lock_guard<std::mutex> slock(s.mutex);
+			if (s.gap_ns)
+				drain(s, done, now);
+		}
+	}
+
+	close_segments(done);
+}
+
+void sequencer::rotate(bool all)
+{
+	std::vector<std::shared_ptr<iodme::segment>> done;
+	uint64_t now = iodme::thread::now_ns();
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (auto& it : _streams) {
+			stream& s = *it.second;
+			std::lock_guard<std::mutex> slock(s.mutex);
+			if (s.seg && (all || (_opts.segment_time_ns && s.seg->age_ns(now) >= _opts.segment_time_ns)))
+				retire(s, done);
+		}
+	}
+
+	close_segments(done);
+}
+
+} // namespace iodme
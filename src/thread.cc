@@ -34,7 +34,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sched.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -54,8 +56,12 @@ thread::thread(const std::string &name) :
 	_failed(false),
 	_running(false),
 	_killed(false),
-	_thread_created(false)
+	_thread_created(false),
+	_pin(false),
+	_policy(-1),
+	_prio(0)
 {
+	CPU_ZERO(&_cpus);
 	_area = hogl::add_area(_name.c_str());
 }
 
@@ -75,11 +81,47 @@ bool thread::start()
 	return true;
 }
 
-thread::~thread()
+void thread::join()
 {
 	_killed = true;
-	if (_thread_created)
+	if (_thread_created) {
 		pthread_join(_thread, NULL);
+		_thread_created = false;
+	}
+}
+
+thread::~thread()
+{
+	join();
+}
+
+bool thread::parse_sched(const std::string& spec, int& policy, int& prio)
+{
+	std::string name = spec.substr(0, spec.find(':'));
+	prio = 0;
+
+	if (name == "other")
+		policy = SCHED_OTHER;
+	else if (name == "batch")
+		policy = SCHED_BATCH;
+	else if (name == "idle")
+		policy = SCHED_IDLE;
+	else if (name == "fifo")
+		policy = SCHED_FIFO;
+	else if (name == "rr")
+		policy = SCHED_RR;
+	else
+		return false;
+
+	if (name.size() < spec.size()) {
+		char *end;
+		const char *p = spec.c_str() + name.size() + 1;
+		prio = strtol(p, &end, 10);
+		if (end == p || *end)
+			return false;
+	}
+
+	return prio >= sched_get_priority_min(policy) && prio <= sched_get_priority_max(policy);
 }
 
 void *thread::entry(void *_self)
@@ -93,6 +135,21 @@ void *thread::entry(void *_self)
 
 	hogl::post(self->_area, self->_area->DEBUG, "thread entry: ring %p", tls.ring());
 
+	if (self->_pin) {
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(self->_cpus), &self->_cpus);
+		if (err)
+			hogl::post(self->_area, self->_area->WARN, "failed to set cpu affinity: %s(%d)", strerror(err), err);
+	}
+
+	if (self->_policy >= 0) {
+		struct sched_param sp = { 0 };
+		sp.sched_priority = self->_prio;
+		int err = pthread_setschedparam(pthread_self(), self->_policy, &sp);
+		if (err)
+			hogl::post(self->_area, self->_area->WARN, "failed to set scheduling policy %d prio %d: %s(%d)",
+				self->_policy, self->_prio, strerror(err), err);
+	}
+
 	// Run the loop
 	self->loop();
 
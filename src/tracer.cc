@@ -0,0 +1,147 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hogl/post.hpp>
+
+#include "iodme/tracer.hpp"
+
+namespace iodme {
+
+const tracer::options tracer::default_options = {
+	.path = ""
+};
+
+tracer::tracer(const std::string& name, const options& opts) :
+	iodme::thread(name),
+	_opts(opts),
+	_file(0),
+	_dumping(false),
+	_metrics(name),
+	_dropped(0),
+	_written(_metrics.add_counter("written"))
+{
+	_metrics.add_gauge("dropped", [this]() { return _dropped.load(std::memory_order_relaxed); });
+
+	if (_opts.path.empty())
+		return;
+
+	_file = fopen(_opts.path.c_str(), "w");
+	if (!_file)
+		hogl::post(_area, _area->ERROR, "failed to open trace file %s: %s(%d)",
+				_opts.path, strerror(errno), errno);
+	_dumping = _file != 0;
+}
+
+// Duration between two points, 0 if either was not reached
+static inline uint64_t span(const buffer::metadata& m, unsigned int from, unsigned int to)
+{
+	if (!m.trace[from] || m.trace[to] < m.trace[from])
+		return 0;
+	return m.trace[to] - m.trace[from];
+}
+
+void tracer::account(const buffer::metadata& m)
+{
+	const uint64_t *t = m.trace;
+
+	std::unique_ptr<stream>& sp = _streams[m.name];
+	if (!sp)
+		sp.reset(new stream(m.name));
+	stream& s = *sp;
+
+	if (t[buffer::T_RX_DONE])
+		s.rx.record(span(m, buffer::T_FIRST_RECV, buffer::T_RX_DONE));
+	if (t[buffer::T_WR_POP])
+		s.queue_wait.record(span(m, buffer::T_RX_DONE, buffer::T_WR_POP));
+	if (t[buffer::T_WRITE_END])
+		s.write.record(span(m, buffer::T_WR_POP, buffer::T_WRITE_END));
+
+	unsigned int last = buffer::T_WRITE_END;
+	if (t[buffer::T_SYNC_END]) {
+		s.sync.record(span(m, buffer::T_WRITE_END, buffer::T_SYNC_END));
+		last = buffer::T_SYNC_END;
+	}
+	if (t[last])
+		s.end_to_end.record(span(m, buffer::T_FIRST_RECV, last));
+}
+
+void tracer::dump(const buffer::metadata& m)
+{
+	record r;
+	r.seqno = m.seqno;
+	strncpy(r.name, m.name, sizeof(r.name) - 1);
+	r.name[sizeof(r.name) - 1] = '\0';
+	memcpy(r.trace, m.trace, sizeof(r.trace));
+
+	if (fwrite(&r, sizeof(r), 1, _file) != 1) {
+		hogl::post(_area, _area->ERROR, "failed to write trace file %s: %s(%d)",
+				_opts.path, strerror(errno), errno);
+		fclose(_file);
+		_file = 0;
+		_dumping = false;
+		return;
+	}
+	_written.add();
+}
+
+void tracer::loop()
+{
+	if (_file)
+		hogl::post(_area, _area->INFO, "tracer loop: dumping into %s", _opts.path);
+	else
+		hogl::post(_area, _area->INFO, "tracer loop: no trace file");
+
+	buffer::metadata m;
+	while (1) {
+		bool got = _killed ? _q.pop(m) : _q.pop_wait(m, default_wait);
+		if (!got) {
+			if (_killed)
+				break;
+			continue;
+		}
+
+		account(m);
+		if (_file)
+			dump(m);
+	}
+
+	if (_file)
+		fflush(_file);
+}
+
+} // namespace iodme
@@ -0,0 +1,280 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "iodme/uring.hpp"
+
+namespace iodme {
+
+static inline int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int io_uring_register(int fd, unsigned int opcode, const void *arg, unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+uring::uring(unsigned int depth) :
+	_failed(true),
+	_errno(EBADFD),
+	_fd(-1),
+	_sqe_tail(0),
+	_sqe_queued(0),
+	_sq_ring(MAP_FAILED),
+	_cq_ring(MAP_FAILED),
+	_sqes_size(0)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	_fd = io_uring_setup(depth, &p);
+	if (_fd < 0) {
+		_errno = errno;
+		return;
+	}
+
+	_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	_sqes_size    = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	_sq_ring = mmap(0, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+	if (_sq_ring == MAP_FAILED) {
+		_errno = errno;
+		return;
+	}
+
+	_cq_ring = mmap(0, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+	if (_cq_ring == MAP_FAILED) {
+		_errno = errno;
+		return;
+	}
+
+	_sqes = (struct io_uring_sqe *) mmap(0, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+	if (_sqes == MAP_FAILED) {
+		_errno = errno;
+		_sqes_size = 0;
+		return;
+	}
+
+	uint8_t *sq = (uint8_t *) _sq_ring;
+	_sq_head  = (unsigned int *) (sq + p.sq_off.head);
+	_sq_tail  = (unsigned int *) (sq + p.sq_off.tail);
+	_sq_mask  = (unsigned int *) (sq + p.sq_off.ring_mask);
+	_sq_array = (unsigned int *) (sq + p.sq_off.array);
+	_sq_entries = p.sq_entries;
+
+	uint8_t *cq = (uint8_t *) _cq_ring;
+	_cq_head = (unsigned int *) (cq + p.cq_off.head);
+	_cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+	_cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+	_cqes    = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+	// We always fill SQEs in ring order, so the index array is an identity map
+	for (unsigned int i = 0; i < _sq_entries; i++)
+		_sq_array[i] = i;
+
+	_sqe_tail = *_sq_tail;
+
+	_errno  = 0;
+	_failed = false;
+}
+
+void uring::unmap()
+{
+	if (_sqes_size)
+		munmap(_sqes, _sqes_size);
+	if (_cq_ring != MAP_FAILED)
+		munmap(_cq_ring, _cq_ring_size);
+	if (_sq_ring != MAP_FAILED)
+		munmap(_sq_ring, _sq_ring_size);
+}
+
+uring::~uring()
+{
+	unmap();
+	if (_fd >= 0)
+		close(_fd);
+}
+
+struct io_uring_sqe* uring::get_sqe()
+{
+	unsigned int head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+	if (_sqe_tail - head >= _sq_entries)
+		return 0;
+
+	struct io_uring_sqe *sqe = &_sqes[_sqe_tail & *_sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+
+	_sqe_tail++;
+	_sqe_queued++;
+	return sqe;
+}
+
+int uring::submit(unsigned int wait_nr)
+{
+	// Publish new entries to the kernel
+	__atomic_store_n(_sq_tail, _sqe_tail, __ATOMIC_RELEASE);
+
+	unsigned int flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+	if (!_sqe_queued && !wait_nr)
+		return 0;
+
+	int r;
+	do {
+		r = io_uring_enter(_fd, _sqe_queued, wait_nr, flags);
+	} while (r < 0 && errno == EINTR);
+
+	if (r < 0) {
+		_errno = errno;
+		return -1;
+	}
+
+	_sqe_queued -= r;
+	return r;
+}
+
+bool uring::pop_cqe(struct io_uring_cqe &cqe)
+{
+	unsigned int head = *_cq_head;
+	if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+		return false;
+
+	cqe = _cqes[head & *_cq_mask];
+	__atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool uring::register_files(const int *fds, unsigned int count)
+{
+	if (io_uring_register(_fd, IORING_REGISTER_FILES, fds, count) < 0) {
+		_errno = errno;
+		return false;
+	}
+	return true;
+}
+
+bool uring::probe(const uint8_t *ops, unsigned int count)
+{
+	static const unsigned int max_ops = 256;
+	size_t size = sizeof(struct io_uring_probe) + max_ops * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *p = (struct io_uring_probe *) calloc(1, size);
+	if (!p) {
+		_errno = ENOMEM;
+		return false;
+	}
+
+	bool ok = io_uring_register(_fd, IORING_REGISTER_PROBE, p, max_ops) == 0;
+	if (!ok)
+		_errno = errno;
+
+	for (unsigned int i = 0; ok && i < count; i++) {
+		if (ops[i] > p->last_op || !(p->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+			_errno = EOPNOTSUPP;
+			ok = false;
+		}
+	}
+
+	free(p);
+	return ok;
+}
+
+// Run a single op and wait for it
+static bool run_one(uring& ring, const struct io_uring_sqe& op, int& res)
+{
+	struct io_uring_sqe *sqe = ring.get_sqe();
+	if (!sqe)
+		return false;
+	*sqe = op;
+
+	if (ring.submit(1) < 0)
+		return false;
+
+	struct io_uring_cqe cqe;
+	if (!ring.pop_cqe(cqe))
+		return false;
+	res = cqe.res;
+	return true;
+}
+
+bool uring::probe_direct_files(unsigned int slot)
+{
+	struct io_uring_sqe op;
+	memset(&op, 0, sizeof(op));
+	op.opcode     = IORING_OP_OPENAT;
+	op.fd         = AT_FDCWD;
+	op.addr       = (uint64_t) "/";
+	op.open_flags = O_RDONLY | O_DIRECTORY;
+	op.file_index = slot + 1;
+
+	int res;
+	if (!run_one(*this, op, res))
+		return false;
+
+	if (res > 0) {
+		// file_index was ignored, got a normal fd
+		close(res);
+		_errno = EOPNOTSUPP;
+		return false;
+	}
+	if (res < 0) {
+		_errno = -res;
+		return false;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.opcode     = IORING_OP_CLOSE;
+	op.file_index = slot + 1;
+	if (!run_one(*this, op, res))
+		return false;
+	if (res < 0) {
+		_errno = -res;
+		return false;
+	}
+	return true;
+}
+
+} // namespace iodme
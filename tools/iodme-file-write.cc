@@ -32,28 +32,31 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <memory.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/uio.h>
+#include <sys/utsname.h>
 
-#include <iostream>
-#include <chrono>
+#include <boost/program_options.hpp>
 
-#include <boost/accumulators/accumulators.hpp>
-#include <boost/accumulators/statistics/count.hpp>
-#include <boost/accumulators/statistics/max.hpp>
-#include <boost/accumulators/statistics/mean.hpp>
-#include <boost/accumulators/statistics/min.hpp>
-#include <boost/accumulators/statistics/variance.hpp>
-#include <boost/accumulators/statistics/stats.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "iodme/mover.hpp"
 
-namespace bacc = boost::accumulators;
+namespace po = boost::program_options;
 
 // Needed for older ubuntu that do not have memfd in the glibc
 #ifndef MFD_HUGETLB
@@ -61,116 +64,503 @@ namespace bacc = boost::accumulators;
 #endif
 int memfd_create(const char *name, unsigned int flags)
 {
-	return syscall(SYS_memfd_create, name, 0);
+	return syscall(SYS_memfd_create, name, flags);
 }
 
-int main(int argc, char **argv) 
-{
-	size_t buf_size = 1ULL * 1024 * 1024 * 1024;
-	bool use_splice = false;
-	bool use_memfd  = false;
+// Hugepage mappings must be a multiple of the (default) hugepage size
+static const size_t hugepage_size = 2ULL * 1024 * 1024;
+
+// How the buffer is moved into the file
+enum Method {
+	WRITEV,   // plain writev()
+	VMSPLICE, // vmsplice() into a pipe + splice() into the file
+	SENDFILE  // memfd backed buffer + sendfile()
+};
+
+static const char *method_name[] = { "writev", "vmsplice", "sendfile" };
+
+// Single benchmark case (one row of the results matrix)
+struct bench_case {
+	Method       method;
+	bool         directio;
+	bool         hugepage;
+	size_t       size;
+
+	std::string mode() const
+	{
+		std::string m(method_name[method]);
+		if (directio) m += "+directio";
+		if (hugepage) m += "+hugepage";
+		return m;
+	}
+};
 
-	unsigned int mmap_flags = MAP_ANONYMOUS | MAP_PRIVATE;
-	unsigned int open_flags = O_CREAT | O_TRUNC | O_WRONLY;
+// Benchmark results for a case
+struct bench_result {
+	bench_case c;
+	bool       ok;
+	std::string error;
+	std::vector<double> samples; // seconds per write
 
-	std::string ofile("/disk/speed-test/vmsplice-out");
+	double min, max, avg, stddev;
+	double p50, p99, p999;
+	double gbps_avg, gbps_p50;  // throughput in GB/s (10^9 bytes)
+};
 
-	for (int i=1; i < argc; i++) {
-		std::string arg(argv[i]);
+enum CacheMode {
+	CACHE_KEEP,   // leave the page cache alone
+	CACHE_FILE,   // fsync and drop the output file pages after each write
+	CACHE_SYSTEM  // same as file + drop all caches before each write (root only)
+};
 
-		if (arg == "use_memfd")  { use_memfd = true; continue; }
-		if (arg == "use_splice") { use_splice = true; continue; }
-		if (arg == "use_hugepages") { mmap_flags |= MAP_HUGETLB;   continue; }
-		if (arg == "use_directio") { open_flags |= O_DIRECT;   continue; }
-		if (arg == "1GB") { buf_size = 1ULL * 1024 * 1024 * 1024;  continue; }
-		if (arg == "2GB") { buf_size = 2ULL * 1024 * 1024 * 1024;  continue; }
+struct bench_options {
+	std::string  ofile;
+	unsigned int iterations;
+	unsigned int warmup;
+	CacheMode    cache;
+	bool         timed_sync; // include fsync in the measured time
+	int          fill;       // fill byte, -1 - don't touch the buffer between writes
+};
 
-		ofile = arg;
+static bench_options bopts;
+
+static size_t parse_size(const std::string& s)
+{
+	char *end;
+	unsigned long long v = strtoull(s.c_str(), &end, 0);
+	switch (*end) {
+	case 'k': case 'K': v *= 1024ULL; end++; break;
+	case 'm': case 'M': v *= 1024ULL * 1024; end++; break;
+	case 'g': case 'G': v *= 1024ULL * 1024 * 1024; end++; break;
 	}
+	if (*end == 'B' || *end == 'b')
+		end++;
+	if (*end || !v)
+		return 0;
+	return v;
+}
 
-	// Allocate main buffer
-	int buf_fd = -1;
+// Split comma separated list
+static std::vector<std::string> split_list(const std::vector<std::string>& args)
+{
+	std::vector<std::string> v;
+	for (auto &a : args) {
+		std::istringstream in(a);
+		std::string s;
+		while (std::getline(in, s, ','))
+			if (!s.empty()) v.push_back(s);
+	}
+	return v;
+}
 
-	if (use_memfd) {
-		buf_fd = memfd_create("file-write-tests.memfd", MFD_HUGETLB);
-		if (buf_fd == -1) {
-			std::cerr << "memfd open failed: " << strerror(errno) << '\n';
-			exit(1);
+// Mode is <method>[+directio][+hugepage] or 'all' for every combination
+static bool parse_modes(const std::vector<std::string>& args, std::vector<bench_case>& modes)
+{
+	for (auto &a : split_list(args)) {
+		if (a == "all") {
+			for (unsigned int m = WRITEV; m <= SENDFILE; m++)
+				for (unsigned int f = 0; f < 4; f++)
+					modes.push_back({ (Method) m, (f & 1) != 0, (f & 2) != 0, 0 });
+			continue;
 		}
 
-		if (ftruncate(buf_fd, buf_size) == -1) {
-			std::cerr << "memfd open failed: " << strerror(errno) << '\n';
-			exit(1);
+		bench_case c = { WRITEV, false, false, 0 };
+		std::istringstream in(a);
+		std::string tok;
+		bool first = true;
+		while (std::getline(in, tok, '+')) {
+			if (first) {
+				auto m = std::find_if(std::begin(method_name), std::end(method_name),
+						[&tok](const char *n) { return tok == n; });
+				if (m == std::end(method_name)) {
+					std::cerr << "unsupported write method " << tok << '\n';
+					return false;
+				}
+				c.method = (Method) (m - std::begin(method_name));
+				first = false;
+			} else if (tok == "directio")
+				c.directio = true;
+			else if (tok == "hugepage")
+				c.hugepage = true;
+			else {
+				std::cerr << "unsupported mode modifier " << tok << '\n';
+				return false;
+			}
 		}
+		modes.push_back(c);
 	}
+	return !modes.empty();
+}
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-	uint8_t *buf = (uint8_t *) mmap(NULL, buf_size, PROT_READ | PROT_WRITE, mmap_flags, buf_fd, 0);
+static void drop_system_caches()
+{
+	sync();
+	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd < 0 || write(fd, "3", 1) != 1)
+		std::cerr << "failed to drop caches: " << strerror(errno) << '\n';
+	if (fd >= 0)
+		close(fd);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const std::vector<double>& v, double p)
+{
+	size_t rank = (size_t) std::ceil(p * v.size());
+	return v[rank ? rank - 1 : 0];
+}
+
+static void summarize(bench_result& r)
+{
+	std::vector<double> s(r.samples);
+	std::sort(s.begin(), s.end());
+
+	double sum = 0;
+	for (auto d : s) sum += d;
+	r.avg = sum / s.size();
+
+	double var = 0;
+	for (auto d : s) var += (d - r.avg) * (d - r.avg);
+	r.stddev = std::sqrt(var / s.size());
+
+	r.min  = s.front();
+	r.max  = s.back();
+	r.p50  = percentile(s, 0.50);
+	r.p99  = percentile(s, 0.99);
+	r.p999 = percentile(s, 0.999);
+
+	r.gbps_avg = r.c.size / r.avg / 1e9;
+	r.gbps_p50 = r.c.size / r.p50 / 1e9;
+}
+
+static bool failed_case(bench_result& r, const std::string& what, int err)
+{
+	r.ok = false;
+	r.error = what + ": " + strerror(err);
+	std::cerr << r.c.mode() << " " << r.c.size << ": " << r.error << '\n';
+	return false;
+}
+
+static bool run_case(iodme::mover& s, bench_result& r)
+{
+	const bench_case& c = r.c;
+	r.ok = true;
+
+	// Allocate main buffer
+	size_t map_size = c.size;
+	if (c.hugepage)
+		map_size = (map_size + hugepage_size - 1) & ~(hugepage_size - 1);
+
+	int buf_fd = -1;
+	unsigned int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	if (c.method == SENDFILE) {
+		buf_fd = memfd_create("file-write-tests.memfd", c.hugepage ? MFD_HUGETLB : 0);
+		if (buf_fd == -1)
+			return failed_case(r, "memfd open failed", errno);
+
+		if (ftruncate(buf_fd, map_size) == -1) {
+			failed_case(r, "memfd truncate failed", errno);
+			close(buf_fd);
+			return false;
+		}
+
+		// sendfile() reads the memfd, make sure it sees what we write into the buffer
+		mmap_flags = MAP_SHARED;
+	} else if (c.hugepage)
+		mmap_flags |= MAP_HUGETLB;
+
+	uint8_t *buf = (uint8_t *) mmap(NULL, map_size, PROT_READ | PROT_WRITE, mmap_flags, buf_fd, 0);
 	if (buf == MAP_FAILED) {
-		std::cerr << "mmap failed: " << strerror(errno) << '\n';
-		exit(1);
+		failed_case(r, "mmap failed", errno);
+		if (buf_fd != -1)
+			close(buf_fd);
+		return false;
 	}
 
-        std::cout << "buffer size: " << buf_size << " bytes\n";
+	// Fault the buffer in before the first write
+	memset(buf, bopts.fill < 0 ? 0 : bopts.fill, c.size);
 
-	iodme::mover s;
-	if (s.failed())
-		exit(1);
+	unsigned int open_flags = O_CREAT | O_TRUNC | O_WRONLY | (c.directio ? O_DIRECT : 0);
 
-	bacc::accumulator_set< double, bacc::stats<
-            bacc::tag::min,
-            bacc::tag::max,
-            bacc::tag::mean,
-            bacc::tag::variance > > stats;
+	for (unsigned int i = 0; i < bopts.warmup + bopts.iterations; i++) {
+		if (bopts.cache == CACHE_SYSTEM)
+			drop_system_caches();
 
-	for (unsigned int i=0; i < 20; i++) {
-		int fd = open(ofile.c_str(), open_flags, 0666);
+		int fd = open(bopts.ofile.c_str(), open_flags, 0666);
 		if (fd < 0) {
-			std::cerr << "open " << ofile << " failed: " << strerror(errno) << '\n';
-			exit(1);
+			failed_case(r, "open " + bopts.ofile + " failed", errno);
+			break;
 		}
 
-		memset(buf, 0, buf_size);
+		if (bopts.fill >= 0)
+			memset(buf, bopts.fill, c.size);
 
 		struct iovec iov;
 		iov.iov_base = buf;
-		iov.iov_len  = buf_size;
-
-		auto start = std::chrono::high_resolution_clock::now();
-		if (use_memfd) {
-			bool r = s.do_write(fd, buf_fd, buf_size);
-			if (!r) {
-				std::cerr << "splice/write failed: " << strerror(s.last_errno()) << '\n';
-				exit(1);
-			}
-		} else if (use_splice) {
-			bool r = s.do_write(fd, &iov, 1);
-			if (!r) {
-				std::cerr << "splice/write failed: " << strerror(s.last_errno()) << '\n';
-				exit(1);
-			}
+		iov.iov_len  = c.size;
+
+		double start = now_sec();
+
+		bool w = true;
+		int  w_errno = 0;
+		if (c.method == SENDFILE) {
+			w = s.do_write(fd, buf_fd, c.size);
+			w_errno = s.last_errno();
+		} else if (c.method == VMSPLICE) {
+			w = s.do_write(fd, &iov, 1);
+			w_errno = s.last_errno();
 		} else {
-			int r = writev(fd, &iov, 1);
-			if (r < 0) {
-				std::cerr << "write failed: " << strerror(errno) << '\n';
-				exit(1);
+			// Large writes may come back short, keep going
+			while (iov.iov_len) {
+				ssize_t n = writev(fd, &iov, 1);
+				if (n <= 0) {
+					w = false;
+					w_errno = n < 0 ? errno : EIO;
+					break;
+				}
+				iov.iov_base = (uint8_t *) iov.iov_base + n;
+				iov.iov_len -= n;
 			}
 		}
-        	auto end = std::chrono::high_resolution_clock::now();
 
-        	std::chrono::duration<double> diff = end - start;
-		stats(diff.count());
+		if (w && bopts.timed_sync)
+			fsync(fd);
+
+		double end = now_sec();
+
+		if (!w) {
+			failed_case(r, std::string(method_name[c.method]) + " failed", w_errno);
+			close(fd);
+			break;
+		}
+
+		if (i >= bopts.warmup)
+			r.samples.push_back(end - start);
 
-		fsync(fd);
-		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		if (bopts.cache != CACHE_KEEP) {
+			if (!bopts.timed_sync)
+				fsync(fd);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		}
 		close(fd);
 	}
 
-        std::cout << "stats: "
-	       	<< " min " << bacc::min(stats)
-	       	<< " max " << bacc::max(stats)
-	       	<< " avg " << bacc::mean(stats)
-		<< " sec per write/splice\n";
+	(void) munmap(buf, map_size);
+	if (buf_fd != -1)
+		close(buf_fd);
+
+	if (r.ok)
+		summarize(r);
+
+	return r.ok;
+}
+
+// **** Results output ****
+
+static void output_text(std::ostream& out, const std::vector<bench_result>& results)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "%-28s %12s %9s %9s %9s %9s %9s %9s %8s %8s\n",
+		"mode", "size", "min", "avg", "p50", "p99", "p999", "max", "GB/s", "GB/s-p50");
+	out << line;
+
+	for (auto &r : results) {
+		if (!r.ok) {
+			snprintf(line, sizeof(line), "%-28s %12zu %s\n", r.c.mode().c_str(), r.c.size, r.error.c_str());
+			out << line;
+			continue;
+		}
+		snprintf(line, sizeof(line), "%-28s %12zu %9.6f %9.6f %9.6f %9.6f %9.6f %9.6f %8.3f %8.3f\n",
+			r.c.mode().c_str(), r.c.size, r.min, r.avg, r.p50, r.p99, r.p999, r.max,
+			r.gbps_avg, r.gbps_p50);
+		out << line;
+	}
+	out << "(seconds per write)\n";
+}
+
+static void output_csv(std::ostream& out, const std::vector<bench_result>& results)
+{
+	out << "mode,method,directio,hugepage,size,iterations,ok,min,avg,stddev,p50,p99,p999,max,gbps_avg,gbps_p50,error\n";
+	for (auto &r : results) {
+		out << r.c.mode() << ',' << method_name[r.c.method] << ','
+			<< r.c.directio << ',' << r.c.hugepage << ','
+			<< r.c.size << ',' << r.samples.size() << ',' << r.ok << ',';
+		if (r.ok)
+			out << r.min << ',' << r.avg << ',' << r.stddev << ','
+				<< r.p50 << ',' << r.p99 << ',' << r.p999 << ',' << r.max << ','
+				<< r.gbps_avg << ',' << r.gbps_p50 << ',';
+		else
+			out << ",,,,,,,,,";
+		out << '"' << r.error << '"' << '\n';
+	}
+}
+
+static void output_json(std::ostream& out, const std::vector<bench_result>& results)
+{
+	// Describe the run so that results from different boxes can be compared
+	struct utsname u;
+	uname(&u);
+	char host[256] = { 0 };
+	gethostname(host, sizeof(host) - 1);
+
+	static const char *cache_name[] = { "keep", "file", "system" };
+
+	out << "{\"host\": \"" << host << "\", \"kernel\": \"" << u.release << "\", \"machine\": \"" << u.machine << "\""
+		<< ", \"iterations\": " << bopts.iterations << ", \"warmup\": " << bopts.warmup
+		<< ", \"drop_caches\": \"" << cache_name[bopts.cache] << "\""
+		<< ", \"timed_sync\": " << (bopts.timed_sync ? "true" : "false")
+		<< ", \"results\": [";
+
+	const char *sep = "";
+	for (auto &r : results) {
+		out << sep << "\n  {\"mode\": \"" << r.c.mode() << "\", \"method\": \"" << method_name[r.c.method] << "\""
+			<< ", \"directio\": " << (r.c.directio ? "true" : "false")
+			<< ", \"hugepage\": " << (r.c.hugepage ? "true" : "false")
+			<< ", \"size\": " << r.c.size
+			<< ", \"iterations\": " << r.samples.size()
+			<< ", \"ok\": " << (r.ok ? "true" : "false");
+		if (r.ok)
+			out << ", \"min\": " << r.min << ", \"avg\": " << r.avg << ", \"stddev\": " << r.stddev
+				<< ", \"p50\": " << r.p50 << ", \"p99\": " << r.p99 << ", \"p999\": " << r.p999
+				<< ", \"max\": " << r.max
+				<< ", \"gbps_avg\": " << r.gbps_avg << ", \"gbps_p50\": " << r.gbps_p50;
+		else
+			out << ", \"error\": \"" << r.error << "\"";
+		out << "}";
+		sep = ",";
+	}
+	out << "\n]}\n";
+}
+
+int main(int argc, char **argv) 
+{
+	std::vector<std::string> size_args, mode_args;
+
+	po::options_description optdesc("File write benchmark");
+	optdesc.add_options()
+		("help", "Print this message")
+		("output,o",     po::value<std::string>(&bopts.ofile)->default_value("/disk/speed-test/vmsplice-out"), "Output file to write into")
+		("size,s",       po::value<std::vector<std::string> >(&size_args)->composing(), "Buffer sizes (eg 64K,4M,1G). Multiple sizes can be specified. Default: 1G")
+		("mode,m",       po::value<std::vector<std::string> >(&mode_args)->composing(),
+			"Write modes: <writev|vmsplice|sendfile>[+directio][+hugepage] or 'all'. Multiple modes can be specified. Default: writev")
+		("iterations,n", po::value<unsigned int>(&bopts.iterations)->default_value(20), "Number of measured writes per case")
+		("warmup,w",     po::value<unsigned int>(&bopts.warmup)->default_value(1), "Number of unmeasured writes before the measured ones")
+		("drop-caches",  po::value<std::string>()->default_value("file"),
+			"Page cache control: keep, file (fsync and drop output file pages after each write), system (also drop all caches before each write, needs root)")
+		("timed-sync",   "Include fsync in the measured write time")
+		("fill",         po::value<int>(&bopts.fill)->default_value(0), "Fill byte written into the buffer before each write, -1 - fill once")
+		("pipe-size",    po::value<unsigned int>(), "Set max pipe size (/proc/sys/fs/pipe-max-size) before running, needs root")
+		("format,f",     po::value<std::string>()->default_value("text"), "Results format: text, json, csv")
+		("results,r",    po::value<std::string>(), "Write results into this file instead of stdout");
+
+	po::variables_map optmap;
+	try {
+		po::store(po::parse_command_line(argc, argv, optdesc), optmap);
+		po::notify(optmap);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << '\n';
+		exit(1);
+	}
+
+	if (optmap.count("help")) {
+		std::cout << optdesc << std::endl;
+		exit(1);
+	}
+
+	std::string cache = optmap["drop-caches"].as<std::string>();
+	if (cache == "keep")
+		bopts.cache = CACHE_KEEP;
+	else if (cache == "file")
+		bopts.cache = CACHE_FILE;
+	else if (cache == "system")
+		bopts.cache = CACHE_SYSTEM;
+	else {
+		std::cerr << "unsupported cache mode " << cache << '\n';
+		exit(1);
+	}
+	bopts.timed_sync = optmap.count("timed-sync");
+
+	std::string format = optmap["format"].as<std::string>();
+	if (format != "text" && format != "json" && format != "csv") {
+		std::cerr << "unsupported results format " << format << '\n';
+		exit(1);
+	}
+
+	if (!bopts.iterations) {
+		std::cerr << "need at least one iteration\n";
+		exit(1);
+	}
+
+	std::vector<size_t> sizes;
+	if (size_args.empty())
+		size_args.push_back("1G");
+	for (auto &a : split_list(size_args)) {
+		size_t sz = parse_size(a);
+		if (!sz) {
+			std::cerr << "invalid size " << a << '\n';
+			exit(1);
+		}
+		sizes.push_back(sz);
+	}
+
+	std::vector<bench_case> modes;
+	if (mode_args.empty())
+		mode_args.push_back("writev");
+	if (!parse_modes(mode_args, modes))
+		exit(1);
+
+	if (optmap.count("pipe-size")) {
+		// Bigger pipes reduce the number of vmsplice() calls
+		std::ofstream ps("/proc/sys/fs/pipe-max-size");
+		ps << optmap["pipe-size"].as<unsigned int>() << std::endl;
+		if (!ps) {
+			std::cerr << "failed to set pipe size: " << strerror(errno) << '\n';
+			exit(1);
+		}
+	}
+
+	// Mover sizes its pipe at creation
+	iodme::mover s;
+	if (s.failed())
+		exit(1);
+
+	std::vector<bench_result> results;
+	for (auto sz : sizes) {
+		for (auto m : modes) {
+			bench_result r;
+			r.c = m;
+			r.c.size = sz;
+
+			std::cerr << "running " << r.c.mode() << " size " << sz << '\n';
+			run_case(s, r);
+			results.push_back(r);
+		}
+	}
+
+	std::ofstream rfile;
+	if (optmap.count("results")) {
+		rfile.open(optmap["results"].as<std::string>());
+		if (!rfile) {
+			std::cerr << "failed to open results file " << optmap["results"].as<std::string>() << ": " << strerror(errno) << '\n';
+			exit(1);
+		}
+	}
+	std::ostream& out = rfile.is_open() ? rfile : std::cout;
+
+	if (format == "json")
+		output_json(out, results);
+	else if (format == "csv")
+		output_csv(out, results);
+	else
+		output_text(out, results);
 
-	(void) munmap(buf, buf_size);
-	close(buf_fd);
+	bool ok = std::all_of(results.begin(), results.end(), [](const bench_result& r) { return r.ok; });
+	return ok ? 0 : 1;
 }
@@ -50,7 +50,9 @@
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
 #include <fstream>
+#include <vector>
 
 #include <hogl/format-basic.hpp>
 #include <hogl/format-raw.hpp>
@@ -70,7 +72,11 @@
 #include "iodme/buffer.hpp"
 #include "iodme/queue.hpp"
 #include "iodme/pump.hpp"
+#include "iodme/payload.hpp"
+#include "iodme/pacer.hpp"
 #include "iodme/nettx.hpp"
+#include "iodme/numa.hpp"
+#include "iodme/metrics.hpp"
 
 ////////
 using iodme::buffer;
@@ -81,6 +87,7 @@ namespace po = boost::program_options;
 
 static const hogl::area *area = nullptr;
 static po::variables_map optmap;
+static std::vector<std::string> stream_specs;
 
 static volatile bool killed = false;
 
@@ -114,20 +121,95 @@ static void setup_rt_sched()
 		strerror(errno), errno);
 }
 
-static bool run()
+// CPU list and scheduling settings for a group of threads
+struct thread_role {
+	bool      pin;
+	cpu_set_t cpus;
+	int       policy; // -1 - inherit
+	int       prio;
+};
+
+// Parse --<role>-cpus and --<role>-sched
+static bool parse_role(const std::string& role, thread_role& r)
 {
-	// Setup RT scheduling and lock ourselves in memory to minimize latencies.
-	setup_rt_sched();
+	r.pin    = false;
+	r.policy = -1;
+	r.prio   = 0;
+	CPU_ZERO(&r.cpus);
+
+	std::string cpus = role + "-cpus";
+	if (optmap.count(cpus)) {
+		std::string v = optmap[cpus].as<std::string>();
+		if (!iodme::numa::parse_cpulist(v.c_str(), r.cpus) || !CPU_COUNT(&r.cpus)) {
+			hogl::post(area, area->ERROR, "invalid cpu list for %s thread: %s", role.c_str(), v.c_str());
+			return false;
+		}
+		r.pin = true;
+	}
+
+	std::string sched = role + "-sched";
+	if (optmap.count(sched)) {
+		std::string v = optmap[sched].as<std::string>();
+		if (!iodme::thread::parse_sched(v, r.policy, r.prio)) {
+			hogl::post(area, area->ERROR, "invalid scheduling spec for %s thread: %s", role.c_str(), v.c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void setup_thread(iodme::thread& t, const thread_role& r)
+{
+	if (r.pin)
+		t.set_cpus(r.cpus);
+	if (r.policy >= 0)
+		t.set_sched(r.policy, r.prio);
+}
+
+// Generated stream settings
+struct stream_cfg {
+	std::string name;
+	uint32_t    frame_size;
+	float       rate;
+};
+
+// Parse --stream spec: <name>[:<frame-size>[:<fps>]]
+static bool parse_stream(const std::string& spec, stream_cfg& s)
+{
+	s.name       = spec.substr(0, spec.find(':'));
+	s.frame_size = optmap["frame-size"].as<unsigned int>();
+	s.rate       = optmap["frame-rate"].as<float>();
+
+	const char *p = spec.c_str() + s.name.size();
+	if (*p == ':') {
+		char *end;
+		s.frame_size = strtoul(++p, &end, 0);
+		if (end == p || (*end && *end != ':'))
+			return false;
+		p = end;
+	}
+	if (*p == ':') {
+		char *end;
+		s.rate = strtof(++p, &end);
+		if (end == p || *end)
+			return false;
+		p = end;
+	}
+
+	return *p == '\0' && s.frame_size && iodme::proto::valid_name(s.name.c_str());
+}
 
-	// Connect to the sink
+// Connect a new socket to the sink
+static int connect_sink(uint32_t sndbuf)
+{
 	int sk = socket(PF_INET, SOCK_STREAM, 0);
 	if (sk < 0) {
 		hogl::post(area, area->ERROR, "failed to create socket: %s(%d).",
 			   strerror(errno), errno);
-		return false;
+		return -1;
 	}
 
-	unsigned int sndbuf = optmap["frame-size"].as<unsigned int>() * 2;
 	if (setsockopt(sk, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf)) < 0) {
 		hogl::post(area, area->WARN, "Failed to set socket sndbuf depth: %s(%d).",
 			   strerror(errno), errno);
@@ -140,7 +222,8 @@ static bool run()
 	if (getaddrinfo(host.c_str(), port.c_str(), 0, &ai) < 0) {
 		hogl::post(area, area->ERROR, "Failed to resolve destination address %s: %s(%d).",
 			   host.c_str(), strerror(errno), errno);
-		return false;
+		close(sk);
+		return -1;
 	}
 
 	int r = connect(sk, ai->ai_addr, ai->ai_addrlen);
@@ -150,35 +233,216 @@ static bool run()
 
 	if (r < 0) {
 		hogl::post(area, area->ERROR, "Failed to connect the socket: %s(%d).", strerror(r_errno), r_errno);
+		close(sk);
+		return -1;
+	}
+
+	return sk;
+}
+
+static bool run()
+{
+	// Setup RT scheduling and lock ourselves in memory to minimize latencies.
+	setup_rt_sched();
+
+	thread_role pump_role, tx_role;
+	if (!parse_role("pump", pump_role) || !parse_role("tx", tx_role))
 		return false;
+
+	// Streams are either listed explicitly or numbered copies of the default one
+	std::vector<stream_cfg> streams;
+	for (auto& spec : stream_specs) {
+		stream_cfg sc;
+		if (!parse_stream(spec, sc)) {
+			hogl::post(area, area->ERROR, "invalid stream spec %s", spec);
+			return false;
+		}
+		streams.push_back(sc);
 	}
+	if (streams.empty()) {
+		std::string name;
+		if (optmap.count("name"))
+			name = optmap["name"].as<std::string>();
+		else {
+			char host[64] = { 0 };
+			gethostname(host, sizeof(host) - 1);
+			name = std::string(host) + "-" + std::to_string(getpid());
+		}
 
-	auto d_queue = std::make_unique<iodme::queue>();
-	auto d_nettx = std::make_unique<iodme::nettx>(sk, *d_queue);
-	auto d_pump  = std::make_unique<iodme::pump>(
-			optmap["frame-size"].as<unsigned int>(),
-			1000000000.0 / optmap["frame-rate"].as<float>(),
-			*d_queue);
+		unsigned int n = optmap["streams"].as<unsigned int>();
+		for (unsigned int i = 0; i < n; i++) {
+			stream_cfg sc = { n > 1 ? name + "-" + std::to_string(i) : name,
+				optmap["frame-size"].as<unsigned int>(), optmap["frame-rate"].as<float>() };
+			streams.push_back(sc);
+		}
+	}
+	if (streams.empty()) {
+		hogl::post(area, area->ERROR, "no streams to generate");
+		return false;
+	}
 
-	d_nettx->start();
-	if (d_nettx->failed() || !d_nettx->running()) {
-		hogl::post(area, area->ERROR, "data-nettx failed/stopped");
+	iodme::payload::Kind payload;
+	if (!iodme::payload::parse_kind(optmap["payload"].as<std::string>(), payload)) {
+		hogl::post(area, area->ERROR, "unsupported payload %s", optmap["payload"].as<std::string>());
 		return false;
 	}
 
-	d_pump->start();
-	if (d_pump->failed() || !d_pump->running()) {
-		hogl::post(area, area->ERROR, "data-pump failed/stopped");
+	iodme::pacer::options p_opts = iodme::pacer::default_options;
+	if (!iodme::pacer::parse_profile(optmap["profile"].as<std::string>(), p_opts) ||
+			!iodme::pacer::parse_catchup(optmap["catch-up"].as<std::string>(), p_opts.catchup)) {
+		hogl::post(area, area->ERROR, "invalid traffic profile %s or catch-up policy %s",
+				optmap["profile"].as<std::string>(), optmap["catch-up"].as<std::string>());
 		return false;
 	}
+	if (optmap.count("frame-size-min"))
+		p_opts.min_size = optmap["frame-size-min"].as<unsigned int>();
+
+	unsigned int n_pumps = std::min<size_t>(std::max(optmap["pump-threads"].as<unsigned int>(), 1U), streams.size());
+	unsigned int n_tx    = std::min<size_t>(std::max(optmap["tx-threads"].as<unsigned int>(), 1U), streams.size());
+
+	// Buffers are shared by all streams and sized for the largest frame
+	uint32_t frame_size = 0;
+	for (auto& sc : streams)
+		frame_size = std::max(frame_size, sc.frame_size);
+
+	unsigned int buff_count = optmap["buff-count"].as<unsigned int>();
+	if (!buff_count)
+		buff_count = std::max<size_t>(8, streams.size() * 2);
+
+	// Connect all streams first
+	std::vector<int> sks;
+	for (auto& sc : streams) {
+		int sk = connect_sink(sc.frame_size * 2);
+		if (sk < 0) {
+			for (int s : sks)
+				close(s);
+			return false;
+		}
+		sks.push_back(sk);
+	}
+
+	// Pre-allocate and pre-fault the frames.
+	// Pumps fill them, nettx returns them via the free queue once sent.
+	unsigned int buff_flags = 0;
+	if (optmap.count("hugepages")) buff_flags |= iodme::buffer::HUGEPAGE;
+
+	// Single pump and nettx get SPSC queues. Queues have room for all frames,
+	// so pumps never push back into the free queue.
+	iodme::queue::Mode q_mode = n_pumps == 1 && n_tx == 1 ? iodme::queue::SPSC : iodme::queue::MPMC;
+
+	auto f_queue = std::make_unique<iodme::queue>(buff_count, q_mode);
+	std::vector<buffer> frames;
+	for (unsigned int i = 0; i < buff_count; i++) {
+		std::string name("frame-buffer-");
+		name += std::to_string(i);
+
+		iodme::buffer::metadata m = { 0 };
+		buffer b;
+		if (!b.alloc(frame_size, buff_flags, name.c_str()) || !b.add_metadata(m)) {
+			hogl::post(area, area->ERROR, "failed to pre-allocate frame-%u size %u : %s(%d).",
+					i, frame_size, strerror(errno), errno);
+			for (auto &f : frames)
+				f.free();
+			for (int s : sks)
+				close(s);
+			return false;
+		}
+		memset(b.base, 0, b.capacity);
+		frames.push_back(b);
+		f_queue->push(b);
+	}
+
+	// Transmit threads, streams are spread round-robin.
+	// Each thread owns its sockets and has its own input queue.
+	unsigned int tx_flags = 0;
+	if (optmap.count("zerocopy"))   tx_flags |= iodme::nettx::ZEROCOPY;
+	if (optmap.count("raw-stream")) tx_flags |= iodme::nettx::RAW;
+
+	std::vector<std::unique_ptr<iodme::queue>> tx_queues;
+	std::vector<std::unique_ptr<iodme::nettx>> txs;
+	for (unsigned int i = 0; i < n_tx; i++) {
+		std::string name("IODME-NETTX");
+		if (n_tx > 1) name += std::to_string(i);
+
+		tx_queues.push_back(std::make_unique<iodme::queue>(buff_count, n_pumps == 1 ? iodme::queue::SPSC : iodme::queue::MPMC));
+		auto tx = std::make_unique<iodme::nettx>(name, *tx_queues.back(), tx_flags);
+		tx->set_free_queue(*f_queue);
+		setup_thread(*tx, tx_role);
+		txs.push_back(std::move(tx));
+	}
+
+	std::vector<std::unique_ptr<iodme::pump>> pumps;
+	for (unsigned int i = 0; i < n_pumps; i++) {
+		std::string name("IODME-PUMP");
+		if (n_pumps > 1) name += std::to_string(i);
+
+		auto p = std::make_unique<iodme::pump>(name, frame_size, *f_queue);
+		p->set_payload(payload);
+		p->set_checksum(optmap.count("checksum"));
+		setup_thread(*p, pump_role);
+		pumps.push_back(std::move(p));
+	}
+
+	for (unsigned int i = 0; i < streams.size(); i++) {
+		stream_cfg& sc = streams[i];
+
+		iodme::proto::hello h = iodme::proto::make_hello(sc.name, sc.frame_size, sc.rate);
+		txs[i % n_tx]->add_stream(i, sks[i], h);
+
+		// Independent random sequences for each stream
+		iodme::pacer::options so = p_opts;
+		so.rate     = sc.rate;
+		so.max_size = sc.frame_size;
+		so.seed     = p_opts.seed + i;
+		pumps[i % n_pumps]->add_stream(i, sc.name, *tx_queues[i % n_tx], so);
+
+		hogl::post(area, area->INFO, "stream %u %s: frame-size %u rate %.3f pump %u tx %u",
+				i, sc.name, sc.frame_size, sc.rate, i % n_pumps, i % n_tx);
+	}
+
+	for (auto& tx : txs) {
+		tx->start();
+		if (tx->failed() || !tx->running()) {
+			hogl::post(area, area->ERROR, "%s failed/stopped", tx->name());
+			return false;
+		}
+	}
 
-	while (!killed) {
-		if (!d_nettx->running() || !d_pump->running()) {
-			break;
+	for (auto& p : pumps) {
+		p->start();
+		if (p->failed() || !p->running()) {
+			hogl::post(area, area->ERROR, "%s failed/stopped", p->name());
+			return false;
 		}
-		iodme::thread::do_nanosleep(250*1000*1000);
 	}
 
+	std::unique_ptr<iodme::metrics::exporter> exporter;
+	if (optmap.count("metrics-file")) {
+		iodme::metrics::exporter::options m_opts = iodme::metrics::exporter::default_options;
+		m_opts.path = optmap["metrics-file"].as<std::string>();
+		m_opts.period_ns = optmap["metrics-period"].as<unsigned int>() * 1000000ULL; // msec to nsec
+		exporter = std::make_unique<iodme::metrics::exporter>(m_opts);
+		exporter->start();
+	}
+
+	bool stopped = false;
+	while (!killed && !stopped) {
+		for (auto& tx : txs)
+			stopped |= !tx->running();
+		for (auto& p : pumps)
+			stopped |= !p->running();
+		if (!stopped)
+			iodme::thread::do_nanosleep(250*1000*1000);
+	}
+
+	// Stop the stages before releasing the frames
+	exporter.reset();
+	pumps.clear();
+	txs.clear();
+
+	for (auto &f : frames)
+		f.free();
+
 	return 0;
 }
 
@@ -196,8 +460,27 @@ int main(int argc, char *argv[])
 		("sink-port,P",  po::value<std::string>()->default_value("15740"),  "Sink TCP port to use")
 		("sink-host,A",  po::value<std::string>(), "Sink hostname (IP address or hostname)")
 		("frame-size,s", po::value<unsigned int>()->default_value(4 * 1024 * 1024), "Size of the data frames to generate")
-		("frame-rate,r", po::value<float>()->default_value(30), "Frame rate in FPS")
-		("name,n",  po::value<std::string>(), "Name of data stream");
+		("frame-rate,r", po::value<float>()->default_value(30), "Frame rate in FPS (average)")
+		("frame-size-min", po::value<unsigned int>(), "Variable frame sizes, uniformly distributed between this and frame-size")
+		("profile",   po::value<std::string>()->default_value("constant"), "Traffic profile: constant, burst:<frames>, ramp:<initial-fps>:<seconds>, poisson")
+		("catch-up",  po::value<std::string>()->default_value("burst"), "When falling behind: burst (send late frames back-to-back), skip (drop missed frames), reset (restart the schedule)")
+		("buff-count,C", po::value<unsigned int>()->default_value(0), "Number of pre-allocated frame buffers shared by all streams (0 - two per stream, at least 8)")
+		("streams,N",    po::value<unsigned int>()->default_value(1), "Number of streams (named <name>-<index>), each over its own connection")
+		("stream",       po::value<std::vector<std::string> >(&stream_specs)->composing(), "Stream <name>[:<frame-size>[:<fps>]], overrides --streams. Can be repeated.")
+		("pump-threads", po::value<unsigned int>()->default_value(1), "Number of pump threads, streams are spread across them")
+		("tx-threads",   po::value<unsigned int>()->default_value(1), "Number of transmit threads, streams are spread across them")
+		("hugepages", "Use huge pages for the frame buffers")
+		("payload",   po::value<std::string>()->default_value("random"), "Frame contents: zero, pattern, random, stamped (can be verified by the sink)")
+		("checksum",  "Send CRC32C checksum with each frame (sink keeps it with the output)")
+		("zerocopy", "Use MSG_ZEROCOPY to send frames without copying them into the socket")
+		("raw-stream", "Send unframed stream (no handshake and frame headers)")
+		("metrics-file",   po::value<std::string>(), "Periodically write JSON snapshot of the stage metrics into this file")
+		("metrics-period", po::value<unsigned int>()->default_value(1000), "Metrics snapshot period in msec")
+		("pump-cpus",  po::value<std::string>(), "CPU list for the pump threads (eg 0-1,4)")
+		("tx-cpus",    po::value<std::string>(), "CPU list for the transmit threads")
+		("pump-sched", po::value<std::string>(), "Scheduling for the pump threads: <other|batch|idle|fifo|rr>[:prio]")
+		("tx-sched",   po::value<std::string>(), "Scheduling for the transmit threads")
+		("name,n",  po::value<std::string>(), "Name of data stream (default: <hostname>-<pid>)");
 
 	po::store(po::parse_command_line(argc, argv, optdesc), optmap);
 	po::notify(optmap);
@@ -0,0 +1,628 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <boost/program_options.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <hogl/format-basic.hpp>
+#include <hogl/output-stdout.hpp>
+#include <hogl/output-stderr.hpp>
+#include <hogl/output-plainfile.hpp>
+#include <hogl/engine.hpp>
+#include <hogl/area.hpp>
+#include <hogl/mask.hpp>
+#include <hogl/post.hpp>
+#include <hogl/flush.hpp>
+#include <hogl/ring.hpp>
+#include <hogl/tls.hpp>
+
+#include "iodme/buffer.hpp"
+#include "iodme/queue.hpp"
+#include "iodme/thread.hpp"
+#include "iodme/proto.hpp"
+#include "iodme/pump.hpp"
+#include "iodme/payload.hpp"
+#include "iodme/pacer.hpp"
+#include "iodme/nettx.hpp"
+#include "iodme/netrx.hpp"
+#include "iodme/file-writer.hpp"
+#include "iodme/reclaimer.hpp"
+#include "iodme/metrics.hpp"
+
+////////
+using iodme::buffer;
+namespace po = boost::program_options;
+namespace metrics = iodme::metrics;
+
+static const hogl::area *area = nullptr;
+static po::variables_map optmap;
+
+static volatile bool killed = false;
+
+// Catch most signal to terminate gracefully.
+static inline void sig_handler(int signum)
+{
+	killed = true;
+}
+
+static inline void catch_signals()
+{
+	struct sigaction sa = {{0}};
+	sa.sa_handler = sig_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+// Connected pair of stream sockets: [0] - generator side, [1] - sink side
+static bool make_unix_pair(int sk[2])
+{
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sk) < 0) {
+		hogl::post(area, area->ERROR, "failed to create socket pair: %s(%d).", strerror(errno), errno);
+		return false;
+	}
+	return true;
+}
+
+// Same over TCP loopback (ephemeral port)
+static bool make_tcp_pair(int sk[2])
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	socklen_t len = sizeof(addr);
+
+	int lsk = socket(AF_INET, SOCK_STREAM, 0);
+	if (lsk < 0 || bind(lsk, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(lsk, 1) < 0 ||
+			getsockname(lsk, (struct sockaddr *) &addr, &len) < 0) {
+		hogl::post(area, area->ERROR, "failed to create loopback listener: %s(%d).", strerror(errno), errno);
+		if (lsk >= 0)
+			close(lsk);
+		return false;
+	}
+
+	sk[0] = socket(AF_INET, SOCK_STREAM, 0);
+	if (sk[0] < 0 || connect(sk[0], (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		hogl::post(area, area->ERROR, "failed to connect loopback socket: %s(%d).", strerror(errno), errno);
+		if (sk[0] >= 0)
+			close(sk[0]);
+		close(lsk);
+		return false;
+	}
+
+	sk[1] = accept(lsk, 0, 0);
+	int a_errno = errno;
+	close(lsk);
+	if (sk[1] < 0) {
+		hogl::post(area, area->ERROR, "failed to accept loopback socket: %s(%d).", strerror(a_errno), a_errno);
+		close(sk[0]);
+		return false;
+	}
+
+	int one = 1;
+	setsockopt(sk[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return true;
+}
+
+static uint64_t now_realtime_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double cpu_seconds()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+// Bytes taken by the recorded frames of the stream
+static uint64_t recorded_bytes(const std::string& dir, const std::string& stream)
+{
+	uint64_t total = 0;
+	DIR *d = opendir(dir.c_str());
+	if (!d)
+		return 0;
+
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		std::string name;
+		uint64_t seqno;
+		bool seg;
+		struct stat st;
+		if (iodme::file_writer::parse_output_name(de->d_name, name, seqno, seg) && name == stream &&
+				stat((dir + "/" + de->d_name).c_str(), &st) == 0)
+			total += st.st_size;
+	}
+	closedir(d);
+	return total;
+}
+
+// Results of the measured part of the run (after the warm-up)
+struct bench_result {
+	uint64_t frames;
+	uint64_t bytes;
+	double   elapsed;     // seconds
+	double   gbps;        // 10^9 bytes per sec
+	double   cpu;         // process CPU seconds (all threads)
+	double   cpu_per_gb;  // CPU seconds per 10^9 bytes
+	uint64_t dropped;     // frames dropped by the generator (paced, no free buffers or full queue)
+	uint64_t corrupted;   // frames that failed payload or checksum verification
+	metrics::histogram::snapshot frame_ns; // generated -> released by the sink
+};
+
+static void output_text(std::ostream& out, const bench_result& r)
+{
+	char line[512];
+	snprintf(line, sizeof(line),
+		"frames %llu bytes %llu elapsed %.3f sec\n"
+		"throughput %.3f GB/s\n"
+		"cpu %.3f sec (%.2f cores), %.3f cpu-sec per GB\n"
+		"frame latency: p50 %.3f p99 %.3f p999 %.3f max %.3f msec\n"
+		"dropped at the generator: %llu\n"
+		"corrupted: %llu\n",
+		(unsigned long long) r.frames, (unsigned long long) r.bytes, r.elapsed, r.gbps,
+		r.cpu, r.elapsed > 0 ? r.cpu / r.elapsed : 0, r.cpu_per_gb,
+		r.frame_ns.percentile(50) / 1e6, r.frame_ns.percentile(99) / 1e6,
+		r.frame_ns.percentile(99.9) / 1e6, r.frame_ns.max / 1e6,
+		(unsigned long long) r.dropped, (unsigned long long) r.corrupted);
+	out << line;
+}
+
+static void output_json(std::ostream& out, const bench_result& r)
+{
+	out << "{\"transport\": \"" << optmap["transport"].as<std::string>() << "\""
+		<< ", \"sink\": \"" << optmap["sink"].as<std::string>() << "\""
+		<< ", \"frame_size\": " << optmap["frame-size"].as<unsigned int>()
+		<< ", \"frame_rate\": " << optmap["frame-rate"].as<float>()
+		<< ", \"writers\": " << optmap["writer-threads"].as<unsigned int>()
+		<< ", \"payload\": \"" << optmap["payload"].as<std::string>() << "\""
+		<< ", \"checksum\": " << (optmap.count("checksum") ? "true" : "false")
+		<< ", \"frames\": " << r.frames << ", \"bytes\": " << r.bytes
+		<< ", \"elapsed\": " << r.elapsed << ", \"gbps\": " << r.gbps
+		<< ", \"cpu\": " << r.cpu << ", \"cpu_per_gb\": " << r.cpu_per_gb
+		<< ", \"dropped\": " << r.dropped << ", \"corrupted\": " << r.corrupted
+		<< ", \"frame_ns\": {\"count\": " << r.frame_ns.count
+		<< ", \"p50\": " << r.frame_ns.percentile(50) << ", \"p99\": " << r.frame_ns.percentile(99)
+		<< ", \"p999\": " << r.frame_ns.percentile(99.9) << ", \"max\": " << r.frame_ns.max << "}"
+		<< "}\n";
+}
+
+static bool run()
+{
+	uint32_t frame_size = optmap["frame-size"].as<unsigned int>();
+	float    frame_rate = optmap["frame-rate"].as<float>();
+	bool     file_sink  = optmap["sink"].as<std::string>() == "file";
+
+	std::string transport = optmap["transport"].as<std::string>();
+	if (transport != "unix" && transport != "tcp") {
+		hogl::post(area, area->ERROR, "unsupported transport %s", transport);
+		return false;
+	}
+	if (!file_sink && optmap["sink"].as<std::string>() != "memory") {
+		hogl::post(area, area->ERROR, "unsupported sink %s", optmap["sink"].as<std::string>());
+		return false;
+	}
+
+	iodme::payload::Kind payload;
+	if (!iodme::payload::parse_kind(optmap["payload"].as<std::string>(), payload)) {
+		hogl::post(area, area->ERROR, "unsupported payload %s", optmap["payload"].as<std::string>());
+		return false;
+	}
+	if (optmap.count("verify") && payload != iodme::payload::STAMPED) {
+		hogl::post(area, area->ERROR, "verify requires stamped payload");
+		return false;
+	}
+
+	iodme::pacer::options p_opts = iodme::pacer::default_options;
+	p_opts.rate = frame_rate;
+	if (!iodme::pacer::parse_profile(optmap["profile"].as<std::string>(), p_opts) ||
+			!iodme::pacer::parse_catchup(optmap["catch-up"].as<std::string>(), p_opts.catchup)) {
+		hogl::post(area, area->ERROR, "invalid traffic profile %s or catch-up policy %s",
+				optmap["profile"].as<std::string>(), optmap["catch-up"].as<std::string>());
+		return false;
+	}
+
+	std::string format = optmap["format"].as<std::string>();
+	if (format != "text" && format != "json") {
+		hogl::post(area, area->ERROR, "unsupported results format %s", format);
+		return false;
+	}
+
+	int sk[2];
+	if (!(transport == "tcp" ? make_tcp_pair(sk) : make_unix_pair(sk)))
+		return false;
+
+	// Queues with a single producer and consumer thread use SPSC rings
+	// (unless told otherwise), queues are sized for all the buffers.
+	std::string q_mode = optmap["queue"].as<std::string>();
+	if (q_mode != "spsc" && q_mode != "mpmc") {
+		hogl::post(area, area->ERROR, "unsupported queue mode %s", q_mode);
+		close(sk[0]); close(sk[1]);
+		return false;
+	}
+	iodme::queue::Mode spsc = q_mode == "spsc" ? iodme::queue::SPSC : iodme::queue::MPMC;
+	unsigned int buff_count = optmap["buff-count"].as<unsigned int>();
+	unsigned int gen_count  = optmap["gen-buff-count"].as<unsigned int>();
+
+	iodme::queue cb_q(buff_count, spsc); // clean buffers
+	iodme::queue db_q(buff_count);       // received frames
+	iodme::queue rq(buff_count);         // written frames (file sink)
+	iodme::queue tx_q(gen_count, spsc);  // generated frames
+
+	// Pre-allocate sink buffers
+	unsigned int buff_flags = 0;
+	if (optmap.count("hugepages")) buff_flags |= buffer::HUGEPAGE;
+
+	std::vector<buffer> pool;
+	for (unsigned int i = 0; i < buff_count; i++) {
+		std::string name("bench-buffer-");
+		name += std::to_string(i);
+
+		buffer::metadata m = { 0 };
+		buffer b;
+		if (!b.alloc(frame_size, buff_flags, name.c_str()) || !b.add_metadata(m)) {
+			hogl::post(area, area->ERROR, "failed to pre-allocate buffer-%u size %u : %s(%d).",
+					i, frame_size, strerror(errno), errno);
+			for (auto& p : pool)
+				p.free();
+			close(sk[0]); close(sk[1]);
+			return false;
+		}
+		memset(b.base, 0, b.capacity);
+		pool.push_back(b);
+		cb_q.push(b);
+	}
+
+	// Sink side: writers (file sink) return the buffers via rq,
+	// memory sink releases received frames right away.
+	// Retention (file sink) keeps the output dir within the budget
+	std::unique_ptr<iodme::reclaimer> reclaimer;
+	uint64_t retain_bytes = optmap["retain-mb"].as<unsigned int>() * 1024ULL * 1024; // MB to bytes
+	if (file_sink && retain_bytes) {
+		iodme::reclaimer::options rcl_opts = iodme::reclaimer::default_options;
+		rcl_opts.max_bytes = retain_bytes;
+		reclaimer = std::make_unique<iodme::reclaimer>("DATA-RECLAIMER", optmap["output-dir"].as<std::string>(), rcl_opts);
+		reclaimer->start();
+	}
+
+	std::vector<std::unique_ptr<iodme::file_writer>> writers;
+	if (file_sink) {
+		iodme::file_writer::options wrt_opts = iodme::file_writer::default_options;
+		wrt_opts.reclaimer = reclaimer.get();
+		if (optmap.count("directio")) wrt_opts.flags |= iodme::file_writer::DIRECTIO;
+		if (optmap.count("uring"))    wrt_opts.flags |= iodme::file_writer::URING;
+		if (optmap.count("segment"))  wrt_opts.flags |= iodme::file_writer::SEGMENT;
+		if (optmap.count("checksum")) wrt_opts.flags |= iodme::file_writer::CHECKSUM;
+
+		for (unsigned int i = 0; i < optmap["writer-threads"].as<unsigned int>(); i++) {
+			std::string name("DATA-WRITER");
+			name += std::to_string(i);
+			auto w = std::make_unique<iodme::file_writer>(name, optmap["output-dir"].as<std::string>(),
+					db_q, rq, wrt_opts);
+			w->start();
+			writers.push_back(std::move(w));
+		}
+	}
+
+	// Generator side, frames are recycled via fq
+	iodme::queue fq(gen_count, spsc);
+	std::vector<buffer> frames;
+	for (unsigned int i = 0; i < gen_count; i++) {
+		std::string name("frame-buffer-");
+		name += std::to_string(i);
+
+		buffer::metadata m = { 0 };
+		buffer b;
+		if (!b.alloc(frame_size, buff_flags, name.c_str()) || !b.add_metadata(m)) {
+			hogl::post(area, area->ERROR, "failed to pre-allocate frame-%u size %u : %s(%d).",
+					i, frame_size, strerror(errno), errno);
+			break;
+		}
+		memset(b.base, 0, b.capacity);
+		frames.push_back(b);
+		fq.push(b);
+	}
+
+	unsigned int tx_flags = 0;
+	if (optmap.count("zerocopy")) tx_flags |= iodme::nettx::ZEROCOPY;
+
+	iodme::proto::hello h = iodme::proto::make_hello("bench", frame_size, frame_rate);
+	auto nettx = std::make_unique<iodme::nettx>(sk[0], tx_q, h, tx_flags);
+	nettx->set_free_queue(fq);
+	nettx->start();
+
+	if (!iodme::proto::recv_hello(sk[1], h)) {
+		hogl::post(area, area->ERROR, "handshake failed: %s(%d).", strerror(errno), errno);
+		close(sk[1]);
+		nettx.reset();
+		writers.clear();
+		for (auto& p : pool)
+			p.free();
+		for (auto& f : frames)
+			f.free();
+		return false;
+	}
+
+	iodme::netrx::options rx_opts = iodme::netrx::default_options;
+	if (optmap.count("verify"))   rx_opts.flags |= iodme::netrx::VERIFY;
+	if (optmap.count("checksum")) rx_opts.flags |= iodme::netrx::CHECKSUM;
+
+	std::string rx_metrics = std::string("IODME-NETRX") + std::to_string(sk[1]) + "/" + h.name;
+	auto netrx = std::make_unique<iodme::netrx>(h.name, sk[1], cb_q, db_q, rx_opts);
+	netrx->start();
+
+	auto pump = std::make_unique<iodme::pump>(frame_size,
+			frame_rate > 0 ? 1000000000.0 / frame_rate : 0, fq, tx_q);
+	pump->set_payload(payload);
+	pump->set_checksum(optmap.count("checksum"));
+	pump->set_pacing(p_opts);
+	pump->start();
+
+	std::unique_ptr<metrics::exporter> exporter;
+	if (optmap.count("metrics-file")) {
+		metrics::exporter::options m_opts = metrics::exporter::default_options;
+		m_opts.path = optmap["metrics-file"].as<std::string>();
+		m_opts.period_ns = optmap["metrics-period"].as<unsigned int>() * 1000000ULL; // msec to nsec
+		exporter = std::make_unique<metrics::exporter>(m_opts);
+		exporter->start();
+	}
+
+	// Release frames back to the receiver and account for them.
+	// Measurement starts after the warm-up.
+	uint64_t warmup_ns   = optmap["warmup"].as<float>() * 1e9;
+	uint64_t duration_ns = optmap["duration"].as<float>() * 1e9;
+	uint64_t start = iodme::thread::now_ns();
+
+	bench_result r = { 0 };
+	metrics::histogram frame_ns;
+	bool     measuring = false;
+	uint64_t m_start = 0, m_dropped = 0;
+	double   m_cpu = 0;
+
+	iodme::queue& done_q = file_sink ? rq : db_q;
+	while (!killed) {
+		uint64_t now = iodme::thread::now_ns();
+		if (now - start >= warmup_ns + duration_ns)
+			break;
+
+		if (!measuring && now - start >= warmup_ns) {
+			measuring = true;
+			m_start = now;
+			m_cpu = cpu_seconds();
+			metrics::registry::read("IODME-PUMP", "dropped", m_dropped);
+		}
+
+		if (!netrx->running() || !nettx->running()) {
+			hogl::post(area, area->ERROR, "pipeline stopped");
+			break;
+		}
+
+		buffer b;
+		if (!done_q.pop_wait(b, iodme::default_wait))
+			continue;
+
+		// Writers hand the buffers back cleared, frames are all the same size
+		if (measuring) {
+			frame_ns.record(now_realtime_ns() - b.meta->timestamp);
+			r.frames++;
+			r.bytes += frame_size;
+		}
+
+		b.clear();
+		cb_q.push(b);
+	}
+
+	uint64_t m_end = iodme::thread::now_ns();
+	r.cpu = cpu_seconds() - m_cpu;
+	metrics::registry::read("IODME-PUMP", "dropped", r.dropped);
+	r.dropped -= m_dropped;
+	metrics::registry::read(rx_metrics, "verify_errors", r.corrupted);
+	uint64_t crc_errors = 0;
+	metrics::registry::read(rx_metrics, "crc_errors", crc_errors);
+	r.corrupted += crc_errors;
+	for (auto& w : writers) {
+		crc_errors = 0;
+		metrics::registry::read(w->name(), "crc_errors", crc_errors);
+		r.corrupted += crc_errors;
+	}
+
+	// Stop the generator first, receiver sees EOF once the socket is closed
+	pump.reset();
+	nettx.reset();
+	netrx.reset();
+	writers.clear();
+	exporter.reset();
+
+	// Everything is reported by now, reclaimer makes the last pass on the way out
+	bool retained = true;
+	if (reclaimer) {
+		reclaimer.reset();
+		uint64_t rb = recorded_bytes(optmap["output-dir"].as<std::string>(), "bench");
+		if (rb > retain_bytes) {
+			hogl::post(area, area->ERROR, "recording is over the retention budget: %llu bytes", rb);
+			retained = false;
+		}
+	}
+
+	for (auto& f : frames)
+		f.free();
+	for (auto& p : pool)
+		p.free();
+
+	r.elapsed    = measuring ? (m_end - m_start) / 1e9 : 0;
+	r.gbps       = r.elapsed > 0 ? r.bytes / r.elapsed / 1e9 : 0;
+	r.cpu_per_gb = r.bytes ? r.cpu / (r.bytes / 1e9) : 0;
+	frame_ns.read(r.frame_ns);
+
+	std::ofstream rfile;
+	if (optmap.count("results")) {
+		rfile.open(optmap["results"].as<std::string>());
+		if (!rfile) {
+			hogl::post(area, area->ERROR, "failed to open results file %s: %s(%d)",
+					optmap["results"].as<std::string>(), strerror(errno), errno);
+			return false;
+		}
+	}
+	std::ostream& out = rfile.is_open() ? rfile : std::cout;
+
+	if (format == "json")
+		output_json(out, r);
+	else
+		output_text(out, r);
+
+	return r.frames >= optmap["min-frames"].as<unsigned int>() && !r.corrupted && retained;
+}
+
+static std::vector<std::string> log_mask;
+int main(int argc, char *argv[])
+{
+	// **** Parse command line arguments ****
+	po::options_description optdesc("In-process pipeline benchmark (pump -> nettx -> socket -> netrx -> writers)");
+	optdesc.add_options()
+		("help", "Print this message")
+		("log-output", po::value<std::string>()->default_value("-"), "Log output file name or - for stderr")
+		("log-format", po::value<std::string>()->default_value("timespec,timedelta,area,section"), "Log output format")
+		("log-mask",   po::value<std::vector<std::string> >(&log_mask)->composing(), "Log mask. Multiple masks can be specified.")
+		("transport",    po::value<std::string>()->default_value("unix"), "Socket between the generator and the sink: unix (socketpair), tcp (loopback)")
+		("sink",         po::value<std::string>()->default_value("memory"), "Sink: memory (frames are released as soon as received), file (written by the writer threads)")
+		("output-dir,D", po::value<std::string>()->default_value("/tmp"), "Output directory (file sink)")
+		("frame-size,s", po::value<unsigned int>()->default_value(4 * 1024 * 1024), "Size of the data frames")
+		("frame-rate,r", po::value<float>()->default_value(0), "Frame rate in FPS, 0 - as fast as possible")
+		("duration,t",   po::value<float>()->default_value(5), "Measurement duration in seconds")
+		("warmup,w",     po::value<float>()->default_value(1), "Warm-up duration in seconds (not measured)")
+		("buff-count,C", po::value<unsigned int>()->default_value(16), "Number of sink buffers")
+		("gen-buff-count", po::value<unsigned int>()->default_value(8), "Number of generator frame buffers")
+		("queue",     po::value<std::string>()->default_value("spsc"), "Queues between single producer/consumer pairs: spsc, mpmc")
+		("writer-threads,W", po::value<unsigned int>()->default_value(2), "Number of writer threads (file sink)")
+		("directio",  "Writers use direct IO")
+		("uring",     "Writers use io_uring")
+		("segment",   "Writers append frames into segment files")
+		("retain-mb", po::value<unsigned int>()->default_value(0), "Keep at most this many MB of frames in the output dir, oldest are removed (file sink)")
+		("hugepages", "Use huge pages for the generator and sink buffers")
+		("zerocopy",  "Send with MSG_ZEROCOPY (tcp transport)")
+		("profile",   po::value<std::string>()->default_value("constant"), "Traffic profile: constant, burst:<frames>, ramp:<initial-fps>:<seconds>, poisson (with frame-rate)")
+		("catch-up",  po::value<std::string>()->default_value("burst"), "When falling behind: burst, skip, reset")
+		("payload",   po::value<std::string>()->default_value("random"), "Frame contents: zero, pattern, random, stamped")
+		("verify",    "Receiver checks the frame contents (stamped payload), fail on corruption")
+		("checksum",  "Generator checksums the frames, receiver (and writers) check them, fail on corruption")
+		("min-frames",   po::value<unsigned int>()->default_value(1), "Fail unless at least this many frames made it through")
+		("metrics-file",   po::value<std::string>(), "Periodically write JSON snapshot of the stage metrics into this file")
+		("metrics-period", po::value<unsigned int>()->default_value(1000), "Metrics snapshot period in msec")
+		("format,f",  po::value<std::string>()->default_value("text"), "Results format: text, json")
+		("results",   po::value<std::string>(), "Write results into this file instead of stdout");
+
+	try {
+		po::store(po::parse_command_line(argc, argv, optdesc), optmap);
+		po::notify(optmap);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+
+	// ** All argument values (including the defaults) are now storred in 'optmap' **
+
+	if (optmap.count("help")) {
+		std::cout << optdesc << std::endl;
+		exit(1);
+	}
+
+	catch_signals();
+
+	// Writes to a closed socket must not kill us
+	signal(SIGPIPE, SIG_IGN);
+
+	hogl::format *lf;
+	hogl::output *lo;
+
+	// Results may go to stdout, keep the log out of the way
+	lf = new hogl::format_basic(optmap["log-format"].as<std::string>().c_str());
+	if (optmap["log-output"].as<std::string>() == "-")
+		lo = new hogl::output_stderr(*lf, 64 * 1024);
+	else
+		lo = new hogl::output_plainfile(optmap["log-output"].as<std::string>().c_str(), *lf, 64 * 1024);
+
+	hogl::engine::options eng_opts = hogl::engine::default_options;
+	for (auto &m : log_mask)
+		eng_opts.default_mask << m;
+
+	hogl::activate(*lo, eng_opts);
+
+	// *****
+	// HOGL engine is running now. Avoid exit()ing from the process
+	// without going through hogl shutdown sequence below.
+
+	area = hogl::add_area("IODME-PIPELINE-BENCH");
+
+	hogl::ringbuf::options ring_opts = { capacity: 1024 * 8, prio: 100, flags: 0, record_tailroom: 128 };
+	hogl::tls *tls = new hogl::tls("MAIN-THREAD", ring_opts);
+
+	bool ok = run();
+
+	delete tls;
+
+	hogl::deactivate();
+
+	delete lo;
+	delete lf;
+
+	return ok ? 0 : 1;
+}
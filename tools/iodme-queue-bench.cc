@@ -0,0 +1,454 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <boost/program_options.hpp>
+#include <boost/lockfree/queue.hpp>
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iodme/buffer.hpp"
+#include "iodme/queue.hpp"
+#include "iodme/thread.hpp"
+
+////////
+using iodme::buffer;
+namespace po = boost::program_options;
+
+static po::variables_map optmap;
+
+static volatile bool killed = false;
+
+// Catch most signal to terminate gracefully.
+static inline void sig_handler(int signum)
+{
+	killed = true;
+}
+
+static inline void catch_signals()
+{
+	struct sigaction sa = {{0}};
+	sa.sa_handler = sig_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+// Queue as it was before the rings: boost MPMC queue, depth counter and
+// notification sequence bumped on every push.
+class boost_queue {
+private:
+	boost::lockfree::queue<buffer, boost::lockfree::fixed_sized<true>> _q;
+
+	alignas(64) std::atomic<uint32_t> _seq;
+	std::atomic<uint32_t>             _waiters;
+	alignas(64) std::atomic<int32_t>  _depth;
+
+public:
+	explicit boost_queue(size_t depth) : _q(depth), _seq(0), _waiters(0), _depth(0) {}
+
+	bool push(const buffer& v)
+	{
+		if (!_q.push(v))
+			return false;
+		_depth.fetch_add(1, std::memory_order_relaxed);
+		_seq.fetch_add(1, std::memory_order_seq_cst);
+		if (_waiters.load(std::memory_order_seq_cst))
+			abort(); // nobody blocks here
+		return true;
+	}
+
+	size_t push(const buffer *v, size_t n)
+	{
+		size_t k = 0;
+		while (k < n && push(v[k]))
+			k++;
+		return k;
+	}
+
+	size_t pop(buffer *v, size_t max)
+	{
+		size_t k = 0;
+		while (k < max && _q.pop(v[k])) {
+			_depth.fetch_sub(1, std::memory_order_relaxed);
+			k++;
+		}
+		return k;
+	}
+};
+
+// Single benchmark case (one row of the results matrix)
+struct bench_case {
+	std::string  queue;     // boost, mpmc, spsc
+	unsigned int producers;
+	unsigned int consumers;
+	unsigned int batch;     // entries per push/pop call
+};
+
+struct bench_result {
+	bench_case  c;
+	bool        ok;
+	std::string error;
+
+	uint64_t ops;        // entries moved through the queue
+	double   elapsed;    // seconds
+	double   mops;       // million entries per sec
+	double   full_pct;   // push calls that found the queue full
+	double   empty_pct;  // pop calls that found the queue empty
+};
+
+// Split comma separated list
+static std::vector<std::string> split_list(const std::vector<std::string>& args)
+{
+	std::vector<std::string> v;
+	for (auto &a : args) {
+		std::istringstream in(a);
+		std::string s;
+		while (std::getline(in, s, ','))
+			if (!s.empty()) v.push_back(s);
+	}
+	return v;
+}
+
+static bool parse_numbers(const std::vector<std::string>& args, std::vector<unsigned int>& v)
+{
+	for (auto &a : split_list(args)) {
+		char *end;
+		unsigned long n = strtoul(a.c_str(), &end, 0);
+		if (*end || !n) {
+			std::cerr << "invalid number " << a << '\n';
+			return false;
+		}
+		v.push_back(n);
+	}
+	return !v.empty();
+}
+
+// Back off after a miss. Spin briefly, then give the CPU away so that
+// oversubscribed runs (more threads than cores) still make progress.
+static inline void backoff(unsigned int& spins)
+{
+	if (++spins < 64)
+		iodme::cpu_relax();
+	else {
+		spins = 0;
+		std::this_thread::yield();
+	}
+}
+
+// Per thread counters, on their own cache lines
+struct alignas(64) worker_stats {
+	uint64_t calls;
+	uint64_t misses; // calls that moved nothing
+	uint64_t entries;
+	uint64_t sum;    // of the entry tags, checks that nothing got lost or duplicated
+};
+
+// Producers push tagged entries until the time is up, consumers pop
+// until all pushed entries are accounted for.
+template<typename Q>
+static void run_case(bench_result& r, Q& q)
+{
+	const bench_case& c = r.c;
+	uint64_t duration_ns = optmap["duration"].as<float>() * 1e9;
+
+	std::vector<worker_stats> prod(c.producers), cons(c.consumers);
+	std::atomic<unsigned int> producing(c.producers);
+	std::atomic<bool> go(false);
+
+	auto producer = [&](unsigned int id) {
+		worker_stats& s = prod[id];
+		s = {};
+		std::vector<buffer> v(c.batch);
+		uint64_t tag = (uint64_t) id << 48;
+		unsigned int spins = 0;
+
+		while (!go.load(std::memory_order_acquire))
+			iodme::cpu_relax();
+
+		uint64_t start = iodme::thread::now_ns();
+		while (!killed) {
+			if (!(s.calls & 1023) && iodme::thread::now_ns() - start >= duration_ns)
+				break;
+
+			for (auto& b : v)
+				b.base = (uint8_t *) ++tag;
+
+			// Partial pushes are finished before the next batch
+			size_t done = 0;
+			while (done < c.batch && !killed) {
+				size_t k = q.push(v.data() + done, c.batch - done);
+				s.calls++;
+				if (!k) {
+					s.misses++;
+					backoff(spins);
+					continue;
+				}
+				for (size_t i = done; i < done + k; i++)
+					s.sum += (uint64_t) v[i].base;
+				done += k;
+			}
+			s.entries += done;
+		}
+		producing.fetch_sub(1, std::memory_order_release);
+	};
+
+	auto consumer = [&](unsigned int id) {
+		worker_stats& s = cons[id];
+		s = {};
+		std::vector<buffer> v(c.batch);
+		unsigned int spins = 0;
+
+		while (!go.load(std::memory_order_acquire))
+			iodme::cpu_relax();
+
+		while (1) {
+			bool last = !producing.load(std::memory_order_acquire);
+			size_t k = q.pop(v.data(), c.batch);
+			s.calls++;
+			if (!k) {
+				s.misses++;
+				if (last)
+					break; // producers are done and the queue is drained
+				backoff(spins);
+				continue;
+			}
+			for (size_t i = 0; i < k; i++)
+				s.sum += (uint64_t) v[i].base;
+			s.entries += k;
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < c.consumers; i++)
+		threads.emplace_back(consumer, i);
+	for (unsigned int i = 0; i < c.producers; i++)
+		threads.emplace_back(producer, i);
+
+	uint64_t start = iodme::thread::now_ns();
+	go.store(true, std::memory_order_release);
+	for (auto& t : threads)
+		t.join();
+	uint64_t end = iodme::thread::now_ns();
+
+	worker_stats p = {}, s = {};
+	for (auto& x : prod) { p.calls += x.calls; p.misses += x.misses; p.entries += x.entries; p.sum += x.sum; }
+	for (auto& x : cons) { s.calls += x.calls; s.misses += x.misses; s.entries += x.entries; s.sum += x.sum; }
+
+	r.ok = p.entries == s.entries && p.sum == s.sum;
+	if (!r.ok)
+		r.error = "entries lost or duplicated";
+
+	r.ops       = s.entries;
+	r.elapsed   = (end - start) / 1e9;
+	r.mops      = r.elapsed > 0 ? r.ops / r.elapsed / 1e6 : 0;
+	r.full_pct  = p.calls ? 100.0 * p.misses / p.calls : 0;
+	r.empty_pct = s.calls ? 100.0 * s.misses / s.calls : 0;
+}
+
+static void output_text(std::ostream& out, const std::vector<bench_result>& results)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "%6s %9s %9s %5s %12s %8s %7s %7s\n",
+		"queue", "producers", "consumers", "batch", "entries", "Mops/s", "full%", "empty%");
+	out << line;
+
+	for (auto &r : results) {
+		snprintf(line, sizeof(line), "%6s %9u %9u %5u ",
+			r.c.queue.c_str(), r.c.producers, r.c.consumers, r.c.batch);
+		out << line;
+
+		if (!r.ok) {
+			out << r.error << '\n';
+			continue;
+		}
+
+		snprintf(line, sizeof(line), "%12llu %8.2f %7.1f %7.1f\n",
+			(unsigned long long) r.ops, r.mops, r.full_pct, r.empty_pct);
+		out << line;
+	}
+}
+
+static void output_csv(std::ostream& out, const std::vector<bench_result>& results)
+{
+	out << "queue,producers,consumers,batch,ok,entries,elapsed,mops,full_pct,empty_pct,error\n";
+	for (auto &r : results)
+		out << r.c.queue << ',' << r.c.producers << ',' << r.c.consumers << ',' << r.c.batch << ','
+			<< r.ok << ',' << r.ops << ',' << r.elapsed << ',' << r.mops << ','
+			<< r.full_pct << ',' << r.empty_pct << ",\"" << r.error << "\"\n";
+}
+
+static void output_json(std::ostream& out, const std::vector<bench_result>& results)
+{
+	out << "{\"depth\": " << optmap["depth"].as<unsigned int>()
+		<< ", \"duration\": " << optmap["duration"].as<float>()
+		<< ", \"results\": [";
+
+	const char *sep = "";
+	for (auto &r : results) {
+		out << sep << "\n  {\"queue\": \"" << r.c.queue << "\", \"producers\": " << r.c.producers
+			<< ", \"consumers\": " << r.c.consumers << ", \"batch\": " << r.c.batch
+			<< ", \"ok\": " << (r.ok ? "true" : "false");
+		sep = ",";
+
+		if (!r.ok) {
+			out << ", \"error\": \"" << r.error << "\"}";
+			continue;
+		}
+
+		out << ", \"entries\": " << r.ops << ", \"elapsed\": " << r.elapsed
+			<< ", \"mops\": " << r.mops << ", \"full_pct\": " << r.full_pct
+			<< ", \"empty_pct\": " << r.empty_pct << "}";
+	}
+	out << "\n]}\n";
+}
+
+static bool run()
+{
+	std::vector<unsigned int> producers, consumers, batches;
+	if (!parse_numbers(optmap["producers"].as<std::vector<std::string>>(), producers) ||
+			!parse_numbers(optmap["consumers"].as<std::vector<std::string>>(), consumers) ||
+			!parse_numbers(optmap["batch"].as<std::vector<std::string>>(), batches))
+		return false;
+
+	std::vector<std::string> queues = split_list(optmap["queue"].as<std::vector<std::string>>());
+	for (auto &q : queues) {
+		if (q != "boost" && q != "mpmc" && q != "spsc") {
+			std::cerr << "unsupported queue " << q << '\n';
+			return false;
+		}
+	}
+
+	std::string format = optmap["format"].as<std::string>();
+	if (format != "text" && format != "json" && format != "csv") {
+		std::cerr << "unsupported results format " << format << '\n';
+		return false;
+	}
+
+	unsigned int depth = optmap["depth"].as<unsigned int>();
+
+	std::vector<bench_result> results;
+	for (auto &q : queues)
+		for (auto b : batches)
+			for (auto c : consumers)
+				for (auto p : producers) {
+					if (killed)
+						break;
+
+					// SPSC rings are for single producer/consumer pairs only
+					if (q == "spsc" && (p > 1 || c > 1))
+						continue;
+
+					bench_result r = {};
+					r.c = { q, p, c, b };
+
+					if (q == "boost") {
+						boost_queue bq(depth);
+						run_case(r, bq);
+					} else {
+						iodme::queue rq(depth, q == "spsc" ? iodme::queue::SPSC : iodme::queue::MPMC);
+						run_case(r, rq);
+					}
+					results.push_back(r);
+				}
+
+	std::ofstream rfile;
+	if (optmap.count("results")) {
+		rfile.open(optmap["results"].as<std::string>());
+		if (!rfile) {
+			std::cerr << "failed to open results file " << optmap["results"].as<std::string>() << ": " << strerror(errno) << '\n';
+			return false;
+		}
+	}
+	std::ostream& out = rfile.is_open() ? rfile : std::cout;
+
+	if (format == "json")
+		output_json(out, results);
+	else if (format == "csv")
+		output_csv(out, results);
+	else
+		output_text(out, results);
+
+	for (auto &r : results)
+		if (!r.ok)
+			return false;
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	// **** Parse command line arguments ****
+	po::options_description optdesc("Buffer queue contention benchmark");
+	optdesc.add_options()
+		("help", "Print this message")
+		("queue,Q",      po::value<std::vector<std::string>>()->composing()->default_value({"boost,mpmc,spsc"}, "boost,mpmc,spsc"), "Queues to compare: boost (lockfree::queue, as before the rings), mpmc, spsc")
+		("producers,p",  po::value<std::vector<std::string>>()->composing()->default_value({"1,2,4"}, "1,2,4"), "Number of producer threads (eg 1,2,4)")
+		("consumers,c",  po::value<std::vector<std::string>>()->composing()->default_value({"1,2,4"}, "1,2,4"), "Number of consumer threads (eg 1,2,4)")
+		("batch,b",      po::value<std::vector<std::string>>()->composing()->default_value({"1,8"}, "1,8"), "Entries per push/pop call (eg 1,8,32)")
+		("depth,d",      po::value<unsigned int>()->default_value(iodme::QUEUE_DEPTH), "Queue depth")
+		("duration,t",   po::value<float>()->default_value(1), "Duration of each case in seconds")
+		("format,f",  po::value<std::string>()->default_value("text"), "Results format: text, json, csv")
+		("results,r", po::value<std::string>(), "Write results into this file instead of stdout");
+
+	try {
+		po::store(po::parse_command_line(argc, argv, optdesc), optmap);
+		po::notify(optmap);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+
+	// ** All argument values (including the defaults) are now storred in 'optmap' **
+
+	if (optmap.count("help")) {
+		std::cout << optdesc << std::endl;
+		exit(1);
+	}
+
+	catch_signals();
+
+	return run() ? 0 : 1;
+}
@@ -0,0 +1,342 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <hogl/format-basic.hpp>
+#include <hogl/format-raw.hpp>
+#include <hogl/output-stdout.hpp>
+#include <hogl/output-stderr.hpp>
+#include <hogl/output-plainfile.hpp>
+#include <hogl/output-pipe.hpp>
+#include <hogl/engine.hpp>
+#include <hogl/area.hpp>
+#include <hogl/mask.hpp>
+#include <hogl/post.hpp>
+#include <hogl/flush.hpp>
+#include <hogl/ring.hpp>
+#include <hogl/platform.hpp>
+
+#include "iodme/timesource.hpp"
+#include "iodme/proto.hpp"
+#include "iodme/pacer.hpp"
+#include "iodme/replay.hpp"
+#include "iodme/metrics.hpp"
+
+////////
+namespace po = boost::program_options;
+
+static const hogl::area *area = nullptr;
+static po::variables_map optmap;
+static std::vector<std::string> stream_names;
+
+static volatile bool killed = false;
+
+// Catch most signal to terminate gracefully.
+static inline void sig_handler(int signum)
+{
+	killed = true;
+}
+
+static inline void catch_signals()
+{
+	struct sigaction sa = {{0}};
+	sa.sa_handler = sig_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+// Connect a new socket to the sink
+static int connect_sink(uint32_t sndbuf)
+{
+	int sk = socket(PF_INET, SOCK_STREAM, 0);
+	if (sk < 0) {
+		hogl::post(area, area->ERROR, "failed to create socket: %s(%d).",
+			   strerror(errno), errno);
+		return -1;
+	}
+
+	if (setsockopt(sk, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf)) < 0) {
+		hogl::post(area, area->WARN, "Failed to set socket sndbuf depth: %s(%d).",
+			   strerror(errno), errno);
+	}
+
+	std::string host = optmap["sink-host"].as<std::string>();
+	std::string port = optmap["sink-port"].as<std::string>();
+	struct addrinfo *ai;
+	if (getaddrinfo(host.c_str(), port.c_str(), 0, &ai) < 0) {
+		hogl::post(area, area->ERROR, "Failed to resolve destination address %s: %s(%d).",
+			   host.c_str(), strerror(errno), errno);
+		close(sk);
+		return -1;
+	}
+
+	int r = connect(sk, ai->ai_addr, ai->ai_addrlen);
+	int r_errno = errno;
+
+	freeaddrinfo(ai);
+
+	if (r < 0) {
+		hogl::post(area, area->ERROR, "Failed to connect the socket: %s(%d).", strerror(r_errno), r_errno);
+		close(sk);
+		return -1;
+	}
+
+	return sk;
+}
+
+static bool run()
+{
+	std::string idir = optmap["input-dir"].as<std::string>();
+
+	std::vector<std::string> names = stream_names;
+	if (names.empty())
+		names = iodme::replay::streams(idir);
+	if (names.empty()) {
+		hogl::post(area, area->ERROR, "no recorded streams in %s", idir);
+		return false;
+	}
+
+	iodme::replay::options r_opts = iodme::replay::default_options;
+	r_opts.repeat = optmap["repeat"].as<unsigned int>();
+	if (!iodme::pacer::parse_profile(optmap["profile"].as<std::string>(), r_opts.pacing) ||
+			!iodme::pacer::parse_catchup(optmap["catch-up"].as<std::string>(), r_opts.pacing.catchup)) {
+		hogl::post(area, area->ERROR, "invalid traffic profile %s or catch-up policy %s",
+				optmap["profile"].as<std::string>(), optmap["catch-up"].as<std::string>());
+		return false;
+	}
+
+	std::string rate_str = optmap["frame-rate"].as<std::string>();
+	float speed = optmap["speed"].as<float>();
+	if (speed <= 0) {
+		hogl::post(area, area->ERROR, "invalid speed %.3f", speed);
+		return false;
+	}
+
+	std::vector<std::unique_ptr<iodme::replay>> replays;
+	for (unsigned int i = 0; i < names.size(); i++) {
+		const std::string& name = names[i];
+
+		std::vector<iodme::replay::frame> frames;
+		if (!iodme::replay::scan(idir, name, frames)) {
+			hogl::post(area, area->ERROR, "failed to read %s: %s(%d)", idir, strerror(errno), errno);
+			return false;
+		}
+		if (frames.empty()) {
+			hogl::post(area, area->WARN, "stream %s: no recorded frames", name);
+			continue;
+		}
+
+		double rate;
+		if (rate_str == "original") {
+			rate = iodme::replay::recorded_rate(frames);
+			if (!rate)
+				hogl::post(area, area->WARN, "stream %s: can't tell the recorded rate, replaying as fast as possible", name);
+		} else {
+			char *end;
+			rate = strtod(rate_str.c_str(), &end);
+			if (*end || end == rate_str.c_str() || rate < 0) {
+				hogl::post(area, area->ERROR, "invalid frame rate %s", rate_str);
+				return false;
+			}
+		}
+
+		iodme::replay::options so = r_opts;
+		so.pacing.rate = rate * speed;
+		so.pacing.seed = r_opts.pacing.seed + i;
+
+		uint32_t frame_size = iodme::replay::max_size(frames);
+		int sk = connect_sink(frame_size * 2);
+		if (sk < 0)
+			return false;
+
+		hogl::post(area, area->INFO, "stream %s: frames %u seqno %llu-%llu max-size %u rate %.3f",
+				name, frames.size(), frames.front().seqno, frames.back().seqno, frame_size, so.pacing.rate);
+
+		iodme::proto::hello h = iodme::proto::make_hello(name, frame_size, so.pacing.rate);
+		replays.push_back(std::make_unique<iodme::replay>(sk, h, frames, so));
+	}
+	if (replays.empty())
+		return false;
+
+	std::unique_ptr<iodme::metrics::exporter> exporter;
+	if (optmap.count("metrics-file")) {
+		iodme::metrics::exporter::options m_opts = iodme::metrics::exporter::default_options;
+		m_opts.path = optmap["metrics-file"].as<std::string>();
+		m_opts.period_ns = optmap["metrics-period"].as<unsigned int>() * 1000000ULL; // msec to nsec
+		exporter = std::make_unique<iodme::metrics::exporter>(m_opts);
+		exporter->start();
+	}
+
+	uint64_t start = iodme::thread::now_ns();
+	for (auto& r : replays)
+		r->start();
+
+	bool running = true;
+	while (!killed && running) {
+		running = false;
+		for (auto& r : replays)
+			running |= r->running();
+		if (running)
+			iodme::thread::do_nanosleep(10*1000*1000);
+	}
+	double elapsed = (iodme::thread::now_ns() - start) / 1e9;
+
+	bool ok = true;
+	uint64_t frames = 0, bytes = 0;
+	for (auto& r : replays) {
+		ok &= !r->failed();
+		frames += r->frames();
+		bytes  += r->bytes();
+	}
+
+	exporter.reset();
+	replays.clear();
+
+	printf("frames %llu bytes %llu elapsed %.3f sec\nthroughput %.3f GB/s\n",
+		(unsigned long long) frames, (unsigned long long) bytes, elapsed, elapsed > 0 ? bytes / elapsed / 1e9 : 0);
+	return ok;
+}
+
+static std::vector<std::string> log_mask;
+int main(int argc, char *argv[])
+{
+	// **** Parse command line arguments ****
+	po::options_description optdesc("Replay recorded streams");
+	optdesc.add_options()
+		("help", "Print this message")
+		("log-output", po::value<std::string>()->default_value("-"), "Log output file name or - for stdout")
+		("log-format", po::value<std::string>()->default_value("timespec,timedelta,area,section"), "Log output format")
+		("log-mask",   po::value<std::vector<std::string> >(&log_mask)->composing(), "Log mask. Multiple masks can be specified.")
+		("timesource,T", po::value<std::string>()->default_value("realtime"),"Timesource (clockid: realtime, monotonic)")
+		("sink-port,P",  po::value<std::string>()->default_value("15740"),  "Sink TCP port to use")
+		("sink-host,A",  po::value<std::string>(), "Sink hostname (IP address or hostname)")
+		("input-dir,D",  po::value<std::string>()->default_value("/tmp"), "Directory with the recorded streams (sink output-dir)")
+		("stream",       po::value<std::vector<std::string> >(&stream_names)->composing(), "Name of the stream to replay (default: all streams in input-dir). Can be repeated.")
+		("frame-rate,r", po::value<std::string>()->default_value("original"), "Frame rate in FPS (average): original (estimated from the recording), or a number (0 - as fast as possible)")
+		("speed",        po::value<float>()->default_value(1), "Rate multiplier (eg 2 - twice as fast)")
+		("profile",   po::value<std::string>()->default_value("constant"), "Traffic profile: constant, burst:<frames>, ramp:<initial-fps>:<seconds>, poisson")
+		("catch-up",  po::value<std::string>()->default_value("burst"), "When falling behind: burst (send late frames back-to-back), skip (drop missed frames), reset (restart the schedule)")
+		("repeat",    po::value<unsigned int>()->default_value(1), "Number of passes over the recording (0 - until stopped)")
+		("metrics-file",   po::value<std::string>(), "Periodically write JSON snapshot of the stage metrics into this file")
+		("metrics-period", po::value<unsigned int>()->default_value(1000), "Metrics snapshot period in msec");
+
+	po::store(po::parse_command_line(argc, argv, optdesc), optmap);
+	po::notify(optmap);
+
+	// ** All argument values (including the defaults) are now storred in 'optmap' **
+
+	if (optmap.count("help")) {
+		std::cout << optdesc << std::endl;
+		exit(1);
+	}
+
+	if (!optmap.count("sink-host")) {
+		std::cout << optdesc << std::endl;
+		std::cout << "*** Sink hostname must be specified" << std::endl;
+		exit(1);
+	}
+
+	iodme::timesource *my_clock;
+	if (optmap["timesource"].as<std::string>() == "realtime")
+		my_clock = new iodme::timesource(CLOCK_REALTIME);
+	else if (optmap["timesource"].as<std::string>() == "monotonic")
+		my_clock = new iodme::timesource(CLOCK_MONOTONIC);
+	else {
+		std::cerr << "Unsupported timesource/clockid " << optmap["timesource"].as<std::string>() << std::endl;
+		exit(1);
+	}
+
+	catch_signals();
+
+	// Writes to a closed socket must not kill us
+	signal(SIGPIPE, SIG_IGN);
+
+	hogl::format *lf;
+	hogl::output *lo;
+
+	lf = new hogl::format_basic(optmap["log-format"].as<std::string>().c_str());
+	if (optmap["log-output"].as<std::string>() == "-")
+		lo = new hogl::output_stdout(*lf, 64 * 1024);
+	else if (optmap["log-output"].as<std::string>()[0] == '|')
+		lo = new hogl::output_pipe(optmap["log-output"].as<std::string>().c_str(), *lf, 64 * 1024);
+	else
+		lo = new hogl::output_plainfile(optmap["log-output"].as<std::string>().c_str(), *lf, 64 * 1024);
+
+	hogl::engine::options eng_opts = hogl::engine::default_options;
+	for (auto &m : log_mask)
+		eng_opts.default_mask << m;
+
+	hogl::activate(*lo, eng_opts);
+
+	hogl::change_timesource(my_clock);
+
+	// *****
+	// HOGL engine is running now. Avoid exit()ing from the process
+	// without going through hogl shutdown sequence below.
+
+	area = hogl::add_area("IODME-REPLAY");
+
+	hogl::ringbuf::options ring_opts = { capacity: 1024 * 8, prio: 100, flags: 0, record_tailroom: 128 };
+	hogl::tls *tls = new hogl::tls("MAIN-THREAD", ring_opts);
+
+	int r = run() ? 0 : 1;
+
+	delete tls;
+
+	hogl::deactivate();
+
+	delete lo;
+	delete lf;
+	delete my_clock;
+
+	return r;
+}
@@ -49,6 +49,8 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
+#include <algorithm>
+
 #include <boost/program_options.hpp>
 
 #include <hogl/format-basic.hpp>
@@ -68,7 +70,16 @@
 #include "iodme/timesource.hpp"
 #include "iodme/buffer.hpp"
 #include "iodme/netrx.hpp"
+#include "iodme/netrx-reactor.hpp"
+#include "iodme/mirror.hpp"
+#include "iodme/proto.hpp"
+#include "iodme/numa.hpp"
 #include "iodme/file-writer.hpp"
+#include "iodme/file-syncer.hpp"
+#include "iodme/reclaimer.hpp"
+#include "iodme/sequencer.hpp"
+#include "iodme/metrics.hpp"
+#include "iodme/tracer.hpp"
 
 ////////
 namespace po = boost::program_options;
@@ -107,17 +118,79 @@ static void setup_rt_sched()
 			strerror(errno), errno);
 }
 
-static bool run()
+// Receive the hello within the deadline, however it is split up
+static bool recv_hello(int sk, iodme::proto::hello& h, uint64_t timeout_ns)
 {
-	// Setup RT scheduling and lock ourselves in memory to minimize latencies.
-	setup_rt_sched();
+	uint64_t deadline = iodme::thread::now_ns() + timeout_ns;
+	uint8_t *p = (uint8_t *) &h;
+	size_t len = sizeof(h);
+
+	while (len) {
+		uint64_t now = iodme::thread::now_ns();
+		if (now >= deadline) {
+			errno = ETIMEDOUT;
+			return false;
+		}
+
+		struct pollfd pfd = { sk, POLLIN, 0 };
+		int r = poll(&pfd, 1, (deadline - now + 999999) / 1000000);
+		if (r < 0 && errno != EINTR)
+			return false;
+		if (r <= 0)
+			continue;
+
+		ssize_t n = recv(sk, p, len, MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				continue;
+			return false;
+		}
+		if (!n) {
+			errno = ECONNRESET;
+			return false;
+		}
+		p += n; len -= n;
+	}
+
+	return iodme::proto::decode_hello(h);
+}
+
+// Receive and validate the client hello
+static bool handshake(int sk, uint32_t buff_size, iodme::proto::hello& h)
+{
+	// Don't let a stuck or slow client block the accept loop.
+	// The whole hello must arrive within a second.
+	if (!recv_hello(sk, h, 1000000000ULL)) {
+		hogl::post(area, area->ERROR, "handshake failed: sk %d %s(%d).", sk, strerror(errno), errno);
+		return false;
+	}
+
+	hogl::post(area, area->INFO, "hello: sk %d name %s frame-size %u rate-mhz %u",
+			sk, h.name, h.frame_size, h.rate_mhz);
+
+	// Names are used for output files
+	if (!iodme::proto::valid_name(h.name)) {
+		hogl::post(area, area->ERROR, "invalid stream name: sk %d", sk);
+		return false;
+	}
 
-	// Connect to the sink
+	if (h.frame_size > buff_size) {
+		hogl::post(area, area->ERROR, "stream %s frame-size %u does not fit into buffer size %u",
+				h.name, h.frame_size, buff_size);
+		return false;
+	}
+
+	return true;
+}
+
+// Create non-blocking listening socket
+static int make_listener(const std::string& port)
+{
 	int sk = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
 	if (sk < 0) {
 		hogl::post(area, area->ERROR, "failed to create socket: %s(%d).",
 			   strerror(errno), errno);
-		return false;
+		return -1;
 	}
 
 	int reuse = 1;
@@ -127,12 +200,11 @@ static bool run()
 	setsockopt(sk, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse));
 #endif
 
-	std::string port = optmap["sink-port"].as<std::string>();
 	struct addrinfo *ai;
 	if (getaddrinfo("0.0.0.0", port.c_str(), 0, &ai) < 0) {
 		hogl::post(area, area->ERROR, "Failed to resolve bind address: %s(%d).",
 			   strerror(errno), errno);
-		return false;
+		return -1;
 	}
 
 	int r = bind(sk, ai->ai_addr, ai->ai_addrlen);
@@ -142,63 +214,447 @@ static bool run()
 
 	if (r < 0) {
 		hogl::post(area, area->ERROR, "Failed to bind the socket: %s(%d).", strerror(r_errno), r_errno);
-		return false;;
+		return -1;
 	}
 
 	if (listen(sk, 64) < 0) {
 		hogl::post(area, area->ERROR, "Failed to listen on socket: %s(%d).", strerror(errno), errno);
-		return false;;
+		return -1;
+	}
+
+	return sk;
+}
+
+// Open mirror destination for the stream.
+// host:port - another sink, anything else - directory for <stream>.mirror files.
+static int open_mirror(const std::string& dest, const char *name)
+{
+	size_t colon = dest.rfind(':');
+	if (colon == std::string::npos) {
+		std::string path = dest + "/" + name + ".mirror";
+		int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0666);
+		if (fd < 0)
+			hogl::post(area, area->ERROR, "failed to open mirror file %s: %s(%d).",
+					path, strerror(errno), errno);
+		return fd;
 	}
 
+	std::string host = dest.substr(0, colon);
+	std::string port = dest.substr(colon + 1);
+
+	struct addrinfo *ai;
+	if (getaddrinfo(host.c_str(), port.c_str(), 0, &ai) != 0) {
+		hogl::post(area, area->ERROR, "failed to resolve mirror address %s", dest);
+		return -1;
+	}
+
+	int sk = socket(PF_INET, SOCK_STREAM, 0);
+	int r  = sk < 0 ? -1 : connect(sk, ai->ai_addr, ai->ai_addrlen);
+	int r_errno = errno;
+
+	freeaddrinfo(ai);
+
+	if (r < 0) {
+		hogl::post(area, area->ERROR, "failed to connect to mirror %s: %s(%d).", dest, strerror(r_errno), r_errno);
+		if (sk >= 0)
+			close(sk);
+		return -1;
+	}
+	return sk;
+}
+
+// Per NUMA node buffer pool
+struct node_pool {
+	int          node; // -1 - no placement
+	cpu_set_t    cpus;
 	iodme::queue cb_q; // Clean buffers
 	iodme::queue db_q; // Dirty buffers
 
-	std::vector<std::unique_ptr<iodme::netrx>>  netrxs;
-	std::vector<std::unique_ptr<iodme::file_writer>> writers;
+	// Queues have room for all buffers of the pool
+	explicit node_pool(unsigned int buff_count) : node(-1), cb_q(buff_count), db_q(buff_count) {}
+};
+
+// CPU list and scheduling settings for a group of threads
+struct thread_role {
+	bool      pin;
+	cpu_set_t cpus;
+	int       policy; // -1 - inherit
+	int       prio;
+};
+
+static cpu_set_t proc_cpus;
+
+// Parse --<role>-cpus and --<role>-sched
+static bool parse_role(const std::string& role, thread_role& r)
+{
+	r.pin    = false;
+	r.policy = -1;
+	r.prio   = 0;
+	CPU_ZERO(&r.cpus);
+
+	std::string cpus = role + "-cpus";
+	if (optmap.count(cpus)) {
+		std::string v = optmap[cpus].as<std::string>();
+		if (!iodme::numa::parse_cpulist(v.c_str(), r.cpus) || !CPU_COUNT(&r.cpus)) {
+			hogl::post(area, area->ERROR, "invalid cpu list for %s threads: %s", role.c_str(), v.c_str());
+			return false;
+		}
+		r.pin = true;
+	}
+
+	std::string sched = role + "-sched";
+	if (optmap.count(sched)) {
+		std::string v = optmap[sched].as<std::string>();
+		if (!iodme::thread::parse_sched(v, r.policy, r.prio)) {
+			hogl::post(area, area->ERROR, "invalid scheduling spec for %s threads: %s", role.c_str(), v.c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static node_pool& pick_pool(std::vector<std::unique_ptr<node_pool>>& pools, int sk)
+{
+	int node = iodme::numa::socket_node(sk);
+	for (auto &p : pools)
+		if (p->node == node) return *p;
+	return *pools[0];
+}
+
+static void release_buffers(std::vector<std::unique_ptr<node_pool>>& pools)
+{
+	iodme::buffer b;
+	for (auto &p : pools) {
+		while (p->cb_q.pop(b))
+			b.free();
+		while (p->db_q.pop(b))
+			b.free();
+	}
+}
+
+// Place the thread according to its role and buffer pool.
+// In NUMA mode role CPUs are narrowed down to the pool's node.
+static void setup_thread(iodme::thread& t, const thread_role& r, const node_pool* p = nullptr)
+{
+	cpu_set_t cpus = r.pin ? r.cpus : proc_cpus;
+
+	// Don't let the threads inherit the main thread's CPUs
+	bool pin = r.pin || optmap.count("main-cpus");
+
+	if (p && p->node >= 0) {
+		cpu_set_t local;
+		CPU_AND(&local, &cpus, &p->cpus);
+		if (CPU_COUNT(&local))
+			cpus = local;
+		else
+			hogl::post(area, area->WARN, "no cpus left on node %d, thread is not node-local", p->node);
+		pin = true;
+	}
+
+	if (pin)
+		t.set_cpus(cpus);
+	if (r.policy >= 0)
+		t.set_sched(r.policy, r.prio);
+}
+
+static bool run()
+{
+	// Setup RT scheduling and lock ourselves in memory to minimize latencies.
+	setup_rt_sched();
+
+	// Per-role thread placement and scheduling
+	thread_role main_role, rx_role, wrt_role, sync_role, reclaim_role;
+	if (!parse_role("main", main_role) || !parse_role("rx", rx_role) ||
+			!parse_role("writer", wrt_role) || !parse_role("sync", sync_role) ||
+			!parse_role("reclaim", reclaim_role))
+		return false;
+
+	// Reclaimer must not compete with the RT threads it's inheriting from
+	if (reclaim_role.policy < 0) {
+		reclaim_role.policy = SCHED_IDLE;
+		reclaim_role.prio   = 0;
+	}
+
+	// Threads started from the main thread inherit its affinity.
+	// Remember the original set before moving the main thread.
+	sched_getaffinity(0, sizeof(proc_cpus), &proc_cpus);
+	if (main_role.pin) {
+		if (sched_setaffinity(0, sizeof(main_role.cpus), &main_role.cpus) < 0)
+			hogl::post(area, area->WARN, "failed to set main thread affinity: %s(%d).", strerror(errno), errno);
+	}
+	if (main_role.policy >= 0) {
+		struct sched_param sp = { 0 };
+		sp.sched_priority = main_role.prio;
+		if (sched_setscheduler(0, main_role.policy, &sp) < 0)
+			hogl::post(area, area->WARN, "failed to set main thread scheduling policy: %s(%d).", strerror(errno), errno);
+	}
+
+	// Each reactor gets its own listening socket (SO_REUSEPORT)
+	unsigned int n_reactors = optmap["reactors"].as<unsigned int>();
+	std::vector<int> lsks;
+	for (unsigned int i = 0; i < std::max(n_reactors, 1U); i++) {
+		int sk = make_listener(optmap["sink-port"].as<std::string>());
+		if (sk < 0)
+			return false;
+		lsks.push_back(sk);
+	}
+	int sk = lsks[0];
 
 	uint32_t buff_size = optmap["buff-size"].as<unsigned int>() * 1024 * 1024; // MB to bytes
 	unsigned int buff_count = optmap["buff-count"].as<unsigned int>();
 
+	// Buffer pools. One per NUMA node in NUMA mode, single unplaced pool otherwise.
+	std::vector<std::unique_ptr<node_pool>> pools;
+	if (optmap.count("numa")) {
+		int n_nodes = iodme::numa::num_nodes();
+		for (int n = 0; n < n_nodes; n++) {
+			auto p = std::make_unique<node_pool>(buff_count);
+			p->node = n;
+			if (!iodme::numa::node_cpus(n, p->cpus) || !CPU_COUNT(&p->cpus))
+				continue; // memory-only or offline node
+			pools.push_back(std::move(p));
+		}
+		if (pools.empty())
+			hogl::post(area, area->WARN, "no NUMA nodes found, using single pool");
+	}
+	if (pools.empty()) {
+		auto p = std::make_unique<node_pool>(buff_count);
+		p->node = -1;
+		pools.push_back(std::move(p));
+	}
+
+	// Reclaimer and syncer must outlive the writers
+	std::unique_ptr<iodme::reclaimer>   reclaimer;
+	std::unique_ptr<iodme::file_syncer> syncer;
+	std::unique_ptr<iodme::sequencer>   sequencer;
+	std::unique_ptr<iodme::tracer>      tracer;
+	std::vector<std::unique_ptr<iodme::netrx>>  netrxs;
+	std::vector<std::unique_ptr<iodme::netrx_reactor>> reactors;
+	std::vector<std::unique_ptr<iodme::file_writer>> writers;
+
 	unsigned int buff_flags = 0;
 	if (optmap.count("hugepages")) buff_flags |= iodme::buffer::HUGEPAGE;
 	if (optmap.count("memfd"))     buff_flags |= iodme::buffer::MEMFD;
 
-	// Pre-allocate clean buffers
-	for (unsigned int i = 0; i < buff_count; i++) {
-		std::string name("data-buffer-");
-		name += std::to_string(i);
+	// Pre-allocate clean buffers (buff-count per pool)
+	for (auto &p : pools) {
+		for (unsigned int i = 0; i < buff_count; i++) {
+			std::string name("data-buffer-");
+			name += std::to_string(i);
+
+			iodme::buffer::metadata m = { 0 };
+			iodme::buffer b;
+			if (!b.alloc(buff_size, buff_flags, name.c_str(), p->node) || !b.add_metadata(m)) {
+				hogl::post(area, area->ERROR, "failed to pre-allocate buffer-%u size %u node %d : %s(%d).",
+						i, buff_size, p->node, strerror(errno), errno);
+				release_buffers(pools);
+				return false;
+			}
 
-		iodme::buffer::metadata m = { 0 };
-		iodme::buffer b;
-		if (!b.alloc(buff_size, buff_flags, name.c_str()) || !b.add_metadata(m)) {
-			hogl::post(area, area->ERROR, "failed to pre-allocate buffer-%u size %u : %s(%d).", i, buff_size, strerror(errno), errno);
+			hogl::post(area, area->INFO, "pre-alloc: base %p capacity %u node %d", b.base, b.capacity, p->node);
+			p->cb_q.push(b);
+		}
+	}
+
+	// Start the sync stage (unless writers sync inline)
+	std::string sync_policy = optmap["sync-policy"].as<std::string>();
+	if (sync_policy != "frame") {
+		iodme::file_syncer::options sync_opts = iodme::file_syncer::default_options;
+		if (sync_policy == "range")
+			sync_opts.policy = iodme::file_syncer::SYNC_RANGE;
+		else if (sync_policy == "group")
+			sync_opts.policy = iodme::file_syncer::SYNC_GROUP;
+		else {
+			hogl::post(area, area->ERROR, "unsupported sync policy %s", sync_policy);
 			return false;
 		}
+		sync_opts.group_time_ns = optmap["sync-group-ms"].as<unsigned int>() * 1000000ULL; // msec to nsec
+		sync_opts.group_bytes   = optmap["sync-group-mb"].as<unsigned int>() * 1024ULL * 1024; // MB to bytes
+		sync_opts.max_unsynced  = optmap["sync-window-mb"].as<unsigned int>() * 1024ULL * 1024; // MB to bytes
 
-		hogl::post(area, area->INFO, "pre-alloc: base %p capacity %u", b.base, b.capacity);
-		cb_q.push(b);
+		syncer = std::make_unique<iodme::file_syncer>("DATA-SYNCER", sync_opts);
+		setup_thread(*syncer, sync_role);
+		syncer->start();
+	}
+
+	// Start the retention stage (before the writers, older files are found by scanning the output dir)
+	uint64_t retain_bytes = optmap["retain-mb"].as<unsigned int>() * 1024ULL * 1024; // MB to bytes
+	uint64_t retain_files = optmap["retain-files"].as<unsigned int>();
+	uint64_t retain_free  = optmap["retain-free-mb"].as<unsigned int>() * 1024ULL * 1024; // MB to bytes
+	if (retain_bytes || retain_files || retain_free) {
+		iodme::reclaimer::options rcl_opts = iodme::reclaimer::default_options;
+		rcl_opts.max_bytes = retain_bytes;
+		rcl_opts.max_files = retain_files;
+		rcl_opts.min_free_bytes = retain_free;
+		rcl_opts.reserve_bytes  = optmap["retain-reserve-mb"].as<unsigned int>() * 1024ULL * 1024; // MB to bytes
+
+		// By default keep room for everything that may be in flight:
+		// all buffers and the open segments. Each writer keeps one open
+		// segment per stream, shared segments (in-order) are one per stream.
+		if (!rcl_opts.reserve_bytes) {
+			rcl_opts.reserve_bytes = (uint64_t) buff_size * buff_count * pools.size();
+			if (optmap.count("segment")) {
+				uint64_t n_segs = optmap["retain-streams"].as<unsigned int>();
+				if (!optmap.count("in-order"))
+					n_segs *= optmap["writer-threads"].as<unsigned int>() * pools.size();
+				rcl_opts.reserve_bytes += n_segs * optmap["segment-size"].as<unsigned int>() * 1024ULL * 1024;
+			}
+		}
+		if (retain_bytes && rcl_opts.reserve_bytes >= retain_bytes) {
+			hogl::post(area, area->ERROR, "retention budget (%llu bytes) does not cover the data in flight (%llu bytes)",
+				   retain_bytes, rcl_opts.reserve_bytes);
+			return false;
+		}
+
+		reclaimer = std::make_unique<iodme::reclaimer>("DATA-RECLAIMER", optmap["output-dir"].as<std::string>(), rcl_opts);
+		setup_thread(*reclaimer, reclaim_role);
+		reclaimer->start();
 	}
 
 	// Start writer threads
-	unsigned int wrt_flags = 0;
-	if (optmap.count("directio")) wrt_flags |= iodme::file_writer::DIRECTIO;
-	if (optmap.count("splice"))   wrt_flags |= iodme::file_writer::SPLICE;
+	iodme::file_writer::options wrt_opts = iodme::file_writer::default_options;
+	if (optmap.count("directio")) wrt_opts.flags |= iodme::file_writer::DIRECTIO;
+	if (optmap.count("splice"))   wrt_opts.flags |= iodme::file_writer::SPLICE;
+	if (optmap.count("uring"))    wrt_opts.flags |= iodme::file_writer::URING;
+	if (optmap.count("segment"))  wrt_opts.flags |= iodme::file_writer::SEGMENT;
+
+	std::string checksum = optmap["checksum"].as<std::string>();
+	if (checksum == "writer")
+		wrt_opts.flags |= iodme::file_writer::CHECKSUM;
+	else if (checksum != "off" && checksum != "rx") {
+		hogl::post(area, area->ERROR, "unsupported checksum mode %s", checksum);
+		return false;
+	}
+	wrt_opts.io_depth = optmap["io-depth"].as<unsigned int>();
+	wrt_opts.segment_size = optmap["segment-size"].as<unsigned int>() * 1024ULL * 1024; // MB to bytes
+	wrt_opts.segment_time_ns = optmap["segment-time"].as<unsigned int>() * 1000000000ULL; // sec to nsec
+	wrt_opts.syncer = syncer.get();
+	wrt_opts.reclaimer = reclaimer.get();
+
+	// Publish frames of each stream in order across the writers
+	if (optmap.count("in-order")) {
+		iodme::sequencer::options seq_opts = iodme::sequencer::default_options;
+		seq_opts.window = optmap["reorder-window"].as<unsigned int>();
+		seq_opts.gap_timeout_ns = optmap["reorder-timeout"].as<unsigned int>() * 1000000ULL; // msec to nsec
+		seq_opts.segment_size = wrt_opts.segment_size;
+		seq_opts.segment_time_ns = wrt_opts.segment_time_ns;
+		seq_opts.syncer = syncer.get();
+		seq_opts.reclaimer = reclaimer.get();
+
+		sequencer = std::make_unique<iodme::sequencer>("DATA-SEQUENCER", seq_opts);
+		wrt_opts.sequencer = sequencer.get();
+	}
 
+	// Frame lifecycle tracing
+	if (optmap.count("trace") || optmap.count("trace-file")) {
+		iodme::tracer::options trc_opts = iodme::tracer::default_options;
+		if (optmap.count("trace-file"))
+			trc_opts.path = optmap["trace-file"].as<std::string>();
+
+		tracer = std::make_unique<iodme::tracer>("FRAME-TRACER", trc_opts);
+		tracer->start();
+		wrt_opts.tracer = tracer.get();
+	}
+
+	// Writers are started per pool and stay on the pool's node
 	unsigned int wrt_count = optmap["writer-threads"].as<unsigned int>();
-	for (unsigned int i = 0; i < wrt_count; i++) {
-		std::string name("DATA-WRITER");
-		name += std::to_string(i);
+	for (auto &p : pools) {
+		for (unsigned int i = 0; i < wrt_count; i++) {
+			std::string name("DATA-WRITER");
+			name += std::to_string(writers.size());
+
+			auto dw = std::make_unique<iodme::file_writer>(
+					name,
+					optmap["output-dir"].as<std::string>(),
+					p->db_q, p->cb_q, wrt_opts);
+			setup_thread(*dw, wrt_role, p.get());
+			dw->start();
+			writers.push_back(std::move(dw));
+		}
+	}
+
+	// Receiver options
+	iodme::netrx::options rx_opts = iodme::netrx::default_options;
+	if (optmap.count("splice-rx"))  rx_opts.flags |= iodme::netrx::SPLICE;
+	if (optmap.count("raw-stream")) rx_opts.flags |= iodme::netrx::RAW;
+	if (optmap.count("verify"))     rx_opts.flags |= iodme::netrx::VERIFY;
+	if (checksum == "rx")           rx_opts.flags |= iodme::netrx::CHECKSUM;
+	rx_opts.odir = optmap["output-dir"].as<std::string>();
+	rx_opts.frame_size = buff_size;
+	rx_opts.syncer = syncer.get();
+	rx_opts.reclaimer = reclaimer.get();
+
+	if ((rx_opts.flags & iodme::netrx::VERIFY) && (rx_opts.flags & (iodme::netrx::SPLICE | iodme::netrx::RAW))) {
+		hogl::post(area, area->ERROR, "verify is supported only for framed streams without splice-rx");
+		return false;
+	}
+
+	if ((rx_opts.flags & iodme::netrx::CHECKSUM) && (rx_opts.flags & (iodme::netrx::SPLICE | iodme::netrx::RAW))) {
+		hogl::post(area, area->ERROR, "checksum rx is supported only for framed streams without splice-rx");
+		return false;
+	}
+
+	// Stream mirrors
+	std::vector<std::string> mirrors;
+	if (optmap.count("mirror"))
+		mirrors = optmap["mirror"].as<std::vector<std::string>>();
+
+	iodme::mirror::options mir_opts = iodme::mirror::default_options;
+	mir_opts.pipe_size = optmap["mirror-pipe-mb"].as<unsigned int>() * 1024 * 1024; // MB to bytes
+
+	if (!mirrors.empty() && (!(rx_opts.flags & iodme::netrx::SPLICE) || (rx_opts.flags & iodme::netrx::RAW) || n_reactors)) {
+		hogl::post(area, area->ERROR, "mirrors are supported only for framed streams with splice-rx");
+		return false;
+	}
+
+	if (n_reactors) {
+		if (rx_opts.flags & (iodme::netrx::SPLICE | iodme::netrx::RAW)) {
+			hogl::post(area, area->ERROR, "reactors support only framed streams without splice-rx");
+			return false;
+		}
 
-		auto dw = std::make_unique<iodme::file_writer>(
-				name,
-				optmap["output-dir"].as<std::string>(),
-				db_q, cb_q, wrt_flags);
-		dw->start();
-		writers.push_back(std::move(dw));
+		for (unsigned int i = 0; i < n_reactors; i++) {
+			std::string name("DATA-REACTOR");
+			name += std::to_string(i);
+
+			node_pool &p = *pools[i % pools.size()];
+			unsigned int dr_flags = (optmap.count("verify") ? iodme::netrx_reactor::VERIFY : 0) |
+					(checksum == "rx" ? iodme::netrx_reactor::CHECKSUM : 0);
+			auto dr = std::make_unique<iodme::netrx_reactor>(name, lsks[i], buff_size, p.cb_q, p.db_q, dr_flags);
+			setup_thread(*dr, rx_role, &p);
+			dr->start();
+			reactors.push_back(std::move(dr));
+		}
+	}
+
+	std::unique_ptr<iodme::metrics::exporter> exporter;
+	if (optmap.count("metrics-file")) {
+		iodme::metrics::exporter::options m_opts = iodme::metrics::exporter::default_options;
+		m_opts.path = optmap["metrics-file"].as<std::string>();
+		m_opts.period_ns = optmap["metrics-period"].as<unsigned int>() * 1000000ULL; // msec to nsec
+		exporter = std::make_unique<iodme::metrics::exporter>(m_opts);
+		exporter->start();
 	}
 
 	hogl::post(area, area->INFO, "waiting for connections");
 
+	// Data that failed to sync is lost. Stop instead of recording on.
+	auto sync_failed = [&]() {
+		if (!syncer || !syncer->errors())
+			return false;
+		hogl::post(area, area->ERROR, "sync failed for %llu files, recorded data is not durable. stopping.",
+			   syncer->errors());
+		return true;
+	};
+
+	while (!killed && n_reactors) {
+		// Reactors accept and serve the connections
+		if (sync_failed())
+			return false;
+		iodme::thread::do_nanosleep(10*1000*1000);
+	}
+
 	while (!killed) {
 		struct sockaddr_in addr;
 		socklen_t alen = sizeof(addr);
@@ -214,6 +670,8 @@ static bool run()
 					}
 				}
 
+				if (sync_failed())
+					return false;
 				iodme::thread::do_nanosleep(10*1000*1000);
 				continue;
 			}
@@ -224,26 +682,59 @@ static bool run()
 
 		hogl::post(area, area->INFO, "new connection: sk %d", nsk);
 
-		unsigned int rcvbuf = 256 * 1024; // figure out buffer size from handshake
+		std::string name = std::string("data-stream-") + std::to_string(nsk);
+		unsigned int rcvbuf = 256 * 1024;
+
+		iodme::proto::hello h;
+		if (!(rx_opts.flags & iodme::netrx::RAW)) {
+			if (!handshake(nsk, buff_size, h)) {
+				close(nsk);
+				continue;
+			}
+			name   = h.name;
+			rcvbuf = h.frame_size * 2;
+		}
+
 		if (setsockopt(nsk, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0) {
 			hogl::post(area, area->WARN, "Failed to set socket rcvbuf depth: %s(%d).",
 				   strerror(errno), errno);
 		}
+		hogl::post(area, area->INFO, "socket: rcv-buffer %u", rcvbuf);
+
+		// New connection / stream.
+		// Receive on the node that processes the socket's traffic.
+		node_pool &p = pick_pool(pools, nsk);
+		auto dn = std::make_unique<iodme::netrx>(name, nsk, p.cb_q, p.db_q, rx_opts);
+		if (p.node >= 0)
+			hogl::post(area, area->INFO, "stream %s: node %d", name.c_str(), p.node);
+
+		// Mirrors that can't be set up are left out, recording goes on regardless
+		for (auto &dest : mirrors) {
+			int mfd = open_mirror(dest, name.c_str());
+			if (mfd < 0)
+				continue;
 
-		// New connection / stream
-		// FIXME: set name from client handshake
-		auto dn = std::make_unique<iodme::netrx>(
-				std::string("data-stream-") + std::to_string(nsk),
-				nsk, cb_q, db_q);
+			auto m = std::make_unique<iodme::mirror>(name, dest, mfd, h, mir_opts);
+			setup_thread(*m, rx_role, &p);
+			if (m->failed() || !m->start()) {
+				hogl::post(area, area->ERROR, "failed to start mirror of stream %s to %s", name.c_str(), dest.c_str());
+				continue;
+			}
+			hogl::post(area, area->INFO, "stream %s: mirror to %s", name.c_str(), dest.c_str());
+			dn->add_mirror(std::move(m));
+		}
+		setup_thread(*dn, rx_role, &p);
 		dn->start();
 		netrxs.push_back(std::move(dn));
 	}
 
-	// Release clean buffers
-	iodme::buffer b;
-	while (cb_q.pop(b)) {
-		b.free();
-	}
+	// Final metrics snapshot, then stop all stages before releasing the buffers
+	exporter.reset();
+	netrxs.clear();
+	reactors.clear();
+	writers.clear();
+
+	release_buffers(pools);
 
 	return 0;
 }
@@ -262,12 +753,51 @@ int main(int argc, char *argv[])
 		("timesource,T", po::value<std::string>()->default_value("realtime"), "Timesource (clockid: realtime, monotonic)")
 		("sink-port,P",  po::value<std::string>()->default_value("15740"),  "Sink TCP port to use")
 		("buff-size,B",  po::value<unsigned int>()->default_value(1024),  "Buffer size in MB")
-		("buff-count,C", po::value<unsigned int>()->default_value(2), "Number of buffers to allocate")
-		("writer-threads,W", po::value<unsigned int>()->default_value(2), "Number of writer threads")
+		("buff-count,C", po::value<unsigned int>()->default_value(2), "Number of buffers to allocate (per node in NUMA mode)")
+		("writer-threads,W", po::value<unsigned int>()->default_value(2), "Number of writer threads (per node in NUMA mode)")
+		("numa",      "Keep buffers, receivers and writers node-local (per-node buffer pools)")
+		("main-cpus",   po::value<std::string>(), "CPU list for the main (accept) thread (eg 0-1,4)")
+		("rx-cpus",     po::value<std::string>(), "CPU list for the receive threads")
+		("writer-cpus", po::value<std::string>(), "CPU list for the writer threads")
+		("sync-cpus",   po::value<std::string>(), "CPU list for the sync thread")
+		("reclaim-cpus", po::value<std::string>(), "CPU list for the reclaim thread")
+		("main-sched",   po::value<std::string>(), "Scheduling for the main thread: <other|batch|idle|fifo|rr>[:prio]")
+		("rx-sched",     po::value<std::string>(), "Scheduling for the receive threads")
+		("writer-sched", po::value<std::string>(), "Scheduling for the writer threads")
+		("sync-sched",   po::value<std::string>(), "Scheduling for the sync thread")
+		("reclaim-sched", po::value<std::string>(), "Scheduling for the reclaim thread (default idle)")
 		("hugepages", "Use hugepages for IO buffers")
 		("directio",  "Use directio for output files")
 		("memfd",     "Use memfd for IO buffers")
-		("splice",    "Use (vm)splice to avoid copies when possible");
+		("splice",    "Use (vm)splice to avoid copies when possible")
+		("splice-rx", "Splice received data straight from the socket into output files")
+		("mirror",    po::value<std::vector<std::string>>()->composing(), "Forward a copy of each stream (splice-rx mode) to <host>:<port> (another sink) or into <dir>/<stream>.mirror. Can be repeated.")
+		("mirror-pipe-mb", po::value<unsigned int>()->default_value(0), "Mirror pipe size in MB, at least one frame of the stream. Frames that don't fit are not mirrored (0 - fs.pipe-max-size)")
+		("raw-stream", "Expect unframed streams (no handshake, files are cut at buff-size)")
+		("verify",    "Check contents of the received frames (generator with --payload stamped)")
+		("checksum",  po::value<std::string>()->default_value("off"), "Check frame checksums (generator with --checksum): off, rx - on receive, writer - before writing (computes missing ones)")
+		("reactors",  po::value<unsigned int>()->default_value(0), "Number of epoll reactor threads serving connections (0 - thread per connection)")
+		("uring",     "Use io_uring to keep multiple frames in flight per writer thread")
+		("io-depth",  po::value<unsigned int>()->default_value(32), "Max number of frames in flight per writer (io_uring mode)")
+		("segment",   "Append frames into rolling segment files instead of file per frame")
+		("segment-size", po::value<unsigned int>()->default_value(1024), "Segment size in MB")
+		("segment-time", po::value<unsigned int>()->default_value(0), "Max segment age in seconds (0 - no limit)")
+		("in-order",  "Publish frames of each stream in seqno order (shared segments with --segment)")
+		("reorder-window", po::value<unsigned int>()->default_value(64), "Max frames held back waiting for a missing frame (in-order mode)")
+		("reorder-timeout", po::value<unsigned int>()->default_value(1000), "Max time in msec to wait for a missing frame (in-order mode)")
+		("metrics-file",   po::value<std::string>(), "Periodically write JSON snapshot of the stage metrics into this file")
+		("metrics-period", po::value<unsigned int>()->default_value(1000), "Metrics snapshot period in msec")
+		("trace",          "Track per-stream frame latencies (receive, queue wait, write, sync, end-to-end)")
+		("trace-file",     po::value<std::string>(), "Enable tracing and dump raw frame lifecycle records into this file")
+		("sync-policy",  po::value<std::string>()->default_value("frame"), "Durability policy (frame - fsync inline, range - background fsync, group - group commit)")
+		("sync-group-ms",  po::value<unsigned int>()->default_value(10),   "Group commit interval in msec")
+		("sync-group-mb",  po::value<unsigned int>()->default_value(256),  "Group commit size in MB")
+		("sync-window-mb", po::value<unsigned int>()->default_value(1024), "Max amount of un-synced data in MB")
+		("retain-mb",      po::value<unsigned int>()->default_value(0), "Keep at most this many MB of recordings in the output dir, oldest are removed (0 - no limit)")
+		("retain-files",   po::value<unsigned int>()->default_value(0), "Keep at most this many files (frames or segments) in the output dir (0 - no limit)")
+		("retain-free-mb", po::value<unsigned int>()->default_value(0), "Remove oldest recordings to keep this many MB free in the output filesystem (0 - don't check)")
+		("retain-reserve-mb", po::value<unsigned int>()->default_value(0), "Room kept free on top of the retention limits for data in flight (0 - all buffers and the open segments)")
+		("retain-streams", po::value<unsigned int>()->default_value(1), "Number of concurrent streams the default retention reserve is sized for");
 
 	po::store(po::parse_command_line(argc, argv, optdesc), optmap);
 	po::notify(optmap);
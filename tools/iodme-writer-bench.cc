@@ -0,0 +1,626 @@
+//  Copyright (c) 2021, Qualcomm Innovation Center, Inc. All rights reserved.
+//
+//  Redistribution and use in source and binary forms, with or without
+//  modification, are permitted provided that the following conditions are met:
+//
+//  1. Redistributions of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//  2. Redistributions in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//  3. Neither the name of the copyright holder nor the names of its contributors
+//     may be used to endorse or promote products derived from this software
+//     without specific prior written permission.
+//
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+//  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+//  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+//  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+//  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+//  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+//  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+//  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+//  POSSIBILITY OF SUCH DAMAGE.
+//
+//  SPDX-License-Identifier: BSD-3-Clause
+
+#define _GNU_SOURCE 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <hogl/format-basic.hpp>
+#include <hogl/output-stdout.hpp>
+#include <hogl/output-stderr.hpp>
+#include <hogl/output-plainfile.hpp>
+#include <hogl/engine.hpp>
+#include <hogl/area.hpp>
+#include <hogl/mask.hpp>
+#include <hogl/post.hpp>
+#include <hogl/flush.hpp>
+#include <hogl/ring.hpp>
+#include <hogl/tls.hpp>
+
+#include "iodme/buffer.hpp"
+#include "iodme/queue.hpp"
+#include "iodme/thread.hpp"
+#include "iodme/file-writer.hpp"
+#include "iodme/file-syncer.hpp"
+#include "iodme/netrx.hpp"
+#include "iodme/metrics.hpp"
+
+////////
+using iodme::buffer;
+namespace po = boost::program_options;
+namespace metrics = iodme::metrics;
+
+static const hogl::area *area = nullptr;
+static po::variables_map optmap;
+
+static volatile bool killed = false;
+
+// Catch most signal to terminate gracefully.
+static inline void sig_handler(int signum)
+{
+	killed = true;
+}
+
+static inline void catch_signals()
+{
+	struct sigaction sa = {{0}};
+	sa.sa_handler = sig_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+// Single benchmark case (one row of the results matrix)
+struct bench_case {
+	unsigned int writers;
+	unsigned int depth;      // frames in flight per writer
+	uint32_t     frame_size;
+	bool         segment;    // append into segments instead of file-per-frame
+};
+
+struct writer_result {
+	std::string name;
+	uint64_t    frames;
+	uint64_t    bytes;
+	metrics::histogram::snapshot write_ns;
+	metrics::histogram::snapshot fsync_ns;
+};
+
+struct bench_result {
+	bench_case  c;
+	bool        ok;
+	std::string error;
+
+	uint64_t frames;
+	uint64_t bytes;
+	double   elapsed;   // seconds from the first frame queued to the last one released
+	double   gbps;      // aggregate throughput (10^9 bytes per sec)
+	uint64_t stalls;    // times the feeder had to wait for a free buffer
+	metrics::histogram::snapshot frame_ns; // queued -> released
+	std::vector<writer_result> writers;
+};
+
+static size_t parse_size(const std::string& s)
+{
+	char *end;
+	unsigned long long v = strtoull(s.c_str(), &end, 0);
+	switch (*end) {
+	case 'k': case 'K': v *= 1024ULL; end++; break;
+	case 'm': case 'M': v *= 1024ULL * 1024; end++; break;
+	case 'g': case 'G': v *= 1024ULL * 1024 * 1024; end++; break;
+	}
+	if (*end == 'B' || *end == 'b')
+		end++;
+	if (*end || !v)
+		return 0;
+	return v;
+}
+
+// Split comma separated list
+static std::vector<std::string> split_list(const std::vector<std::string>& args)
+{
+	std::vector<std::string> v;
+	for (auto &a : args) {
+		std::istringstream in(a);
+		std::string s;
+		while (std::getline(in, s, ','))
+			if (!s.empty()) v.push_back(s);
+	}
+	return v;
+}
+
+static bool parse_numbers(const std::vector<std::string>& args, std::vector<unsigned int>& v)
+{
+	for (auto &a : split_list(args)) {
+		char *end;
+		unsigned long n = strtoul(a.c_str(), &end, 0);
+		if (*end || !n) {
+			std::cerr << "invalid number " << a << '\n';
+			return false;
+		}
+		v.push_back(n);
+	}
+	return !v.empty();
+}
+
+// Remove regular files from the case directory
+static void clean_dir(const std::string& dir)
+{
+	DIR *d = opendir(dir.c_str());
+	if (!d)
+		return;
+	struct dirent *e;
+	while ((e = readdir(d)) != 0) {
+		if (e->d_type == DT_DIR)
+			continue;
+		std::string p = dir + '/' + e->d_name;
+		unlink(p.c_str());
+	}
+	closedir(d);
+}
+
+static bool failed_case(bench_result& r, const std::string& what, int err)
+{
+	r.ok = false;
+	r.error = what + ": " + strerror(err);
+	hogl::post(area, area->ERROR, "%s", r.error);
+	return false;
+}
+
+// Per-writer metrics live in the writer metrics groups, which are
+// gone once the writers are destroyed. Grab them just before that.
+static void read_writer_metrics(bench_result& r)
+{
+	for (auto& w : r.writers) {
+		metrics::registry::read(w.name, "frames", w.frames);
+		metrics::registry::read(w.name, "bytes",  w.bytes);
+		metrics::registry::read(w.name, "write_ns", w.write_ns);
+		metrics::registry::read(w.name, "fsync_ns", w.fsync_ns);
+	}
+}
+
+static bool run_case(bench_result& r, const iodme::file_writer::options& base_opts)
+{
+	const bench_case& c = r.c;
+	r.ok = true;
+	r.frames = r.bytes = r.stalls = 0;
+	r.elapsed = r.gbps = 0;
+
+	unsigned int buff_count = c.writers * c.depth;
+
+	std::string odir = optmap["output-dir"].as<std::string>() + "/iodme-writer-bench";
+	if (mkdir(odir.c_str(), 0777) < 0 && errno != EEXIST)
+		return failed_case(r, "failed to create " + odir, errno);
+	clean_dir(odir);
+
+	unsigned int buff_flags = 0;
+	if (optmap.count("hugepages")) buff_flags |= buffer::HUGEPAGE;
+	if (optmap.count("memfd"))     buff_flags |= buffer::MEMFD;
+
+	iodme::queue cb_q(buff_count); // clean buffers
+	iodme::queue db_q(buff_count); // data buffers
+
+	// Pre-allocate the frames, fill them with something other than zeros
+	std::vector<buffer> pool;
+	for (unsigned int i = 0; i < buff_count; i++) {
+		std::string name("bench-buffer-");
+		name += std::to_string(i);
+
+		buffer::metadata m = { 0 };
+		buffer b;
+		if (!b.alloc(c.frame_size, buff_flags, name.c_str()) || !b.add_metadata(m)) {
+			failed_case(r, "failed to allocate buffer", errno);
+			break;
+		}
+		memset(b.base, 0xa5 + i, b.capacity);
+		pool.push_back(b);
+		cb_q.push(b);
+	}
+
+	std::unique_ptr<iodme::file_syncer> syncer;
+	std::vector<std::unique_ptr<iodme::file_writer>> writers;
+
+	iodme::file_writer::options wrt_opts = base_opts;
+	if (c.segment)
+		wrt_opts.flags |= iodme::file_writer::SEGMENT;
+	wrt_opts.io_depth = c.depth;
+
+	std::string sync_policy = optmap["sync-policy"].as<std::string>();
+	if (r.ok && sync_policy != "frame") {
+		iodme::file_syncer::options sync_opts = iodme::file_syncer::default_options;
+		sync_opts.policy = sync_policy == "range" ? iodme::file_syncer::SYNC_RANGE : iodme::file_syncer::SYNC_GROUP;
+		syncer = std::make_unique<iodme::file_syncer>("BENCH-SYNCER", sync_opts);
+		syncer->start();
+		wrt_opts.syncer = syncer.get();
+	}
+
+	for (unsigned int i = 0; r.ok && i < c.writers; i++) {
+		std::string name("BENCH-WRITER");
+		name += std::to_string(i);
+
+		auto w = std::make_unique<iodme::file_writer>(name, odir, db_q, cb_q, wrt_opts);
+		w->start();
+		writers.push_back(std::move(w));
+	}
+
+	// Feed the writers for the duration of the case.
+	// Writers return the buffers into the clean queue with the
+	// lifecycle trace filled in.
+	metrics::histogram frame_ns;
+	uint64_t duration_ns = optmap["duration"].as<float>() * 1e9;
+	uint64_t max_frames  = optmap["frames"].as<unsigned int>();
+	uint64_t seqno = 0, done = 0;
+	uint64_t start = iodme::thread::now_ns(), last = start;
+
+	while (r.ok && !killed) {
+		bool feeding = (!max_frames || seqno < max_frames) &&
+				(!duration_ns || iodme::thread::now_ns() - start < duration_ns);
+		if (!feeding && done == seqno)
+			break;
+
+		buffer b;
+		if (!cb_q.pop(b)) {
+			if (feeding)
+				r.stalls++;
+			if (!cb_q.pop_wait(b, iodme::default_wait))
+				continue;
+		}
+
+		// Account for the returned frame
+		if (b.meta->trace[buffer::T_RELEASED]) {
+			frame_ns.record(b.meta->trace[buffer::T_RELEASED] - b.meta->trace[buffer::T_RX_DONE]);
+			last = b.meta->trace[buffer::T_RELEASED];
+			done++;
+		}
+
+		if (!feeding) {
+			memset(b.meta->trace, 0, sizeof(b.meta->trace));
+			continue;
+		}
+
+		iodme::netrx::init_frame(b, "bench", seqno++);
+		b.clear();
+		b.put(b.capacity);
+		b.meta->trace[buffer::T_RX_DONE] = b.meta->trace[buffer::T_POOL_POP];
+		db_q.push(b);
+	}
+
+	for (auto& w : writers) {
+		writer_result wr;
+		wr.name = w->name();
+		wr.frames = wr.bytes = 0;
+		r.writers.push_back(wr);
+	}
+	read_writer_metrics(r);
+
+	// Writers flush (close segments) on the way out
+	writers.clear();
+	syncer.reset();
+
+	r.frames  = done;
+	r.bytes   = done * c.frame_size;
+	r.elapsed = (last - start) / 1e9;
+	r.gbps    = r.elapsed > 0 ? r.bytes / r.elapsed / 1e9 : 0;
+	frame_ns.read(r.frame_ns);
+
+	for (auto& b : pool)
+		b.free();
+
+	if (!optmap.count("keep-files"))
+		clean_dir(odir);
+
+	if (killed && r.ok)
+		failed_case(r, "interrupted", EINTR);
+
+	return r.ok;
+}
+
+// **** Results output ****
+
+static std::string case_layout(const bench_case& c)
+{
+	return c.segment ? "segment" : "file";
+}
+
+static void output_text(std::ostream& out, const std::vector<bench_result>& results)
+{
+	char line[256];
+	snprintf(line, sizeof(line), "%7s %5s %10s %8s %8s %8s %8s %10s %10s %10s %10s\n",
+		"writers", "depth", "frame-size", "layout", "frames", "stalls", "GB/s",
+		"frame-p50", "frame-p99", "write-p99", "fsync-p99");
+	out << line;
+
+	for (auto &r : results) {
+		snprintf(line, sizeof(line), "%7u %5u %10u %8s ",
+			r.c.writers, r.c.depth, r.c.frame_size, case_layout(r.c).c_str());
+		out << line;
+
+		if (!r.ok) {
+			out << r.error << '\n';
+			continue;
+		}
+
+		// Worst writer
+		uint64_t write_p99 = 0, fsync_p99 = 0;
+		for (auto &w : r.writers) {
+			write_p99 = std::max(write_p99, w.write_ns.percentile(99));
+			fsync_p99 = std::max(fsync_p99, w.fsync_ns.percentile(99));
+		}
+
+		snprintf(line, sizeof(line), "%8llu %8llu %8.3f %10.3f %10.3f %10.3f %10.3f\n",
+			(unsigned long long) r.frames, (unsigned long long) r.stalls, r.gbps,
+			r.frame_ns.percentile(50) / 1e6, r.frame_ns.percentile(99) / 1e6,
+			write_p99 / 1e6, fsync_p99 / 1e6);
+		out << line;
+	}
+	out << "(latencies in msec, write/fsync of the worst writer)\n";
+}
+
+static void output_csv(std::ostream& out, const std::vector<bench_result>& results)
+{
+	out << "writers,depth,frame_size,layout,ok,frames,bytes,elapsed,gbps,stalls,"
+		"frame_p50_ns,frame_p99_ns,frame_max_ns,writer,writer_frames,writer_bytes,"
+		"write_p50_ns,write_p99_ns,write_max_ns,fsync_p50_ns,fsync_p99_ns,fsync_max_ns,error\n";
+
+	// One row per writer, case totals repeated
+	for (auto &r : results) {
+		std::ostringstream head;
+		head << r.c.writers << ',' << r.c.depth << ',' << r.c.frame_size << ',' << case_layout(r.c) << ','
+			<< r.ok << ',' << r.frames << ',' << r.bytes << ',' << r.elapsed << ',' << r.gbps << ','
+			<< r.stalls << ',' << r.frame_ns.percentile(50) << ',' << r.frame_ns.percentile(99) << ','
+			<< r.frame_ns.max << ',';
+
+		if (!r.ok || r.writers.empty()) {
+			out << head.str() << ",,,,,,,,," << '"' << r.error << '"' << '\n';
+			continue;
+		}
+
+		for (auto &w : r.writers)
+			out << head.str() << w.name << ',' << w.frames << ',' << w.bytes << ','
+				<< w.write_ns.percentile(50) << ',' << w.write_ns.percentile(99) << ',' << w.write_ns.max << ','
+				<< w.fsync_ns.percentile(50) << ',' << w.fsync_ns.percentile(99) << ',' << w.fsync_ns.max << ','
+				<< "\"\"\n";
+	}
+}
+
+static void json_latency(std::ostream& out, const char *name, const metrics::histogram::snapshot& s)
+{
+	out << ", \"" << name << "\": {\"count\": " << s.count
+		<< ", \"p50\": " << s.percentile(50) << ", \"p99\": " << s.percentile(99)
+		<< ", \"p999\": " << s.percentile(99.9) << ", \"max\": " << s.max << "}";
+}
+
+static void output_json(std::ostream& out, const std::vector<bench_result>& results)
+{
+	out << "{\"output_dir\": \"" << optmap["output-dir"].as<std::string>() << "\""
+		<< ", \"sync_policy\": \"" << optmap["sync-policy"].as<std::string>() << "\""
+		<< ", \"directio\": " << (optmap.count("directio") ? "true" : "false")
+		<< ", \"uring\": " << (optmap.count("uring") ? "true" : "false")
+		<< ", \"splice\": " << (optmap.count("splice") ? "true" : "false")
+		<< ", \"results\": [";
+
+	const char *sep = "";
+	for (auto &r : results) {
+		out << sep << "\n  {\"writers\": " << r.c.writers << ", \"depth\": " << r.c.depth
+			<< ", \"frame_size\": " << r.c.frame_size << ", \"layout\": \"" << case_layout(r.c) << "\""
+			<< ", \"ok\": " << (r.ok ? "true" : "false");
+		sep = ",";
+
+		if (!r.ok) {
+			out << ", \"error\": \"" << r.error << "\"}";
+			continue;
+		}
+
+		out << ", \"frames\": " << r.frames << ", \"bytes\": " << r.bytes
+			<< ", \"elapsed\": " << r.elapsed << ", \"gbps\": " << r.gbps
+			<< ", \"stalls\": " << r.stalls;
+		json_latency(out, "frame_ns", r.frame_ns);
+
+		out << ", \"writers_detail\": [";
+		const char *wsep = "";
+		for (auto &w : r.writers) {
+			out << wsep << "{\"name\": \"" << w.name << "\", \"frames\": " << w.frames << ", \"bytes\": " << w.bytes;
+			json_latency(out, "write_ns", w.write_ns);
+			json_latency(out, "fsync_ns", w.fsync_ns);
+			out << "}";
+			wsep = ", ";
+		}
+		out << "]}";
+	}
+	out << "\n]}\n";
+}
+
+static void run()
+{
+	iodme::file_writer::options wrt_opts = iodme::file_writer::default_options;
+	if (optmap.count("directio")) wrt_opts.flags |= iodme::file_writer::DIRECTIO;
+	if (optmap.count("splice"))   wrt_opts.flags |= iodme::file_writer::SPLICE;
+	if (optmap.count("uring"))    wrt_opts.flags |= iodme::file_writer::URING;
+	wrt_opts.segment_size = optmap["segment-size"].as<unsigned int>() * 1024ULL * 1024; // MB to bytes
+
+	std::vector<unsigned int> writers, depths;
+	std::vector<uint32_t> sizes;
+	std::vector<bool> layouts;
+
+	if (!parse_numbers(optmap["writers"].as<std::vector<std::string>>(), writers) ||
+			!parse_numbers(optmap["depth"].as<std::vector<std::string>>(), depths))
+		return;
+
+	for (auto &a : split_list(optmap["frame-size"].as<std::vector<std::string>>())) {
+		size_t sz = parse_size(a);
+		if (!sz || sz > UINT32_MAX) {
+			std::cerr << "invalid frame size " << a << '\n';
+			return;
+		}
+		sizes.push_back(sz);
+	}
+
+	for (auto &a : split_list(optmap["layout"].as<std::vector<std::string>>())) {
+		if (a != "file" && a != "segment") {
+			std::cerr << "unsupported layout " << a << '\n';
+			return;
+		}
+		layouts.push_back(a == "segment");
+	}
+
+	std::string sync_policy = optmap["sync-policy"].as<std::string>();
+	if (sync_policy != "frame" && sync_policy != "range" && sync_policy != "group") {
+		std::cerr << "unsupported sync policy " << sync_policy << '\n';
+		return;
+	}
+
+	std::string format = optmap["format"].as<std::string>();
+	if (format != "text" && format != "json" && format != "csv") {
+		std::cerr << "unsupported results format " << format << '\n';
+		return;
+	}
+
+	std::vector<bench_result> results;
+	for (auto layout : layouts)
+		for (auto sz : sizes)
+			for (auto d : depths)
+				for (auto w : writers) {
+					if (killed)
+						break;
+
+					bench_result r;
+					r.c = { w, d, sz, layout };
+
+					hogl::post(area, area->INFO, "running: writers %u depth %u frame-size %u layout %s",
+							w, d, sz, case_layout(r.c));
+					run_case(r, wrt_opts);
+					results.push_back(r);
+				}
+
+	std::ofstream rfile;
+	if (optmap.count("results")) {
+		rfile.open(optmap["results"].as<std::string>());
+		if (!rfile) {
+			std::cerr << "failed to open results file " << optmap["results"].as<std::string>() << ": " << strerror(errno) << '\n';
+			return;
+		}
+	}
+	std::ostream& out = rfile.is_open() ? rfile : std::cout;
+
+	if (format == "json")
+		output_json(out, results);
+	else if (format == "csv")
+		output_csv(out, results);
+	else
+		output_text(out, results);
+}
+
+static std::vector<std::string> log_mask;
+int main(int argc, char *argv[])
+{
+	// **** Parse command line arguments ****
+	po::options_description optdesc("File writer scaling benchmark");
+	optdesc.add_options()
+		("help", "Print this message")
+		("log-output", po::value<std::string>()->default_value("-"), "Log output file name or - for stderr")
+		("log-format", po::value<std::string>()->default_value("timespec,timedelta,area,section"), "Log output format")
+		("log-mask",   po::value<std::vector<std::string> >(&log_mask)->composing(), "Log mask. Multiple masks can be specified.")
+		("output-dir,D", po::value<std::string>()->default_value("/tmp"), "Directory to write into (files go into iodme-writer-bench sub-directory)")
+		("writers,W",    po::value<std::vector<std::string>>()->composing()->default_value({"1,2,4"}, "1,2,4"), "Number of writer threads (eg 1,2,4,8)")
+		("depth,q",      po::value<std::vector<std::string>>()->composing()->default_value({"4"}, "4"), "Frames in flight per writer, also io_uring depth (eg 2,8)")
+		("frame-size,s", po::value<std::vector<std::string>>()->composing()->default_value({"4M"}, "4M"), "Frame sizes (eg 1M,4M,16M)")
+		("layout,l",     po::value<std::vector<std::string>>()->composing()->default_value({"file"}, "file"), "Output layout: file (file per frame), segment (appended into segments)")
+		("duration,t",   po::value<float>()->default_value(5), "Duration of each case in seconds, 0 - no limit")
+		("frames,n",     po::value<unsigned int>()->default_value(0), "Number of frames per case, 0 - no limit")
+		("segment-size", po::value<unsigned int>()->default_value(1024), "Segment size in MB (segment layout)")
+		("sync-policy",  po::value<std::string>()->default_value("frame"), "How data is made durable: frame (fsync each file), range (sync stage, sync_file_range), group (sync stage, group commit)")
+		("directio",  "Use direct IO")
+		("splice",    "Use vmsplice/splice")
+		("uring",     "Use io_uring")
+		("memfd",     "Use memfd backed buffers (written with sendfile)")
+		("hugepages", "Use huge pages for the buffers")
+		("keep-files", "Don't remove the output files after each case")
+		("format,f",  po::value<std::string>()->default_value("text"), "Results format: text, json, csv")
+		("results,r", po::value<std::string>(), "Write results into this file instead of stdout");
+
+	try {
+		po::store(po::parse_command_line(argc, argv, optdesc), optmap);
+		po::notify(optmap);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+
+	// ** All argument values (including the defaults) are now storred in 'optmap' **
+
+	if (optmap.count("help")) {
+		std::cout << optdesc << std::endl;
+		exit(1);
+	}
+
+	if (!optmap["duration"].as<float>() && !optmap["frames"].as<unsigned int>()) {
+		std::cerr << "need a duration or a frame count" << std::endl;
+		exit(1);
+	}
+
+	catch_signals();
+
+	hogl::format *lf;
+	hogl::output *lo;
+
+	// Results may go to stdout, keep the log out of the way
+	lf = new hogl::format_basic(optmap["log-format"].as<std::string>().c_str());
+	if (optmap["log-output"].as<std::string>() == "-")
+		lo = new hogl::output_stderr(*lf, 64 * 1024);
+	else
+		lo = new hogl::output_plainfile(optmap["log-output"].as<std::string>().c_str(), *lf, 64 * 1024);
+
+	hogl::engine::options eng_opts = hogl::engine::default_options;
+	for (auto &m : log_mask)
+		eng_opts.default_mask << m;
+
+	hogl::activate(*lo, eng_opts);
+
+	// *****
+	// HOGL engine is running now. Avoid exit()ing from the process
+	// without going through hogl shutdown sequence below.
+
+	area = hogl::add_area("IODME-WRITER-BENCH");
+
+	hogl::ringbuf::options ring_opts = { capacity: 1024 * 8, prio: 100, flags: 0, record_tailroom: 128 };
+	hogl::tls *tls = new hogl::tls("MAIN-THREAD", ring_opts);
+
+	run();
+
+	delete tls;
+
+	hogl::deactivate();
+
+	delete lo;
+	delete lf;
+
+	return 0;
+}